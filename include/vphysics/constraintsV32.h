@@ -45,7 +45,8 @@ public:
 	// No other functions on this user constraint will be called afterwards from that constraint.
 	virtual void			ConstraintDestroyed(IPhysicsConstraint *pConstraint) {}
 
-	// WARNING: The following functions may not be called on the main thread! Do not do any non-threadsafe operations here!
+	// NOTE: The following functions are called on the main thread once per simulation tick, before the solver runs.
+	// They are not called if the environment has an IPhysicsUserConstraintBatch handler.
 
 	// Basic constraint info for internal setup
 	virtual void			GetConstraintInfo(IPhysicsObject32 *pObjA, IPhysicsObject32 *pObjB, physconstraintinfo_t &info) = 0;
@@ -55,8 +56,32 @@ public:
 	virtual void			GetConstraintSolveInfo(IPhysicsObject32 *pObjA, IPhysicsObject32 *pObjB, physconstraintsolveinfo_t *info, int numRows, float fps, float erp) = 0;
 };
 
+struct physuserconstraintrows_t {
+	IPhysicsUserConstraint *	pUserConstraint;
+	IPhysicsObject32 *			pObjA;
+	IPhysicsObject32 *			pObjB;
+
+	physconstraintinfo_t		info;	// Filled in by GetConstraintInfoBatch
+	physconstraintsolveinfo_t *	pRows;	// Array of info.numConstraintRows rows (set to defaults), filled in by GetConstraintSolveInfoBatch
+};
+
+// Optional interface to evaluate every user constraint of an environment with a single call,
+// instead of calling each IPhysicsUserConstraint separately.
+// Called on the main thread once per simulation tick, before the solver runs.
+class IPhysicsUserConstraintBatch {
+public:
+	virtual ~IPhysicsUserConstraintBatch() {}
+
+	// Fill in info for every constraint in the array
+	virtual void			GetConstraintInfoBatch(physuserconstraintrows_t *pConstraints, int count) = 0;
+
+	// Fill in the solve info rows for every constraint in the array
+	// FPS - frames per second (1/stepsize), erp - default error reduction parameter (0..1)
+	virtual void			GetConstraintSolveInfoBatch(physuserconstraintrows_t *pConstraints, int count, float fps, float erp) = 0;
+};
+
 struct constraint_gearparams_t {
-	constraint_breakableparams_t	constraint; // TODO: Will be supported in the future
+	constraint_breakableparams_t	constraint;
 	Vector	objectLocalAxes[2]; // Local axis in objects
 	float	ratio; // Gear ratio
 
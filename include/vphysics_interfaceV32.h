@@ -19,14 +19,47 @@ class IPhysicsSoftBody;
 class IPhysicsConstraint;
 class IPhysicsConstraintGroup;
 class IPhysicsUserConstraint;
+class IPhysicsUserConstraintBatch;
 class IPhysicsVehicleController;
 
 struct softbodyparams_t;
 struct constraint_gearparams_t;
 
+// Purpose: Lets vphysics run its worker threads on the engine's thread pool instead of creating its own,
+// so physics and the engine's jobs don't fight over the cores.
+abstract_class IPhysicsThreadProvider {
+	public:
+		// Number of threads physics may keep busy (not counting the thread that simulates)
+		virtual int		GetThreadCount() = 0;
+
+		// Start pfnWorker(pContext) on a pool thread and return right away. The worker keeps the thread
+		// until physics lets go of it (SetThreadProvider with another provider, or shutdown).
+		virtual void	RunOnThread(void (*pfnWorker)(void *pContext), void *pContext) = 0;
+};
+
+// Purpose: State of an object attached to a motion controller, in HL units
+struct motionstate_t {
+	IPhysicsObject *	pObject;
+	Vector				position;			// World space (same as IPhysicsObject::GetPosition)
+	Vector				velocity;			// World space
+	AngularImpulse		angularVelocity;	// Local space (same as IPhysicsObject::GetVelocity)
+};
+
+// Purpose: Batch version of IMotionEvent::Simulate. Called once per tick with every object of the controller.
+abstract_class IMotionEventBatch {
+	public:
+		// For each object write what IMotionEvent::Simulate would return to pResults, and its linear and angular
+		// outputs to pLinear and pAngular. Outputs start out as SIM_NOTHING and zero.
+		virtual void	SimulateBatch(IPhysicsMotionController *pController, const motionstate_t *pStates, int count, float deltaTime, Vector *pLinear, AngularImpulse *pAngular, IMotionEvent::simresult_e *pResults) = 0;
+};
+
 abstract_class IPhysics32 : public IPhysics {
 	public:
 		virtual int		GetActiveEnvironmentCount() = 0;
+
+		// Run physics worker threads on this provider (NULL to use our own threads). Call from the main thread
+		// while no environment is simulating. All threads are released again before this returns.
+		virtual void	SetThreadProvider(IPhysicsThreadProvider *pProvider) = 0;
 };
 
 abstract_class IPhysicsEnvironment32 : public IPhysicsEnvironment {
@@ -46,6 +79,25 @@ abstract_class IPhysicsEnvironment32 : public IPhysicsEnvironment {
 		virtual void	SweepConvex(const CPhysConvex *pConvex, const Vector &vecAbsStart, const Vector &vecAbsEnd, const QAngle &vecAngles, unsigned int fMask, IPhysicsTraceFilter *pTraceFilter, trace_t *pTrace) = 0;
 
 		virtual int		GetObjectCount() const = 0;
+
+		// Evaluate all user constraints of this environment with one call per tick (NULL to call each user constraint separately)
+		virtual void	SetUserConstraintBatchHandler(IPhysicsUserConstraintBatch *pHandler) = 0;
+
+		// Constraints that broke (exceeded their constraint_breakableparams_t limits) during the last Simulate call.
+		// Broken constraints are deactivated, not destroyed. Returns the number of constraints written to the list.
+		virtual int		GetBrokenConstraintCount() const = 0;
+		virtual int		GetBrokenConstraints(IPhysicsConstraint **pOutputConstraintList, int maxCount) const = 0;
+
+		// Simulation LOD: objects far away from all of these positions are simulated at a reduced rate, or frozen.
+		// Call this whenever the viewers move (usually once per frame with the player positions). Pass 0 viewers to simulate everything at full rate.
+		virtual void	SetSimulationViewers(const Vector *pPositions, int count) = 0;
+
+		// Same as calling IPhysicsShadowController::Update on each controller, in one call. Controllers may be NULL.
+		virtual void	UpdateShadowControllers(IPhysicsShadowController **pControllers, const Vector *pPositions, const QAngle *pAngles, const float *pTimeOffsets, int count) = 0;
+
+		// Simulate all objects of a motion controller with one call per tick instead of one IMotionEvent::Simulate
+		// call per object (NULL to go back to the controller's IMotionEvent)
+		virtual void	SetMotionEventBatchHandler(IPhysicsMotionController *pController, IMotionEventBatch *pHandler) = 0;
 };
 
 abstract_class IPhysicsObject32 : public IPhysicsObject {
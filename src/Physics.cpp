@@ -6,6 +6,8 @@
 #include "Physics_Environment.h"
 #include "Physics_ObjectPairHash.h"
 #include "Physics_CollisionSet.h"
+#include "Physics_TaskScheduler.h"
+#include "Physics_Allocator.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -39,6 +41,9 @@ InitReturnVal_t CPhysics::Init() {
 	const InitReturnVal_t nRetVal = BaseClass::Init();
 	if (nRetVal != INIT_OK) return nRetVal;
 
+	// Before anything allocates through Bullet
+	InstallBulletAllocator();
+
 	// Hook up our debug output functions
 	btSetDbgMsgFn(btDebugMessage);
 	btSetDbgWarnFn(btDebugWarning);
@@ -47,6 +52,10 @@ InitReturnVal_t CPhysics::Init() {
 }
 
 void CPhysics::Shutdown() {
+#ifdef BT_THREADSAFE
+	ShutdownPhysicsTaskScheduler();
+#endif
+
 	BaseClass::Shutdown();
 }
 
@@ -78,6 +87,12 @@ int CPhysics::GetActiveEnvironmentCount() {
 	return m_envList.Count();
 }
 
+void CPhysics::SetThreadProvider(IPhysicsThreadProvider *pProvider) {
+#ifdef BT_THREADSAFE
+	GetPhysicsTaskScheduler()->SetThreadProvider(pProvider);
+#endif
+}
+
 IPhysicsObjectPairHash *CPhysics::CreateObjectPairHash() {
 	return new CPhysicsObjectPairHash();
 }
@@ -22,6 +22,7 @@ class CPhysics : public CTier1AppSystem<IPhysics32> {
 		void						DestroyEnvironment(IPhysicsEnvironment *pEnv);
 		IPhysicsEnvironment *		GetActiveEnvironmentByIndex(int index);
 		int							GetActiveEnvironmentCount();
+		void						SetThreadProvider(IPhysicsThreadProvider *pProvider);
 
 		IPhysicsObjectPairHash *	CreateObjectPairHash();
 		void						DestroyObjectPairHash(IPhysicsObjectPairHash *pHash);
@@ -0,0 +1,424 @@
+#include "StdAfx.h"
+
+#include <atomic>
+#include <new>
+#include <tier0/threadtools.h>
+#include <tier0/icommandline.h>
+
+#include "Physics_Allocator.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define ALLOC_HEADER_SIZE	16			// In front of every block, keeps the blocks 16 byte aligned
+#define ALLOC_MAGIC			0xB7A1
+
+#define POOL_NUM_CLASSES	17
+#define POOL_SMALL_CLASSES	12			// Always pooled, the others only once they outlived a step
+#define POOL_MAX_SIZE		2048		// Biggest always pooled block
+#define POOL_CHUNK_SIZE		(64 * 1024)	// Pools grow by this much (at least)
+#define POOL_BATCH_SIZE		32			// Blocks moved between a thread cache and the shared pool at once (at most)
+
+#define ARENA_CHUNK_SIZE	(256 * 1024)
+#define ARENA_MAX_SIZE		(ARENA_CHUNK_SIZE / 4)	// Bigger blocks go to the heap
+#define ARENA_RETIRED		0x40000000	// Chunk state bit, no arena allocates from the chunk anymore
+
+static const int s_poolClassSizes[POOL_NUM_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 1024, POOL_MAX_SIZE,
+	4096, 8192, 16384, 32768, ARENA_MAX_SIZE};
+
+enum blockkind_t {
+	BLOCK_POOL = 0,
+	BLOCK_ARENA,
+	BLOCK_HEAP,
+};
+
+struct blockheader_t {
+	void *			pOwner;		// Arena chunk, or the heap allocation
+	unsigned short	magic;
+	unsigned char	kind;
+	unsigned char	sizeClass;
+	unsigned int	frame;		// Step an arena block was allocated in
+};
+COMPILE_TIME_ASSERT(sizeof(blockheader_t) <= ALLOC_HEADER_SIZE);
+
+struct freeblock_t {
+	freeblock_t *	pNext;
+};
+
+struct arenachunk_t {
+	std::atomic<int>	state;		// Live blocks, plus ARENA_RETIRED
+	int					offset;		// Next free byte, only touched by the arena allocating from it
+	arenachunk_t *		pNext;		// In the free chunk list
+};
+
+#define ARENA_DATA_OFFSET	((sizeof(arenachunk_t) + 15) & ~15)
+
+// Pool cache and frame arena of a thread
+struct threadcache_t {
+	freeblock_t *		pFree[POOL_NUM_CLASSES];
+	int					count[POOL_NUM_CLASSES];
+	arenachunk_t *		pArena;
+	int					poolAllocs;
+	int					arenaAllocs;
+	threadcache_t *		pPrev;		// All caches, for the stats
+	threadcache_t *		pNext;
+};
+
+static bool						s_bInstalled = false;
+static CThreadLocalPtr<threadcache_t> s_threadCache;
+static CThreadFastMutex			s_cacheMutex;
+static threadcache_t *			s_pCaches = NULL;
+static int						s_releasedPoolAllocs = 0;	// Counts of the caches released so far
+static int						s_releasedArenaAllocs = 0;
+
+static CThreadFastMutex			s_poolMutex[POOL_NUM_CLASSES];
+static freeblock_t *			s_pPoolFree[POOL_NUM_CLASSES];
+static std::atomic<bool>		s_bOutlivesStep[POOL_NUM_CLASSES];	// Seen an arena block of this size outlive its step
+
+static CThreadFastMutex			s_arenaMutex;
+static arenachunk_t *			s_pFreeChunks = NULL;
+
+static std::atomic<int>			s_frameDepth(0);
+static unsigned int				s_frame = 0;
+static std::atomic<int>			s_heapAllocs(0);
+static std::atomic<int>			s_heapFrees(0);
+static std::atomic<int>			s_arenaChunks(0);
+static int						s_frameHeapAllocs = 0;	// s_heapAllocs when the step started
+static int						s_lastStepHeapAllocs = 0;
+
+static inline blockheader_t *GetHeader(void *ptr) {
+	return (blockheader_t *)((char *)ptr - ALLOC_HEADER_SIZE);
+}
+
+static inline void SetHeader(void *ptr, blockkind_t kind, void *pOwner, int sizeClass) {
+	blockheader_t *pHeader = GetHeader(ptr);
+	pHeader->pOwner = pOwner;
+	pHeader->magic = ALLOC_MAGIC;
+	pHeader->kind = kind;
+	pHeader->sizeClass = sizeClass;
+	pHeader->frame = s_frame;
+}
+
+static void *SystemAlloc(size_t size, size_t alignment) {
+	s_heapAllocs++;
+	return MemAlloc_AllocAligned(size, alignment);
+}
+
+static void SystemFree(void *ptr) {
+	s_heapFrees++;
+	MemAlloc_FreeAligned(ptr);
+}
+
+static threadcache_t *GetThreadCache() {
+	threadcache_t *pCache = s_threadCache;
+	if (pCache)
+		return pCache;
+
+	pCache = (threadcache_t *)SystemAlloc(sizeof(threadcache_t), 16);
+	memset(pCache, 0, sizeof(threadcache_t));
+	s_threadCache = pCache;
+
+	AUTO_LOCK(s_cacheMutex);
+	pCache->pNext = s_pCaches;
+	if (s_pCaches)
+		s_pCaches->pPrev = pCache;
+	s_pCaches = pCache;
+	return pCache;
+}
+
+/*******************************
+* Size class pools
+*******************************/
+
+static int GetSizeClass(size_t size) {
+	for (int i = 0; i < POOL_NUM_CLASSES; i++) {
+		if (size <= (size_t)s_poolClassSizes[i])
+			return i;
+	}
+
+	return -1;
+}
+
+// Big blocks move a few at a time, a thread cache shouldn't sit on megabytes
+static inline int GetBatchSize(int sizeClass) {
+	return clamp(POOL_CHUNK_SIZE / s_poolClassSizes[sizeClass], 1, POOL_BATCH_SIZE);
+}
+
+// Shared pool lock must be held
+static void GrowPool(int sizeClass) {
+	const int blockSize = ALLOC_HEADER_SIZE + s_poolClassSizes[sizeClass];
+	const int chunkSize = max(POOL_CHUNK_SIZE, 4 * blockSize);
+	char *pChunk = (char *)SystemAlloc(chunkSize, 16);
+
+	for (int offset = 0; offset + blockSize <= chunkSize; offset += blockSize) {
+		freeblock_t *pBlock = (freeblock_t *)(pChunk + offset + ALLOC_HEADER_SIZE);
+		SetHeader(pBlock, BLOCK_POOL, NULL, sizeClass);
+		pBlock->pNext = s_pPoolFree[sizeClass];
+		s_pPoolFree[sizeClass] = pBlock;
+	}
+}
+
+static void *PoolAlloc(int sizeClass) {
+	threadcache_t *pCache = GetThreadCache();
+	if (!pCache->pFree[sizeClass]) {
+		AUTO_LOCK(s_poolMutex[sizeClass]);
+		if (!s_pPoolFree[sizeClass])
+			GrowPool(sizeClass);
+
+		const int batchSize = GetBatchSize(sizeClass);
+		for (int i = 0; i < batchSize && s_pPoolFree[sizeClass]; i++) {
+			freeblock_t *pBlock = s_pPoolFree[sizeClass];
+			s_pPoolFree[sizeClass] = pBlock->pNext;
+			pBlock->pNext = pCache->pFree[sizeClass];
+			pCache->pFree[sizeClass] = pBlock;
+			pCache->count[sizeClass]++;
+		}
+	}
+
+	freeblock_t *pBlock = pCache->pFree[sizeClass];
+	pCache->pFree[sizeClass] = pBlock->pNext;
+	pCache->count[sizeClass]--;
+	pCache->poolAllocs++;
+	return pBlock;
+}
+
+static void PoolFree(void *ptr, int sizeClass) {
+	threadcache_t *pCache = GetThreadCache();
+	freeblock_t *pBlock = (freeblock_t *)ptr;
+	pBlock->pNext = pCache->pFree[sizeClass];
+	pCache->pFree[sizeClass] = pBlock;
+	pCache->count[sizeClass]++;
+
+	// Don't let a thread that frees more than it allocates hoard the blocks
+	const int batchSize = GetBatchSize(sizeClass);
+	if (pCache->count[sizeClass] > 2 * batchSize) {
+		AUTO_LOCK(s_poolMutex[sizeClass]);
+		for (int i = 0; i < batchSize; i++) {
+			pBlock = pCache->pFree[sizeClass];
+			pCache->pFree[sizeClass] = pBlock->pNext;
+			pBlock->pNext = s_pPoolFree[sizeClass];
+			s_pPoolFree[sizeClass] = pBlock;
+		}
+
+		pCache->count[sizeClass] -= batchSize;
+	}
+}
+
+/*******************************
+* Frame arenas
+*******************************/
+
+static void PushFreeChunk(arenachunk_t *pChunk) {
+	AUTO_LOCK(s_arenaMutex);
+	pChunk->pNext = s_pFreeChunks;
+	s_pFreeChunks = pChunk;
+}
+
+static arenachunk_t *PopFreeChunk() {
+	arenachunk_t *pChunk = NULL;
+	{
+		AUTO_LOCK(s_arenaMutex);
+		pChunk = s_pFreeChunks;
+		if (pChunk)
+			s_pFreeChunks = pChunk->pNext;
+	}
+
+	if (!pChunk) {
+		pChunk = (arenachunk_t *)SystemAlloc(ARENA_CHUNK_SIZE, 16);
+		new (&pChunk->state) std::atomic<int>(0);
+		s_arenaChunks++;
+	}
+
+	pChunk->state.store(0);
+	pChunk->offset = ARENA_DATA_OFFSET;
+	pChunk->pNext = NULL;
+	return pChunk;
+}
+
+// The arena is done with the chunk, it's freed once its last block is
+static void RetireChunk(arenachunk_t *pChunk) {
+	if (pChunk->state.fetch_or(ARENA_RETIRED) == 0)
+		PushFreeChunk(pChunk);
+}
+
+static void *ArenaAlloc(size_t size, int sizeClass) {
+	threadcache_t *pCache = GetThreadCache();
+	const int needed = ALLOC_HEADER_SIZE + (int)((size + 15) & ~15);
+
+	arenachunk_t *pChunk = pCache->pArena;
+	if (pChunk) {
+		// Everything allocated from it so far was freed, start over
+		if (pChunk->state.load() == 0)
+			pChunk->offset = ARENA_DATA_OFFSET;
+
+		if (pChunk->offset + needed > ARENA_CHUNK_SIZE) {
+			RetireChunk(pChunk);
+			pChunk = NULL;
+		}
+	}
+
+	if (!pChunk) {
+		pChunk = PopFreeChunk();
+		pCache->pArena = pChunk;
+	}
+
+	void *ptr = (char *)pChunk + pChunk->offset + ALLOC_HEADER_SIZE;
+	pChunk->offset += needed;
+	pChunk->state++;
+	pCache->arenaAllocs++;
+
+	SetHeader(ptr, BLOCK_ARENA, pChunk, sizeClass);
+	return ptr;
+}
+
+static void ArenaFree(const blockheader_t *pHeader) {
+	// A block that outlives its step keeps its whole chunk alive, later blocks of its size come from the pools
+	if (s_frameDepth == 0 || pHeader->frame != s_frame)
+		s_bOutlivesStep[pHeader->sizeClass] = true;
+
+	arenachunk_t *pChunk = (arenachunk_t *)pHeader->pOwner;
+	if (--pChunk->state == ARENA_RETIRED)
+		PushFreeChunk(pChunk);
+}
+
+/*******************************
+* Bullet hooks
+*******************************/
+
+static void *BulletAlloc(size_t size, int alignment) {
+	if (alignment <= 16) {
+		const int sizeClass = GetSizeClass(size);
+		if (sizeClass != -1 && sizeClass < POOL_SMALL_CLASSES)
+			return PoolAlloc(sizeClass);
+
+		if (sizeClass != -1 && s_frameDepth > 0)
+			return s_bOutlivesStep[sizeClass] ? PoolAlloc(sizeClass) : ArenaAlloc(size, sizeClass);
+	}
+
+	// Big or overaligned block, the header goes in the alignment padding
+	const size_t padding = max(alignment, ALLOC_HEADER_SIZE);
+	char *pBase = (char *)SystemAlloc(size + padding, padding);
+	void *ptr = pBase + padding;
+	SetHeader(ptr, BLOCK_HEAP, pBase, 0);
+	return ptr;
+}
+
+static void BulletFree(void *ptr) {
+	if (!ptr) return;
+
+	const blockheader_t *pHeader = GetHeader(ptr);
+	Assert(pHeader->magic == ALLOC_MAGIC);
+
+	switch (pHeader->kind) {
+		case BLOCK_POOL:
+			PoolFree(ptr, pHeader->sizeClass);
+			break;
+		case BLOCK_ARENA:
+			ArenaFree(pHeader);
+			break;
+		case BLOCK_HEAP:
+			SystemFree(pHeader->pOwner);
+			break;
+	}
+}
+
+void InstallBulletAllocator() {
+	if (s_bInstalled)
+		return;
+
+	if (CommandLine()->CheckParm("-bt_defaultallocator"))
+		return;
+
+	btAlignedAllocSetCustomAligned(BulletAlloc, BulletFree);
+	s_bInstalled = true;
+}
+
+void BeginAllocatorFrame() {
+	if (s_frameDepth == 0) {
+		s_frame++;
+		s_frameHeapAllocs = s_heapAllocs;
+	}
+
+	s_frameDepth++;
+}
+
+void EndAllocatorFrame() {
+	if (--s_frameDepth == 0)
+		s_lastStepHeapAllocs = s_heapAllocs - s_frameHeapAllocs;
+}
+
+void ReleaseAllocatorThreadCache() {
+	threadcache_t *pCache = s_threadCache;
+	if (!pCache) return;
+
+	s_threadCache = NULL;
+
+	for (int i = 0; i < POOL_NUM_CLASSES; i++) {
+		if (!pCache->pFree[i])
+			continue;
+
+		AUTO_LOCK(s_poolMutex[i]);
+		while (pCache->pFree[i]) {
+			freeblock_t *pBlock = pCache->pFree[i];
+			pCache->pFree[i] = pBlock->pNext;
+			pBlock->pNext = s_pPoolFree[i];
+			s_pPoolFree[i] = pBlock;
+		}
+	}
+
+	// Blocks still in it free it later
+	if (pCache->pArena)
+		RetireChunk(pCache->pArena);
+
+	{
+		AUTO_LOCK(s_cacheMutex);
+		s_releasedPoolAllocs += pCache->poolAllocs;
+		s_releasedArenaAllocs += pCache->arenaAllocs;
+
+		if (pCache->pPrev)
+			pCache->pPrev->pNext = pCache->pNext;
+		else
+			s_pCaches = pCache->pNext;
+
+		if (pCache->pNext)
+			pCache->pNext->pPrev = pCache->pPrev;
+	}
+
+	SystemFree(pCache);
+}
+
+void GetAllocatorStats(allocatorstats_t *pOutput) {
+	if (!pOutput) return;
+
+	memset(pOutput, 0, sizeof(allocatorstats_t));
+	pOutput->heapAllocs = s_heapAllocs;
+	pOutput->heapFrees = s_heapFrees;
+	pOutput->arenaChunks = s_arenaChunks;
+	pOutput->lastStepHeapAllocs = s_lastStepHeapAllocs;
+
+	// Other threads may still be counting, this is only exact while nothing is simulating
+	AUTO_LOCK(s_cacheMutex);
+	pOutput->poolAllocs = s_releasedPoolAllocs;
+	pOutput->arenaAllocs = s_releasedArenaAllocs;
+	for (threadcache_t *pCache = s_pCaches; pCache; pCache = pCache->pNext) {
+		pOutput->poolAllocs += pCache->poolAllocs;
+		pOutput->arenaAllocs += pCache->arenaAllocs;
+	}
+}
+
+void AllocatorStats_f(const CCommand &args) {
+	if (!s_bInstalled) {
+		Msg("Bullet is using the default allocator (-bt_defaultallocator)\n");
+		return;
+	}
+
+	allocatorstats_t stats;
+	GetAllocatorStats(&stats);
+
+	Msg("Bullet allocator stats:\n");
+	Msg("  heap calls: %d allocs, %d frees (%d during the last simulation step)\n", stats.heapAllocs, stats.heapFrees, stats.lastStepHeapAllocs);
+	Msg("  pool blocks handed out: %d\n", stats.poolAllocs);
+	Msg("  arena blocks handed out: %d (%d chunks of %d KB)\n", stats.arenaAllocs, stats.arenaChunks, ARENA_CHUNK_SIZE / 1024);
+}
+
+static ConCommand cmd_allocatorstats("bt_allocator_stats", AllocatorStats_f, "Print how many of Bullet's allocations went to the system heap");
@@ -0,0 +1,40 @@
+#ifndef PHYSICS_ALLOCATOR_H
+#define PHYSICS_ALLOCATOR_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+struct allocatorstats_t {
+	int		heapAllocs;			// Calls to the system heap (pool and arena chunks, big and overaligned blocks)
+	int		heapFrees;
+	int		poolAllocs;			// Blocks handed out by the size class pools
+	int		arenaAllocs;		// Blocks handed out by the frame arenas
+	int		arenaChunks;		// Arena chunks allocated so far
+	int		lastStepHeapAllocs;	// Heap calls during the last simulation step
+};
+
+// Purpose: Allocator behind btAlignedAlloc (and so every Bullet object and array).
+// Small blocks come from size class pools with per thread caches. Bigger blocks allocated during a simulation step
+// come from per thread frame arenas, whose chunks are reused once everything in them is freed. Sizes that were seen
+// outliving their step come from the pools instead, so they don't keep whole arena chunks alive.
+// Only big blocks outside of a step go straight to the system heap, so steady state steps don't touch it.
+
+// Called once before anything allocates through Bullet. Can't be undone, the blocks can't go back to the default allocator.
+void					InstallBulletAllocator();
+
+// Brackets a simulation step
+void					BeginAllocatorFrame();
+void					EndAllocatorFrame();
+
+// Hands the calling thread's cached blocks back to the shared pools. For threads on their way out.
+void					ReleaseAllocatorThreadCache();
+
+void					GetAllocatorStats(allocatorstats_t *pOutput);
+
+class CAllocatorFrame {
+	public:
+		CAllocatorFrame() { BeginAllocatorFrame(); }
+		~CAllocatorFrame() { EndAllocatorFrame(); }
+};
+
+#endif // PHYSICS_ALLOCATOR_H
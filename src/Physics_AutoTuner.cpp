@@ -0,0 +1,241 @@
+#include "StdAfx.h"
+
+#include "Physics_AutoTuner.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cvar_autotune("bt_autotune", "0", FCVAR_REPLICATED, "Tune the dispatcher grain, solver batch sizes and island batching threshold for the current workload while the game runs. Tuned values replace the ConVar values until this is turned off");
+static ConVar cvar_autotune_window("bt_autotune_window", "32", FCVAR_REPLICATED, "Number of simulation steps the auto-tuner measures each setting for", true, 4, true, 1000);
+static ConVar cvar_autotune_margin("bt_autotune_margin", "0.03", FCVAR_REPLICATED, "A change is only kept if it makes its phase at least this much (fraction) faster, filters out timing noise", true, 0, true, 0.5f);
+static ConVar cvar_autotune_retune("bt_autotune_retune", "0.25", FCVAR_REPLICATED, "Once converged, start over when the time per unit of work of a phase moves this much (fraction)", true, 0.05f, true, 10);
+
+#define TUNER_INITIAL_STEP	0.5f	// Relative change of the first trial
+#define TUNER_MIN_STEP		0.05f	// Parameter is settled once its step falls below this
+
+// Only one environment gets to tune the Bullet statics at a time
+static CAutoTuner *s_pSharedOwner = NULL;
+
+/*******************************
+* CLASS CAutoTuner
+*******************************/
+
+CAutoTuner::CAutoTuner() {
+	m_bActive = false;
+	Reset();
+}
+
+CAutoTuner::~CAutoTuner() {
+	if (m_bActive)
+		Stop();
+}
+
+void CAutoTuner::AddParameter(const char *pName, int *pValue, int minValue, int maxValue, tunerphase_t phase, bool shared, const int *pLowerBound, const int *pUpperBound) {
+	parameter_t &param = m_parameters[m_parameters.AddToTail()];
+	param.pName = pName;
+	param.pValue = pValue;
+	param.minValue = minValue;
+	param.maxValue = maxValue;
+	param.pLowerBound = pLowerBound;
+	param.pUpperBound = pUpperBound;
+	param.phase = phase;
+	param.shared = shared;
+	param.userValue = *pValue;
+	param.tunedValue = *pValue;
+	param.step = TUNER_INITIAL_STEP;
+	param.dir = 1;
+	param.tries = 0;
+}
+
+void CAutoTuner::Tick(const phasetimes_t &times) {
+	if (m_parameters.Count() == 0)
+		return;
+
+	if (!cvar_autotune.GetBool()) {
+		if (m_bActive)
+			Stop();
+
+		return;
+	}
+
+	if (!m_bActive)
+		Start();
+	else
+		CheckExternalChanges();
+
+	m_time[TUNER_PHASE_COLLISION] += times.collision;
+	m_work[TUNER_PHASE_COLLISION] += times.pairs;
+	m_time[TUNER_PHASE_SOLVE] += times.solve;
+	m_work[TUNER_PHASE_SOLVE] += times.solverRows;
+	m_windowSteps += times.steps;
+
+	if (m_windowSteps < cvar_autotune_window.GetInt())
+		return;
+
+	const double cost[2] = {GetCost(TUNER_PHASE_COLLISION), GetCost(TUNER_PHASE_SOLVE)};
+
+	m_windowSteps = 0;
+	m_time[0] = m_time[1] = 0;
+	m_work[0] = m_work[1] = 0;
+
+	switch (m_state) {
+		case STATE_BASELINE:
+			m_baseline[0] = cost[0];
+			m_baseline[1] = cost[1];
+			break;
+		case STATE_TRIAL: {
+			parameter_t &param = m_parameters[m_current];
+			if (cost[param.phase] < m_baseline[param.phase] * (1 - cvar_autotune_margin.GetFloat())) {
+				// Keep it and keep going in the same direction
+				DevMsg("Auto-tuner: %s %i -> %i\n", param.pName, m_trialOldValue, *param.pValue);
+				m_baseline[0] = cost[0];
+				m_baseline[1] = cost[1];
+				param.tries = 0;
+				m_settledCount = 0;
+			} else {
+				// Worse (or just noise), try the other direction, then smaller steps
+				*param.pValue = m_trialOldValue;
+				param.tunedValue = m_trialOldValue;
+				param.dir = -param.dir;
+				if (++param.tries >= 2) {
+					param.tries = 0;
+					param.step *= 0.5f;
+					if (param.step < TUNER_MIN_STEP) {
+						param.step = TUNER_INITIAL_STEP;
+						m_settledCount++;
+						NextParameter();
+					}
+				}
+			}
+
+			break;
+		}
+		case STATE_CONVERGED: {
+			// Workload changed enough that the settings may no longer be the best ones
+			const float retune = cvar_autotune_retune.GetFloat();
+			for (int i = 0; i < 2; i++) {
+				if (m_baseline[i] > 0 && fabs(cost[i] - m_baseline[i]) > m_baseline[i] * retune) {
+					DevMsg("Auto-tuner: workload changed, tuning again\n");
+					Reset();
+					break;
+				}
+			}
+
+			return;
+		}
+	}
+
+	// Pick the next trial
+	while (m_settledCount < m_parameters.Count()) {
+		parameter_t &param = m_parameters[m_current];
+		if (CanTune(param) && ApplyTrial(param)) {
+			m_state = STATE_TRIAL;
+			return;
+		}
+
+		m_settledCount++;
+		NextParameter();
+	}
+
+	m_state = STATE_CONVERGED;
+}
+
+void CAutoTuner::Reset() {
+	m_state = STATE_BASELINE;
+	m_current = 0;
+	m_trialOldValue = 0;
+	m_settledCount = 0;
+
+	m_windowSteps = 0;
+	for (int i = 0; i < 2; i++) {
+		m_time[i] = 0;
+		m_work[i] = 0;
+		m_baseline[i] = 0;
+	}
+
+	for (int i = 0; i < m_parameters.Count(); i++) {
+		m_parameters[i].step = TUNER_INITIAL_STEP;
+		m_parameters[i].dir = 1;
+		m_parameters[i].tries = 0;
+	}
+}
+
+void CAutoTuner::Start() {
+	if (!s_pSharedOwner)
+		s_pSharedOwner = this;
+
+	for (int i = 0; i < m_parameters.Count(); i++) {
+		m_parameters[i].userValue = *m_parameters[i].pValue;
+		m_parameters[i].tunedValue = *m_parameters[i].pValue;
+	}
+
+	m_bActive = true;
+	Reset();
+}
+
+void CAutoTuner::Stop() {
+	// Back to the values we started with, unless someone else (a ConVar) changed them since we last did
+	for (int i = 0; i < m_parameters.Count(); i++) {
+		parameter_t &param = m_parameters[i];
+		if (CanTune(param) && *param.pValue == param.tunedValue)
+			*param.pValue = param.userValue;
+	}
+
+	if (s_pSharedOwner == this)
+		s_pSharedOwner = NULL;
+
+	m_bActive = false;
+}
+
+// Values changed behind our back (the user changed a ConVar) become the new starting point
+void CAutoTuner::CheckExternalChanges() {
+	bool changed = false;
+	for (int i = 0; i < m_parameters.Count(); i++) {
+		parameter_t &param = m_parameters[i];
+		if (!CanTune(param) || *param.pValue == param.tunedValue)
+			continue;
+
+		param.userValue = *param.pValue;
+		param.tunedValue = *param.pValue;
+		changed = true;
+	}
+
+	// The measurements (and a running trial) are meaningless now
+	if (changed)
+		Reset();
+}
+
+bool CAutoTuner::CanTune(const parameter_t &param) const {
+	return !param.shared || s_pSharedOwner == this;
+}
+
+bool CAutoTuner::ApplyTrial(parameter_t &param) {
+	const int lo = param.pLowerBound ? max(param.minValue, *param.pLowerBound) : param.minValue;
+	const int hi = param.pUpperBound ? min(param.maxValue, *param.pUpperBound) : param.maxValue;
+	const int value = *param.pValue;
+	const int delta = max(1, (int)(value * param.step));
+
+	// Try the other direction if we're stuck at a bound
+	for (int i = 0; i < 2; i++) {
+		const int newValue = clamp(value + param.dir * delta, lo, hi);
+		if (newValue != value) {
+			m_trialOldValue = value;
+			*param.pValue = newValue;
+			param.tunedValue = newValue;
+			return true;
+		}
+
+		param.dir = -param.dir;
+	}
+
+	return false;
+}
+
+void CAutoTuner::NextParameter() {
+	m_current = (m_current + 1) % m_parameters.Count();
+}
+
+double CAutoTuner::GetCost(tunerphase_t phase) const {
+	// Time per unit of work, so the cost doesn't follow the amount of stuff going on
+	return m_work[phase] > 0 ? m_time[phase] / m_work[phase] : m_time[phase];
+}
@@ -0,0 +1,158 @@
+#ifndef PHYSICS_AUTOTUNER_H
+#define PHYSICS_AUTOTUNER_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+// Purpose: Where the time of a simulation step went (summed over all substeps of a Simulate call)
+struct phasetimes_t {
+	double	collision;	// Broadphase + narrowphase (seconds)
+	double	solve;		// Constraint solver, including island generation
+	double	step;		// Whole internal step (including controllers and game callbacks)
+	int		steps;		// Internal steps taken
+	int		pairs;		// Overlapping pairs handed to the narrowphase
+	int		solverRows;	// Manifolds + constraints of awake islands handed to the solver
+};
+
+class CPhaseTimer {
+	public:
+		CPhaseTimer() { ClearPhaseTimes(); }
+		virtual ~CPhaseTimer() {}
+
+		void					ClearPhaseTimes() { memset(&m_phaseTimes, 0, sizeof(m_phaseTimes)); }
+		const phasetimes_t &	GetPhaseTimes() const { return m_phaseTimes; }
+
+	protected:
+		phasetimes_t			m_phaseTimes;
+};
+
+// Purpose: Dynamics world that measures its step phases
+template <class T>
+class CTimedDynamicsWorld : public T, public CPhaseTimer {
+	public:
+		template <class A, class B, class C, class D>
+		CTimedDynamicsWorld(A a, B b, C c, D d) : T(a, b, c, d) {}
+
+		template <class A, class B, class C, class D, class E>
+		CTimedDynamicsWorld(A a, B b, C c, D d, E e) : T(a, b, c, d, e) {}
+
+		void performDiscreteCollisionDetection() override {
+			const double start = Plat_FloatTime();
+			T::performDiscreteCollisionDetection();
+			m_phaseTimes.collision += Plat_FloatTime() - start;
+			m_phaseTimes.pairs += this->getBroadphase()->getOverlappingPairCache()->getNumOverlappingPairs();
+		}
+
+	protected:
+		void solveConstraints(btContactSolverInfo &solverInfo) override {
+			const double start = Plat_FloatTime();
+			T::solveConstraints(solverInfo);
+			m_phaseTimes.solve += Plat_FloatTime() - start;
+			m_phaseTimes.solverRows += CountSolverRows();
+		}
+
+		// Manifolds and constraints of awake islands, the same ones the island manager handed to the solver.
+		// Sleeping pairs are skipped so a mostly asleep map doesn't water down the time per row.
+		int CountSolverRows() {
+			int rows = 0;
+
+			btDispatcher *pDispatcher = this->getDispatcher();
+			btPersistentManifold **ppManifolds = pDispatcher->getInternalManifoldPointer();
+			for (int i = 0; i < pDispatcher->getNumManifolds(); i++) {
+				const btCollisionObject *pObj0 = ppManifolds[i]->getBody0();
+				const btCollisionObject *pObj1 = ppManifolds[i]->getBody1();
+				if ((IsAwake(pObj0) || IsAwake(pObj1)) && pDispatcher->needsResponse(pObj0, pObj1))
+					rows++;
+			}
+
+			for (int i = 0; i < this->getNumConstraints(); i++) {
+				const btTypedConstraint *pConstraint = this->getConstraint(i);
+				if (pConstraint->isEnabled() && (IsAwake(&pConstraint->getRigidBodyA()) || IsAwake(&pConstraint->getRigidBodyB())))
+					rows++;
+			}
+
+			return rows;
+		}
+
+		static bool IsAwake(const btCollisionObject *pObject) {
+			// Static bodies aren't part of any island
+			return pObject->getIslandTag() >= 0 && pObject->getActivationState() != ISLAND_SLEEPING;
+		}
+
+		void internalSingleStepSimulation(btScalar timeStep) override {
+			const double start = Plat_FloatTime();
+			T::internalSingleStepSimulation(timeStep);
+			m_phaseTimes.step += Plat_FloatTime() - start;
+			m_phaseTimes.steps++;
+		}
+};
+
+enum tunerphase_t {
+	TUNER_PHASE_COLLISION = 0,
+	TUNER_PHASE_SOLVE,
+};
+
+// Purpose: Opt-in (bt_autotune) hill climber for the threading parameters of an environment.
+// Tweaks one parameter at a time, keeps the change if the time per unit of work of the phase it affects
+// went down, and shrinks its step size once neither direction helps. Starts over when the workload changes.
+class CAutoTuner {
+	public:
+		CAutoTuner();
+		~CAutoTuner();
+
+		// pValue must stay valid for the lifetime of the tuner. Shared parameters (Bullet statics) are
+		// only tuned by one environment at a time. pLowerBound/pUpperBound optionally tie the range to another value.
+		void						AddParameter(const char *pName, int *pValue, int minValue, int maxValue, tunerphase_t phase, bool shared, const int *pLowerBound = NULL, const int *pUpperBound = NULL);
+
+		// Called after each Simulate call that took at least one step
+		void						Tick(const phasetimes_t &times);
+
+		// Measurements are no longer comparable (e.g. thread count changed)
+		void						Reset();
+
+	private:
+		struct parameter_t {
+			const char *	pName;
+			int *			pValue;
+			int				minValue;
+			int				maxValue;
+			const int *		pLowerBound;
+			const int *		pUpperBound;
+			tunerphase_t	phase;
+			bool			shared;
+			int				userValue;	// Value before tuning started
+			int				tunedValue;	// Last value we set
+			float			step;		// Relative step size
+			int				dir;		// +1 or -1
+			int				tries;		// Directions tried at this step size
+		};
+
+		enum state_t {
+			STATE_BASELINE = 0,	// Measuring the current settings
+			STATE_TRIAL,		// Measuring a changed parameter
+			STATE_CONVERGED,	// Watching for workload changes
+		};
+
+		void						Start();
+		void						Stop();
+		void						CheckExternalChanges();
+		bool						CanTune(const parameter_t &param) const;
+		bool						ApplyTrial(parameter_t &param);
+		void						NextParameter();
+		double						GetCost(tunerphase_t phase) const;
+
+		CUtlVector<parameter_t>		m_parameters;
+		bool						m_bActive;
+		state_t						m_state;
+		int							m_current;		// Parameter being tuned
+		int							m_trialOldValue;
+		int							m_settledCount;	// Parameters in a row that couldn't be improved
+
+		// Measurement window
+		int							m_windowSteps;
+		double						m_time[2];		// Per phase
+		double						m_work[2];
+		double						m_baseline[2];	// Cost per unit of work of the accepted settings
+};
+
+#endif // PHYSICS_AUTOTUNER_H
@@ -5,6 +5,7 @@
 
 #include "BulletCollision/CollisionDispatch/btInternalEdgeUtility.h"
 #include "LinearMath/btConvexHull.h"
+#include "LinearMath/btConvexHullComputer.h"
 
 #include "Physics_Collision.h"
 #include "Physics_Object.h"
@@ -183,6 +184,242 @@ CPhysCollide::CPhysCollide(btCollisionShape *pShape) {
 	m_pShape->setUserPointer(this);
 
 	m_massCenter.setZero();
+
+	m_orthoAreas.setValue(1, 1, 1);
+	m_bOrthoAreasComputed = false;
+	m_bOrthoAreasSet = false;
+
+	m_trianglePackVolume = 0;
+	m_bTrianglePacksBuilt = false;
+}
+
+#define ORTHO_SUPPORT_DIRECTIONS	32	// Directions sampled for the outline of each convex piece
+#define ORTHO_GRID_SIZE				32	// Resolution of the coverage grid on each AABB face
+
+// Outline of a convex piece projected along axis, counter clockwise in the (axis + 1, axis + 2) plane
+static void ProjectConvexOutline(const btConvexShape *pShape, const btTransform &trans, int axis, btVector3 *pOutline) {
+	const int u = (axis + 1) % 3;
+	const int v = (axis + 2) % 3;
+
+	for (int i = 0; i < ORTHO_SUPPORT_DIRECTIONS; i++) {
+		const btScalar angle = SIMD_2_PI * i / ORTHO_SUPPORT_DIRECTIONS;
+
+		btVector3 dir(0, 0, 0);
+		dir[u] = btCos(angle);
+		dir[v] = btSin(angle);
+
+		const btVector3 support = trans(pShape->localGetSupportingVertex(dir * trans.getBasis()));
+		pOutline[i].setValue(support[u], support[v], 0);
+	}
+}
+
+static bool IsInsideOutline(const btVector3 *pOutline, btScalar x, btScalar y) {
+	for (int i = 0; i < ORTHO_SUPPORT_DIRECTIONS; i++) {
+		const btVector3 &a = pOutline[i];
+		const btVector3 &b = pOutline[(i + 1) % ORTHO_SUPPORT_DIRECTIONS];
+
+		if ((b.x() - a.x()) * (y - a.y()) - (b.y() - a.y()) * (x - a.x()) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Rasterizes the union of the projections of all convex pieces onto each AABB face
+static bool ComputeOrthographicAreas(const btCollisionShape *pShape, btVector3 &areas) {
+	CUtlVector<const btConvexShape *> pieces;
+	btAlignedObjectArray<btTransform> transforms;
+
+	if (pShape->isCompound()) {
+		const btCompoundShape *pCompound = (const btCompoundShape *)pShape;
+		for (int i = 0; i < pCompound->getNumChildShapes(); i++) {
+			if (!pCompound->getChildShape(i)->isConvex())
+				return false;
+
+			pieces.AddToTail((const btConvexShape *)pCompound->getChildShape(i));
+			transforms.push_back(pCompound->getChildTransform(i));
+		}
+	} else if (pShape->isConvex()) {
+		pieces.AddToTail((const btConvexShape *)pShape);
+		transforms.push_back(btTransform::getIdentity());
+	}
+
+	if (pieces.Count() == 0)
+		return false;
+
+	btVector3 mins, maxs;
+	pShape->getAabb(btTransform::getIdentity(), mins, maxs);
+
+	btVector3 outline[ORTHO_SUPPORT_DIRECTIONS];
+	bool covered[ORTHO_GRID_SIZE * ORTHO_GRID_SIZE];
+
+	for (int axis = 0; axis < 3; axis++) {
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+		const btScalar cellU = (maxs[u] - mins[u]) / ORTHO_GRID_SIZE;
+		const btScalar cellV = (maxs[v] - mins[v]) / ORTHO_GRID_SIZE;
+
+		if (cellU <= 0 || cellV <= 0) {
+			areas[axis] = 1;
+			continue;
+		}
+
+		memset(covered, 0, sizeof(covered));
+		for (int p = 0; p < pieces.Count(); p++) {
+			ProjectConvexOutline(pieces[p], transforms[p], axis, outline);
+
+			// Only test the cells under the outline's bounds
+			btScalar minU = outline[0].x(), maxU = minU, minV = outline[0].y(), maxV = minV;
+			for (int i = 1; i < ORTHO_SUPPORT_DIRECTIONS; i++) {
+				minU = btMin(minU, outline[i].x()); maxU = btMax(maxU, outline[i].x());
+				minV = btMin(minV, outline[i].y()); maxV = btMax(maxV, outline[i].y());
+			}
+
+			const int u0 = clamp((int)((minU - mins[u]) / cellU), 0, ORTHO_GRID_SIZE - 1);
+			const int u1 = clamp((int)((maxU - mins[u]) / cellU), 0, ORTHO_GRID_SIZE - 1);
+			const int v0 = clamp((int)((minV - mins[v]) / cellV), 0, ORTHO_GRID_SIZE - 1);
+			const int v1 = clamp((int)((maxV - mins[v]) / cellV), 0, ORTHO_GRID_SIZE - 1);
+
+			for (int j = v0; j <= v1; j++) {
+				for (int i = u0; i <= u1; i++) {
+					bool &cell = covered[j * ORTHO_GRID_SIZE + i];
+					if (!cell)
+						cell = IsInsideOutline(outline, mins[u] + (i + 0.5f) * cellU, mins[v] + (j + 0.5f) * cellV);
+				}
+			}
+		}
+
+		int numCovered = 0;
+		for (int i = 0; i < ORTHO_GRID_SIZE * ORTHO_GRID_SIZE; i++)
+			numCovered += covered[i] ? 1 : 0;
+
+		areas[axis] = (btScalar)numCovered / (ORTHO_GRID_SIZE * ORTHO_GRID_SIZE);
+	}
+
+	return true;
+}
+
+const btVector3 &CPhysCollide::GetOrthographicAreas() const {
+	if (!m_bOrthoAreasComputed) {
+		if (!ComputeOrthographicAreas(m_pShape, m_orthoAreas))
+			m_orthoAreas.setValue(1, 1, 1);
+
+		m_bOrthoAreasComputed = true;
+	}
+
+	return m_orthoAreas;
+}
+
+void CPhysCollide::SetOrthographicAreas(const btVector3 &areas) {
+	m_orthoAreas = areas;
+	m_bOrthoAreasComputed = true;
+	m_bOrthoAreasSet = true;
+}
+
+#define TRIANGLE_SUPPORT_DIRECTIONS	64	// Directions sampled for the hull of non polyhedral convex pieces
+
+// Collects the hull points of a convex piece, in the space of its parent
+static void GetConvexHullPoints(const btConvexShape *pShape, const btTransform &trans, btAlignedObjectArray<btVector3> &points) {
+	if (pShape->isPolyhedral()) {
+		const btPolyhedralConvexShape *pPoly = (const btPolyhedralConvexShape *)pShape;
+		for (int i = 0; i < pPoly->getNumVertices(); i++) {
+			btVector3 vert;
+			pPoly->getVertex(i, vert);
+			points.push_back(trans(vert));
+		}
+
+		return;
+	}
+
+	// Implicit shapes (spheres, cylinders, ...) are sampled along a spiral covering the sphere of directions
+	const btScalar goldenAngle = SIMD_PI * (3 - btSqrt(5));
+	for (int i = 0; i < TRIANGLE_SUPPORT_DIRECTIONS; i++) {
+		const btScalar y = 1 - 2 * (i + btScalar(0.5)) / TRIANGLE_SUPPORT_DIRECTIONS;
+		const btScalar r = btSqrt(1 - y * y);
+		const btVector3 dir(r * btCos(goldenAngle * i), y, r * btSin(goldenAngle * i));
+
+		points.push_back(trans(pShape->localGetSupportingVertex(dir * trans.getBasis())));
+	}
+}
+
+// Triangulates the hull of a convex piece and appends the triangles to the list
+static void AddConvexHullTriangles(const btConvexShape *pShape, const btTransform &trans, btAlignedObjectArray<btVector3> &triangles) {
+	btAlignedObjectArray<btVector3> points;
+	GetConvexHullPoints(pShape, trans, points);
+	if (points.size() < 4)
+		return;
+
+	btConvexHullComputer hull;
+	hull.compute(&points[0].getX(), sizeof(btVector3), points.size(), 0, 0);
+	if (hull.vertices.size() < 4)
+		return;
+
+	btVector3 interior(0, 0, 0);
+	for (int i = 0; i < hull.vertices.size(); i++)
+		interior += hull.vertices[i];
+
+	interior /= btScalar(hull.vertices.size());
+
+	for (int i = 0; i < hull.faces.size(); i++) {
+		const btConvexHullComputer::Edge *pFirst = &hull.edges[hull.faces[i]];
+		const btVector3 &a = hull.vertices[pFirst->getSourceVertex()];
+
+		// Fan out from the first vertex of the face
+		for (const btConvexHullComputer::Edge *pEdge = pFirst->getNextEdgeOfFace(); pEdge->getTargetVertex() != pFirst->getSourceVertex(); pEdge = pEdge->getNextEdgeOfFace()) {
+			const btVector3 &b = hull.vertices[pEdge->getSourceVertex()];
+			const btVector3 &c = hull.vertices[pEdge->getTargetVertex()];
+
+			// Wind them so they face away from the inside
+			const bool flip = (b - a).cross(c - a).dot(a - interior) < 0;
+			triangles.push_back(a);
+			triangles.push_back(flip ? c : b);
+			triangles.push_back(flip ? b : c);
+		}
+	}
+}
+
+const btAlignedObjectArray<trianglepack_t> &CPhysCollide::GetTrianglePacks() const {
+	if (m_bTrianglePacksBuilt)
+		return m_trianglePacks;
+
+	btAlignedObjectArray<btVector3> triangles;
+	if (m_pShape->isCompound()) {
+		const btCompoundShape *pCompound = (const btCompoundShape *)m_pShape;
+		for (int i = 0; i < pCompound->getNumChildShapes(); i++) {
+			if (pCompound->getChildShape(i)->isConvex())
+				AddConvexHullTriangles((const btConvexShape *)pCompound->getChildShape(i), pCompound->getChildTransform(i), triangles);
+		}
+	} else if (m_pShape->isConvex()) {
+		AddConvexHullTriangles((const btConvexShape *)m_pShape, btTransform::getIdentity(), triangles);
+	}
+
+	const int numTriangles = triangles.size() / 3;
+	m_trianglePacks.resize((numTriangles + 3) / 4);
+	m_trianglePackVolume = 0;
+
+	for (int i = 0; i < m_trianglePacks.size(); i++) {
+		trianglepack_t &pack = m_trianglePacks[i];
+		for (int lane = 0; lane < 4; lane++) {
+			const int tri = i * 4 + lane;
+			for (int j = 0; j < 3; j++) {
+				const btVector3 vert = tri < numTriangles ? triangles[tri * 3 + j] : btVector3(0, 0, 0);
+				SubFloat(pack.x[j], lane) = vert.x();
+				SubFloat(pack.y[j], lane) = vert.y();
+				SubFloat(pack.z[j], lane) = vert.z();
+			}
+
+			if (tri < numTriangles)
+				m_trianglePackVolume += triangles[tri * 3].dot(triangles[tri * 3 + 1].cross(triangles[tri * 3 + 2])) / 6;
+		}
+	}
+
+	m_bTrianglePacksBuilt = true;
+	return m_trianglePacks;
+}
+
+btScalar CPhysCollide::GetTrianglePackVolume() const {
+	GetTrianglePacks();
+	return m_trianglePackVolume;
 }
 
 /****************************
@@ -496,6 +733,8 @@ void CPhysicsCollision::AddConvexToCollide(CPhysCollide *pCollide, const CPhysCo
 		}
 
 		pCompound->addChildShape(trans, pShape);
+		pCollide->InvalidateOrthographicAreas();
+		pCollide->InvalidateTrianglePacks();
 	}
 }
 
@@ -508,6 +747,8 @@ void CPhysicsCollision::RemoveConvexFromCollide(CPhysCollide *pCollide, const CP
 
 		// FIXME: Need to recalculate the aabb tree or something
 		pCompound->removeChildShape(pShape);
+		pCollide->InvalidateOrthographicAreas();
+		pCollide->InvalidateTrianglePacks();
 	}
 }
 
@@ -735,14 +976,20 @@ void CPhysicsCollision::CollideSetMassCenter(CPhysCollide *pCollide, const Vecto
 	pCollide->SetMassCenter(bullMassCenter);
 }
 
+// Fractions of the AABB faces (x, y, z) covered by the shape's projection, used for drag
 Vector CPhysicsCollision::CollideGetOrthographicAreas(const CPhysCollide *pCollide) {
-	// What is this?
-	NOT_IMPLEMENTED
-	return Vector(1, 1, 1); // Documentation says we will return 1,1,1 if ortho areas undefined
+	if (!pCollide)
+		return Vector(1, 1, 1); // Documentation says we will return 1,1,1 if ortho areas undefined
+
+	// Not a position, just swap the axes (scaling doesn't change the fractions)
+	const btVector3 &areas = pCollide->GetOrthographicAreas();
+	return Vector(areas.x(), areas.z(), areas.y());
 }
 
 void CPhysicsCollision::CollideSetOrthographicAreas(CPhysCollide *pCollide, const Vector &areas) {
-	NOT_IMPLEMENTED
+	if (!pCollide) return;
+
+	pCollide->SetOrthographicAreas(btVector3(areas.x, areas.z, areas.y));
 }
 
 void CPhysicsCollision::CollideSetScale(CPhysCollide *pCollide, const Vector &scale) {
@@ -757,6 +1004,8 @@ void CPhysicsCollision::CollideSetScale(CPhysCollide *pCollide, const Vector &sc
 		bullScale.setZ(scale.y);
 
 		pCompound->setLocalScaling(bullScale);
+		pCollide->InvalidateOrthographicAreas();
+		pCollide->InvalidateTrianglePacks();
 	}
 }
 
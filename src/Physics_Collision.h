@@ -4,12 +4,21 @@
 	#pragma once
 #endif
 
+#include <mathlib/ssemath.h>
+
 // NOTE: There can only be up to 16 unique collision groups (data type of short)!
 enum ECollisionGroups {
 	COLGROUP_NONE	= 0,
 	COLGROUP_WORLD	= 1<<1,
 };
 
+// Four triangles (one per lane) of the hulls of a collide's convex pieces, in the collide's space
+struct trianglepack_t {
+	fltx4	x[3];	// Of vertex 0, 1 and 2
+	fltx4	y[3];
+	fltx4	z[3];
+};
+
 // Because the old vphysics had to do this.
 struct bboxcache_t {
 	CPhysCollide *	pCollide;
@@ -92,11 +101,40 @@ class CPhysCollide {
 			return m_pShape->isConvex();
 		}
 
+		// Fraction of each AABB face (along the bullet x, y and z axes) that the shape covers when
+		// projected onto it. Computed on first use and cached, (1, 1, 1) for shapes we can't project.
+		const btVector3 &GetOrthographicAreas() const;
+		void SetOrthographicAreas(const btVector3 &areas);
+
+		// Shape changed, throw away computed (not explicitly set) areas
+		void InvalidateOrthographicAreas() {
+			m_bOrthoAreasComputed = m_bOrthoAreasSet;
+		}
+
+		// Outward facing triangles of the hulls of all convex pieces, packed four at a time (unused lanes are
+		// degenerate). Built on first use and cached, empty for shapes without convex pieces.
+		const btAlignedObjectArray<trianglepack_t> &GetTrianglePacks() const;
+
+		// Volume enclosed by the triangle packs
+		btScalar GetTrianglePackVolume() const;
+
+		void InvalidateTrianglePacks() {
+			m_bTrianglePacksBuilt = false;
+		}
+
 	private:
 		btCollisionShape *m_pShape;
 
 		btVector3 m_rotInertia;
 		btVector3 m_massCenter;
+
+		mutable btVector3 m_orthoAreas;
+		mutable bool m_bOrthoAreasComputed;
+		bool m_bOrthoAreasSet;
+
+		mutable btAlignedObjectArray<trianglepack_t> m_trianglePacks;
+		mutable btScalar m_trianglePackVolume;
+		mutable bool m_bTrianglePacksBuilt;
 };
 
 class CPhysicsCollision : public IPhysicsCollision32 {
@@ -0,0 +1,300 @@
+#include "StdAfx.h"
+
+#include <new>
+
+#include "Physics_CollisionPools.h"
+#include "Physics_TaskScheduler.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cvar_collisionpool_trim("bt_collisionpool_trim", "600", FCVAR_REPLICATED, "Give the unused chunks of the manifold and collision algorithm pools back every this many simulation steps (0 to never shrink)", true, 0, false, 0);
+
+#define POOL_HEADER_SIZE		16		// Chunk pointer in front of every element, keeps the elements 16 byte aligned
+#define POOL_BATCH_SIZE			32		// Elements moved between a thread list and the shared list at once
+#define MANIFOLD_CHUNK_SIZE		256		// Elements per chunk
+#define ALGORITHM_CHUNK_SIZE	512
+
+/*******************************
+* CLASS CGrowablePool
+*******************************/
+
+CGrowablePool::CGrowablePool(const char *pName, int elementSize, int chunkElements) {
+	m_pName = pName;
+	m_elementSize = elementSize;
+	m_stride = POOL_HEADER_SIZE + ((elementSize + 15) & ~15);
+	m_chunkElements = chunkElements;
+
+	m_pFree = NULL;
+	m_pChunks = NULL;
+	m_numChunks = 0;
+	memset(m_threadLists, 0, sizeof(m_threadLists));
+
+	m_lockedLive = 0;
+	m_peak = 0;
+	m_recentPeak = 0;
+	m_oversized = 0;
+}
+
+CGrowablePool::~CGrowablePool() {
+	while (m_pChunks) {
+		chunk_t *pChunk = m_pChunks;
+		m_pChunks = pChunk->pNext;
+		pChunk->~chunk_t();
+		btAlignedFree(pChunk);
+	}
+}
+
+CGrowablePool::chunk_t *&CGrowablePool::GetChunk(element_t *pElement) const {
+	return *(chunk_t **)((char *)pElement - POOL_HEADER_SIZE);
+}
+
+// List of the calling thread, NULL if its slot is out of range (the shared list is used under the lock then)
+CGrowablePool::threadlist_t *CGrowablePool::GetThreadList() {
+	const int slot = GetPhysicsThreadSlot();
+	Assert(slot >= 0 && slot < BT_MAX_THREAD_COUNT);
+	return slot >= 0 && slot < BT_MAX_THREAD_COUNT ? &m_threadLists[slot] : NULL;
+}
+
+void *CGrowablePool::Alloc(int size) {
+	threadlist_t *pList = GetThreadList();
+
+	element_t *pElement;
+	if (size > m_elementSize) {
+		// Doesn't fit, the chunk pointer stays NULL
+		m_oversized++;
+		pElement = (element_t *)((char *)btAlignedAlloc(POOL_HEADER_SIZE + size, 16) + POOL_HEADER_SIZE);
+		GetChunk(pElement) = NULL;
+	} else if (!pList) {
+		AUTO_LOCK(m_mutex);
+		if (!m_pFree)
+			Grow();
+
+		pElement = m_pFree;
+		m_pFree = pElement->pNext;
+		GetChunk(pElement)->live++;
+	} else {
+		if (!pList->pFree)
+			Refill(*pList);
+
+		pElement = pList->pFree;
+		pList->pFree = pElement->pNext;
+		pList->count--;
+		GetChunk(pElement)->live++;
+	}
+
+	// Counted per thread so the dispatcher's threads don't all write the same cache line
+	if (pList)
+		pList->live++;
+	else
+		m_lockedLive++;
+
+	return pElement;
+}
+
+void CGrowablePool::Free(void *ptr) {
+	if (!ptr) return;
+
+	threadlist_t *pList = GetThreadList();
+	if (pList)
+		pList->live--;
+	else
+		m_lockedLive--;
+
+	element_t *pElement = (element_t *)ptr;
+	chunk_t *pChunk = GetChunk(pElement);
+	if (!pChunk) {
+		btAlignedFree((char *)ptr - POOL_HEADER_SIZE);
+		return;
+	}
+
+	pChunk->live--;
+
+	if (!pList) {
+		AUTO_LOCK(m_mutex);
+		pElement->pNext = m_pFree;
+		m_pFree = pElement;
+		return;
+	}
+
+	pElement->pNext = pList->pFree;
+	pList->pFree = pElement;
+	pList->count++;
+
+	// Don't let a thread that frees more than it allocates hoard the elements
+	if (pList->count > 2 * POOL_BATCH_SIZE)
+		Spill(*pList);
+}
+
+// Elements are freed by other threads than the ones that allocated them, only the sum means something
+int CGrowablePool::GetLive() const {
+	int live = m_lockedLive;
+	for (int i = 0; i < BT_MAX_THREAD_COUNT; i++)
+		live += m_threadLists[i].live;
+
+	return live;
+}
+
+void CGrowablePool::UpdatePeaks() {
+	const int live = GetLive();
+	m_peak = max(m_peak, live);
+	m_recentPeak = max(m_recentPeak, live);
+}
+
+// Shared list lock must be held
+void CGrowablePool::Grow() {
+	char *pMemory = (char *)btAlignedAlloc(POOL_HEADER_SIZE + m_chunkElements * m_stride, 16);
+	chunk_t *pChunk = new (pMemory) chunk_t;
+	pChunk->live = 0;
+	pChunk->bRelease = false;
+	pChunk->pNext = m_pChunks;
+	m_pChunks = pChunk;
+	m_numChunks++;
+
+	for (int i = m_chunkElements - 1; i >= 0; i--) {
+		element_t *pElement = (element_t *)(pMemory + POOL_HEADER_SIZE + i * m_stride + POOL_HEADER_SIZE);
+		GetChunk(pElement) = pChunk;
+		pElement->pNext = m_pFree;
+		m_pFree = pElement;
+	}
+}
+
+void CGrowablePool::Refill(threadlist_t &list) {
+	AUTO_LOCK(m_mutex);
+	if (!m_pFree)
+		Grow();
+
+	for (int i = 0; i < POOL_BATCH_SIZE && m_pFree; i++) {
+		element_t *pElement = m_pFree;
+		m_pFree = pElement->pNext;
+		pElement->pNext = list.pFree;
+		list.pFree = pElement;
+		list.count++;
+	}
+}
+
+void CGrowablePool::Spill(threadlist_t &list) {
+	AUTO_LOCK(m_mutex);
+	for (int i = 0; i < POOL_BATCH_SIZE && list.pFree; i++) {
+		element_t *pElement = list.pFree;
+		list.pFree = pElement->pNext;
+		list.count--;
+		pElement->pNext = m_pFree;
+		m_pFree = pElement;
+	}
+}
+
+void CGrowablePool::Trim() {
+	AUTO_LOCK(m_mutex);
+	UpdatePeaks();
+
+	// Keep enough chunks for the recent high-water mark, plus one so we don't give back and grow over and over
+	const int keepChunks = (m_recentPeak + m_chunkElements - 1) / m_chunkElements + 1;
+	m_recentPeak = GetLive();
+
+	int release = 0;
+	for (chunk_t *pChunk = m_pChunks; pChunk && m_numChunks - release > keepChunks; pChunk = pChunk->pNext) {
+		if (pChunk->live == 0) {
+			pChunk->bRelease = true;
+			release++;
+		}
+	}
+
+	if (release == 0)
+		return;
+
+	// Nothing is allocating, so the thread lists can be pulled back. The shared list is then rebuilt
+	// without the elements of the chunks we give back.
+	for (int i = 0; i < BT_MAX_THREAD_COUNT; i++) {
+		threadlist_t &list = m_threadLists[i];
+		while (list.pFree) {
+			element_t *pElement = list.pFree;
+			list.pFree = pElement->pNext;
+			pElement->pNext = m_pFree;
+			m_pFree = pElement;
+		}
+
+		list.count = 0;
+	}
+
+	element_t *pKeep = NULL;
+	while (m_pFree) {
+		element_t *pElement = m_pFree;
+		m_pFree = pElement->pNext;
+		if (!GetChunk(pElement)->bRelease) {
+			pElement->pNext = pKeep;
+			pKeep = pElement;
+		}
+	}
+
+	m_pFree = pKeep;
+
+	for (chunk_t **ppChunk = &m_pChunks; *ppChunk;) {
+		chunk_t *pChunk = *ppChunk;
+		if (pChunk->bRelease) {
+			*ppChunk = pChunk->pNext;
+			pChunk->~chunk_t();
+			btAlignedFree(pChunk);
+			m_numChunks--;
+		} else {
+			ppChunk = &pChunk->pNext;
+		}
+	}
+}
+
+void CGrowablePool::GetStats(poolstats_t *pOutput) const {
+	if (!pOutput) return;
+
+	const int live = GetLive();
+	pOutput->pName = m_pName;
+	pOutput->elementSize = m_elementSize;
+	pOutput->live = live;
+	pOutput->peak = max(m_peak, live);
+	pOutput->recentPeak = max(m_recentPeak, live);
+	pOutput->capacity = m_numChunks * m_chunkElements;
+	pOutput->chunks = m_numChunks;
+	pOutput->oversized = m_oversized;
+}
+
+/*******************************
+* CLASS CDispatcherPools
+*******************************/
+
+CDispatcherPools::CDispatcherPools(btCollisionConfiguration *pConfig) :
+	m_manifoldPool("persistent manifolds", sizeof(btPersistentManifold), MANIFOLD_CHUNK_SIZE),
+	m_algorithmPool("collision algorithms", pConfig->getCollisionAlgorithmPool()->getElementSize(), ALGORITHM_CHUNK_SIZE) {
+	m_ticksSinceTrim = 0;
+	m_contactBreakingThreshold = gContactBreakingThreshold;
+}
+
+// Same as btCollisionDispatcher::getNewManifold, without the bookkeeping of the dispatcher's manifold list,
+// and with our own contact breaking threshold instead of the global one
+btPersistentManifold *CDispatcherPools::NewManifold(const btCollisionObject *body0, const btCollisionObject *body1, int dispatcherFlags) {
+	// Optional relative contact breaking threshold, turned on by default
+	const btScalar contactBreakingThreshold = (dispatcherFlags & btCollisionDispatcher::CD_USE_RELATIVE_CONTACT_BREAKING_THRESHOLD) ?
+		btMin(body0->getCollisionShape()->getContactBreakingThreshold(m_contactBreakingThreshold), body1->getCollisionShape()->getContactBreakingThreshold(m_contactBreakingThreshold))
+		: m_contactBreakingThreshold;
+
+	const btScalar contactProcessingThreshold = btMin(body0->getContactProcessingThreshold(), body1->getContactProcessingThreshold());
+
+	void *mem = m_manifoldPool.Alloc(sizeof(btPersistentManifold));
+	return new (mem) btPersistentManifold(body0, body1, 0, contactBreakingThreshold, contactProcessingThreshold);
+}
+
+void CDispatcherPools::DeleteManifold(btPersistentManifold *manifold) {
+	manifold->~btPersistentManifold();
+	m_manifoldPool.Free(manifold);
+}
+
+void CDispatcherPools::Tick() {
+	m_manifoldPool.UpdatePeaks();
+	m_algorithmPool.UpdatePeaks();
+
+	const int interval = cvar_collisionpool_trim.GetInt();
+	if (interval <= 0 || ++m_ticksSinceTrim < interval)
+		return;
+
+	m_ticksSinceTrim = 0;
+	m_manifoldPool.Trim();
+	m_algorithmPool.Trim();
+}
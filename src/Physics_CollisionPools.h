@@ -0,0 +1,113 @@
+#ifndef PHYSICS_COLLISIONPOOLS_H
+#define PHYSICS_COLLISIONPOOLS_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+#include <atomic>
+#include <tier0/threadtools.h>
+#include <LinearMath/btThreads.h>
+
+struct poolstats_t {
+	const char *	pName;
+	int				elementSize;
+	int				live;			// Elements in use
+	int				peak;			// High-water mark since the pool was created (sampled between steps)
+	int				recentPeak;		// High-water mark since the last trim (sampled between steps)
+	int				capacity;		// Elements in the allocated chunks
+	int				chunks;
+	int				oversized;		// Allocations too big for the pool that went to btAlignedAlloc
+};
+
+// Purpose: Pool of fixed size elements that grows a chunk at a time and gives empty chunks back when trimmed.
+// Each thread (by task scheduler slot) allocates from and frees to its own free list, and trades batches
+// of elements with the shared list once it runs dry or holds too many.
+class CGrowablePool {
+	public:
+		CGrowablePool(const char *pName, int elementSize, int chunkElements);
+		~CGrowablePool();
+
+		void *						Alloc(int size);
+		void						Free(void *ptr);
+
+		// Gives back the empty chunks that aren't needed to cover the recent high-water mark.
+		// Main thread only, while nothing is being simulated.
+		void						Trim();
+
+		// Samples the live count into the high-water marks. Main thread only, while nothing is being simulated.
+		void						UpdatePeaks();
+
+		void						GetStats(poolstats_t *pOutput) const;
+
+	private:
+		struct chunk_t {
+			chunk_t *				pNext;
+			std::atomic<int>		live;
+			bool					bRelease;	// Being trimmed
+		};
+
+		struct element_t {
+			element_t *				pNext;		// While free
+		};
+
+		struct threadlist_t {
+			element_t *				pFree;
+			int						count;
+			int						live;		// Allocated minus freed by this thread, can be negative
+			char					pad[64];
+		};
+
+		chunk_t *&					GetChunk(element_t *pElement) const;
+		threadlist_t *				GetThreadList();
+		int							GetLive() const;
+		void						Grow();
+		void						Refill(threadlist_t &list);
+		void						Spill(threadlist_t &list);
+
+		const char *				m_pName;
+		int							m_elementSize;
+		int							m_stride;			// Element with its header
+		int							m_chunkElements;
+
+		CThreadFastMutex			m_mutex;			// Shared list and chunks
+		element_t *					m_pFree;
+		chunk_t *					m_pChunks;
+		int							m_numChunks;
+		threadlist_t				m_threadLists[BT_MAX_THREAD_COUNT];
+
+		std::atomic<int>			m_lockedLive;		// Live count of the threads without a list
+		int							m_peak;
+		int							m_recentPeak;
+		std::atomic<int>			m_oversized;
+};
+
+// Purpose: Growable persistent manifold and collision algorithm pools of a dispatcher.
+// Replaces the fixed size btPoolAllocators of the collision configuration (which fall back to the heap once full).
+class CDispatcherPools {
+	public:
+		CDispatcherPools(btCollisionConfiguration *pConfig);
+
+		btPersistentManifold *		NewManifold(const btCollisionObject *body0, const btCollisionObject *body1, int dispatcherFlags);
+		void						DeleteManifold(btPersistentManifold *manifold);
+
+		// Per world replacement of gContactBreakingThreshold, which is shared by every environment
+		void						SetContactBreakingThreshold(btScalar threshold) { m_contactBreakingThreshold = threshold; }
+		btScalar					GetContactBreakingThreshold() const { return m_contactBreakingThreshold; }
+
+		void *						AllocAlgorithm(int size) { return m_algorithmPool.Alloc(size); }
+		void						FreeAlgorithm(void *ptr) { m_algorithmPool.Free(ptr); }
+
+		// Called after each simulation step, trims the pools every so often
+		void						Tick();
+
+		void						GetManifoldPoolStats(poolstats_t *pOutput) const { m_manifoldPool.GetStats(pOutput); }
+		void						GetAlgorithmPoolStats(poolstats_t *pOutput) const { m_algorithmPool.GetStats(pOutput); }
+
+	private:
+		CGrowablePool				m_manifoldPool;
+		CGrowablePool				m_algorithmPool;
+		int							m_ticksSinceTrim;
+		btScalar					m_contactBreakingThreshold;
+};
+
+#endif // PHYSICS_COLLISIONPOOLS_H
@@ -394,37 +394,65 @@ class btSpringConstraint : public btPoint2PointConstraint {
 };
 
 // Purpose: Bind IPhysicsUserConstraint to a bullet constraint
+// The rows are gathered ahead of the solve by CUserConstraintBatch, so this never calls into the game from a solver thread
+// unless the constraint was skipped by the batch (e.g. it woke up in the middle of a tick).
 class btUserConstraint : public btTypedConstraint {
 	public:
 		btUserConstraint(btRigidBody &rbA, btRigidBody &rbB, IPhysicsUserConstraint *pConstraint): btTypedConstraint(CONSTRAINT_TYPE_USER, rbA, rbB) {
 			m_pUserConstraint = pConstraint;
+			clearRows();
 		}
 
+		// The game is only ever called by CUserConstraintBatch::Gather on the main thread, never from the solver
+		// (which may run on a worker thread). A constraint that wasn't gathered this tick isn't solved.
 		void getInfo1(btConstraintInfo1 *pInfo) {
-			physconstraintinfo_t info;
-			info.numConstraintRows = 0;
-			info.nub = 0;
-
-			CPhysicsObject *pObjA, *pObjB;
-			pObjA = (CPhysicsObject *)m_rbA.getUserPointer();
-			pObjB = (CPhysicsObject *)m_rbB.getUserPointer();
-			m_pUserConstraint->GetConstraintInfo(pObjA, pObjB, info);
+			if (!m_bGathered) {
+				pInfo->m_numConstraintRows = 0;
+				pInfo->nub = 0;
+				return;
+			}
 
-			pInfo->m_numConstraintRows = info.numConstraintRows;
-			pInfo->nub = info.nub;
+			pInfo->m_numConstraintRows = m_numRows;
+			pInfo->nub = m_nub;
 		}
 
 		void getInfo2(btConstraintInfo2 *pInfo) {
-			physconstraintsolveinfo_t *solveinfo = new physconstraintsolveinfo_t[pInfo->m_numConstraintRows];
-			for (int i = 0; i < pInfo->m_numConstraintRows; i++) {
-				solveinfo[i].Defaults();
-			}
+			if (!m_bGathered || pInfo->m_numConstraintRows == 0)
+				return;
+
+			Assert(pInfo->m_numConstraintRows == m_numRows);
+			convertRows(pInfo, m_pRows);
+		}
+
+		// Rows gathered by the batch, valid until the next gather
+		void setRows(const physconstraintsolveinfo_t *pRows, int numRows, int nub) {
+			m_pRows = pRows;
+			m_numRows = numRows;
+			m_nub = nub;
+			m_bGathered = true;
+		}
+
+		void clearRows() {
+			m_pRows = NULL;
+			m_numRows = 0;
+			m_nub = 0;
+			m_bGathered = false;
+		}
 
-			CPhysicsObject *pObjA, *pObjB;
-			pObjA = (CPhysicsObject *)m_rbA.getUserPointer();
-			pObjB = (CPhysicsObject *)m_rbB.getUserPointer();
-			m_pUserConstraint->GetConstraintSolveInfo(pObjA, pObjB, solveinfo, pInfo->m_numConstraintRows, pInfo->fps, pInfo->erp);
+		IPhysicsUserConstraint *getUserConstraint() {
+			return m_pUserConstraint;
+		}
+
+		btScalar getParam(int num, int axis = -1) const {
+			return 0xB16B00B5;
+		}
+
+		void setParam(int num, btScalar value, int axis = -1) {
 
+		}
+
+	private:
+		void convertRows(btConstraintInfo2 *pInfo, const physconstraintsolveinfo_t *solveinfo) {
 			for (int i = 0; i < pInfo->m_numConstraintRows; i++) {
 				ConvertDirectionToBull(solveinfo[i].J1linearAxis, *(btVector3 *)&pInfo->m_J1linearAxis[i * pInfo->rowskip]);
 				ConvertDirectionToBull(solveinfo[i].J1angularAxis, *(btVector3 *)&pInfo->m_J1angularAxis[i * pInfo->rowskip]);
@@ -441,24 +469,13 @@ class btUserConstraint : public btTypedConstraint {
 				pInfo->m_lowerLimit[i * pInfo->rowskip] = solveinfo[i].lowerLimit;
 				pInfo->m_upperLimit[i * pInfo->rowskip] = solveinfo[i].upperLimit;
 			}
-
-			delete[] solveinfo;
-		}
-
-		IPhysicsUserConstraint *getUserConstraint() {
-			return m_pUserConstraint;
-		}
-
-		btScalar getParam(int num, int axis = -1) const {
-			return 0xB16B00B5;
 		}
 
-		void setParam(int num, btScalar value, int axis = -1) {
-
-		}
-
-	private:
-		IPhysicsUserConstraint *m_pUserConstraint;
+		IPhysicsUserConstraint *			m_pUserConstraint;
+		const physconstraintsolveinfo_t *	m_pRows;		// May be NULL when there are no rows
+		int									m_numRows;
+		int									m_nub;
+		bool								m_bGathered;
 };
 
 /*********************************
@@ -474,6 +491,10 @@ CPhysicsConstraint::CPhysicsConstraint(CPhysicsEnvironment *pEnv, IPhysicsConstr
 	m_type = type;
 	m_bRemovedFromEnv = false;
 	m_bNotifyBroken = true;
+	m_bBreakable = false;
+	m_forceLimit = 0;
+	m_torqueLimit = 0;
+	m_breakableParams.Defaults();
 
 	if (m_type == CONSTRAINT_RAGDOLL || m_type == CONSTRAINT_BALLSOCKET || m_type == CONSTRAINT_FIXED) {
 		m_pEnv->GetBulletEnvironment()->addConstraint(m_pConstraint);
@@ -481,6 +502,7 @@ CPhysicsConstraint::CPhysicsConstraint(CPhysicsEnvironment *pEnv, IPhysicsConstr
 		m_pEnv->GetBulletEnvironment()->addConstraint(m_pConstraint);
 	}
 
+	m_solveOrder = m_pEnv->NextConstraintSolveOrder();
 	m_pConstraint->setUserConstraintPtr(this);
 
 	if (pReferenceObject) {
@@ -501,8 +523,10 @@ CPhysicsConstraint::CPhysicsConstraint(CPhysicsEnvironment *pEnv, IPhysicsConstr
 CPhysicsConstraint::~CPhysicsConstraint() {
 	if (!m_bRemovedFromEnv) {
 		m_pEnv->GetBulletEnvironment()->removeConstraint(m_pConstraint);
-		if (m_type == CONSTRAINT_USER)
+		if (m_type == CONSTRAINT_USER) {
+			m_pEnv->GetUserConstraintBatch()->RemoveConstraint(this);
 			((btUserConstraint *)m_pConstraint)->getUserConstraint()->ConstraintDestroyed(this);
+		}
 
 		m_bRemovedFromEnv = true;
 	}
@@ -521,6 +545,10 @@ CPhysicsConstraint::~CPhysicsConstraint() {
 		m_pGroup->RemoveConstraint(this);
 	}
 
+	if (m_bBreakable) {
+		m_pEnv->RemoveBreakableConstraint(this);
+	}
+
 	delete m_pConstraint;
 }
 
@@ -582,8 +610,8 @@ bool CPhysicsConstraint::GetConstraintTransform(matrix3x4_t *pConstraintToRefere
 bool CPhysicsConstraint::GetConstraintParams(constraint_breakableparams_t *pParams) const {
 	if (!pParams) return false;
 
-	NOT_IMPLEMENTED
-	return false;
+	*pParams = m_breakableParams;
+	return true;
 }
 
 void CPhysicsConstraint::OutputDebugInfo() {
@@ -612,8 +640,10 @@ void CPhysicsConstraint::ObjectDestroyed(CPhysicsObject *pObject) {
 		m_bRemovedFromEnv = true;
 		notify = true;
 
-		if (m_type == CONSTRAINT_USER)
+		if (m_type == CONSTRAINT_USER) {
+			m_pEnv->GetUserConstraintBatch()->RemoveConstraint(this);
 			((btUserConstraint *)m_pConstraint)->getUserConstraint()->ConstraintDestroyed(this);
+		}
 	}
 
 	// Tell the game that this constraint was broken.
@@ -621,6 +651,114 @@ void CPhysicsConstraint::ObjectDestroyed(CPhysicsObject *pObject) {
 		m_pEnv->HandleConstraintBroken(this);
 }
 
+// UNEXPOSED
+void CPhysicsConstraint::SetBreakable(const constraint_breakableparams_t &params) {
+	m_breakableParams = params;
+
+	// NOTE: strength and bodyMassScale are not supported.
+	m_forceLimit = ConvertForceImpulseToBull(params.forceLimit);
+	m_torqueLimit = HL2BULL(HL2BULL(params.torqueLimit));
+
+	const bool breakable = m_forceLimit > 0 || m_torqueLimit > 0;
+	if (breakable == m_bBreakable)
+		return;
+
+	m_bBreakable = breakable;
+	if (m_bBreakable) {
+		m_jointFeedback.m_appliedForceBodyA.setZero();
+		m_jointFeedback.m_appliedTorqueBodyA.setZero();
+		m_jointFeedback.m_appliedForceBodyB.setZero();
+		m_jointFeedback.m_appliedTorqueBodyB.setZero();
+
+		// The solver sums the forces it applied into the feedback, we check them once per simulation step
+		m_pConstraint->setJointFeedback(&m_jointFeedback);
+		m_pConstraint->enableFeedback(true);
+		m_pEnv->AddBreakableConstraint(this);
+	} else {
+		m_pConstraint->enableFeedback(false);
+		m_pConstraint->setJointFeedback(NULL);
+		m_pEnv->RemoveBreakableConstraint(this);
+	}
+}
+
+// Pivots of the constraint's linear rows, relative to each body's center of mass. False for constraints without
+// linear rows at a pivot (gears), or ones we don't know the layout of.
+static bool GetConstraintPivots(btTypedConstraint *pConstraint, btVector3 &pivotA, btVector3 &pivotB) {
+	switch (pConstraint->getConstraintType()) {
+		case POINT2POINT_CONSTRAINT_TYPE: {
+			btPoint2PointConstraint *pP2P = static_cast<btPoint2PointConstraint *>(pConstraint);
+			pivotA = pP2P->getPivotInA();
+			pivotB = pP2P->getPivotInB();
+			return true;
+		}
+		case HINGE_CONSTRAINT_TYPE: {
+			btHingeConstraint *pHinge = static_cast<btHingeConstraint *>(pConstraint);
+			pivotA = pHinge->getAFrame().getOrigin();
+			pivotB = pHinge->getBFrame().getOrigin();
+			return true;
+		}
+		case D6_CONSTRAINT_TYPE:
+		case D6_SPRING_CONSTRAINT_TYPE: {
+			btGeneric6DofConstraint *p6Dof = static_cast<btGeneric6DofConstraint *>(pConstraint);
+			pivotA = p6Dof->getFrameOffsetA().getOrigin();
+			pivotB = p6Dof->getFrameOffsetB().getOrigin();
+			return true;
+		}
+		case D6_SPRING_2_CONSTRAINT_TYPE: {
+			// btFixedConstraint
+			btGeneric6DofSpring2Constraint *p6Dof = static_cast<btGeneric6DofSpring2Constraint *>(pConstraint);
+			pivotA = p6Dof->getFrameOffsetA().getOrigin();
+			pivotB = p6Dof->getFrameOffsetB().getOrigin();
+			return true;
+		}
+		case SLIDER_CONSTRAINT_TYPE: {
+			btSliderConstraint *pSlider = static_cast<btSliderConstraint *>(pConstraint);
+			pivotA = pSlider->getFrameOffsetA().getOrigin();
+			pivotB = pSlider->getFrameOffsetB().getOrigin();
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+// UNEXPOSED
+// Returns true if the average force applied over the last numSubSteps substeps exceeds our limits.
+// Resets the accumulated forces.
+bool CPhysicsConstraint::CheckBreak(int numSubSteps) {
+	bool shouldBreak = false;
+	if (m_pConstraint->isEnabled() && !m_bRemovedFromEnv && numSubSteps > 0) {
+		const btScalar invSubSteps = btScalar(1) / numSubSteps;
+
+		const btVector3 &forceA = m_jointFeedback.m_appliedForceBodyA;
+		const btVector3 &forceB = m_jointFeedback.m_appliedForceBodyB;
+		btVector3 torqueA = m_jointFeedback.m_appliedTorqueBodyA;
+		btVector3 torqueB = m_jointFeedback.m_appliedTorqueBodyB;
+
+		// The applied torque includes the torque of the linear rows (the force at the pivot's lever arm),
+		// only the angular rows count against the torque limit. Uses the current pose for the whole step.
+		btVector3 pivotA, pivotB;
+		if (GetConstraintPivots(m_pConstraint, pivotA, pivotB)) {
+			const btRigidBody &bodyA = m_pConstraint->getRigidBodyA();
+			const btRigidBody &bodyB = m_pConstraint->getRigidBodyB();
+			torqueA -= (bodyA.getCenterOfMassTransform().getBasis() * pivotA).cross(forceA);
+			torqueB -= (bodyB.getCenterOfMassTransform().getBasis() * pivotB).cross(forceB);
+		}
+
+		const btScalar force = btMax(forceA.length(), forceB.length()) * invSubSteps;
+		const btScalar torque = btMax(torqueA.length(), torqueB.length()) * invSubSteps;
+
+		shouldBreak = (m_forceLimit > 0 && force > m_forceLimit) || (m_torqueLimit > 0 && torque > m_torqueLimit);
+	}
+
+	m_jointFeedback.m_appliedForceBodyA.setZero();
+	m_jointFeedback.m_appliedTorqueBodyA.setZero();
+	m_jointFeedback.m_appliedForceBodyB.setZero();
+	m_jointFeedback.m_appliedTorqueBodyB.setZero();
+
+	return shouldBreak;
+}
+
 // UNEXPOSED
 EConstraintType CPhysicsConstraint::GetType() {
 	return m_type;
@@ -638,14 +776,34 @@ btTypedConstraint *CPhysicsConstraint::GetConstraint() {
 CPhysicsConstraintGroup::CPhysicsConstraintGroup(CPhysicsEnvironment *pEnv, const constraint_groupparams_t &params) {
 	m_errorParams = params;
 	m_pEnvironment = pEnv;
+	m_bIsTree = false;
+	m_baseIterations = 0;
+	m_solverIterations = -1;
 }
 
 CPhysicsConstraintGroup::~CPhysicsConstraintGroup() {
 
 }
 
+// The game calls this once all of the group's constraints are created (i.e. the whole ragdoll)
 void CPhysicsConstraintGroup::Activate() {
+	m_bIsTree = SortConstraintsByTree();
+
+	// Renumber the constraints in tree order. The solver processes constraints by their solve order,
+	// so this lets a single iteration push impulses from the root all the way to the leaves.
+	if (m_bIsTree && !m_pEnvironment->IsInSimulation()) {
+		for (int i = 0; i < m_constraints.Count(); i++) {
+			m_constraints[i]->SetSolveOrder(m_pEnvironment->NextConstraintSolveOrder());
+		}
+	}
+
+	ApplySolverIterations();
+
 	for (int i = 0; i < m_constraints.Count(); i++) {
+		// Already removed by the game (or one of its objects was destroyed), don't bring it back
+		if (m_constraints[i]->IsRemovedFromEnv())
+			continue;
+
 		m_constraints[i]->Activate();
 	}
 }
@@ -668,6 +826,7 @@ void CPhysicsConstraintGroup::GetErrorParams(constraint_groupparams_t *pParams)
 
 void CPhysicsConstraintGroup::SetErrorParams(const constraint_groupparams_t &params) {
 	m_errorParams = params;
+	ApplySolverIterations();
 }
 
 void CPhysicsConstraintGroup::SolvePenetration(IPhysicsObject *pObj0, IPhysicsObject *pObj1) {
@@ -677,11 +836,206 @@ void CPhysicsConstraintGroup::SolvePenetration(IPhysicsObject *pObj0, IPhysicsOb
 // UNEXPOSED
 void CPhysicsConstraintGroup::AddConstraint(CPhysicsConstraint *pConstraint) {
 	m_constraints.AddToTail(pConstraint);
+	pConstraint->GetConstraint()->setOverrideNumSolverIterations(m_solverIterations);
 }
 
 // UNEXPOSED
 void CPhysicsConstraintGroup::RemoveConstraint(CPhysicsConstraint *pConstraint) {
 	m_constraints.FindAndRemove(pConstraint);
+	m_bIsTree = false; // Until the next Activate()
+}
+
+// Purpose: Sorts m_constraints in breadth-first order from the root object of the group.
+// Returns false (and leaves the order alone) if the group isn't a single tree.
+bool CPhysicsConstraintGroup::SortConstraintsByTree() {
+	const int numConstraints = m_constraints.Count();
+	if (numConstraints == 0)
+		return false;
+
+	CUtlVector<CPhysicsObject *> objects;
+	for (int i = 0; i < numConstraints; i++) {
+		CPhysicsObject *pRef = (CPhysicsObject *)m_constraints[i]->GetReferenceObject();
+		CPhysicsObject *pAtt = (CPhysicsObject *)m_constraints[i]->GetAttachedObject();
+
+		// One of the objects was destroyed
+		if (!pRef || !pAtt || pRef == pAtt || m_constraints[i]->IsRemovedFromEnv())
+			return false;
+
+		if (objects.Find(pRef) == -1)
+			objects.AddToTail(pRef);
+
+		if (objects.Find(pAtt) == -1)
+			objects.AddToTail(pAtt);
+	}
+
+	// A connected graph is a tree iff it has exactly one edge less than it has vertices
+	if (numConstraints != objects.Count() - 1)
+		return false;
+
+	// The root is the object that is never attached to anything (the ragdoll's pelvis)
+	CPhysicsObject *pRoot = (CPhysicsObject *)m_constraints[0]->GetReferenceObject();
+	for (int i = 0; i < objects.Count(); i++) {
+		bool bAttached = false;
+		for (int j = 0; j < numConstraints && !bAttached; j++) {
+			bAttached = m_constraints[j]->GetAttachedObject() == objects[i];
+		}
+
+		if (!bAttached) {
+			pRoot = objects[i];
+			break;
+		}
+	}
+
+	// Breadth-first walk from the root
+	CUtlVector<CPhysicsObject *> visited;
+	CUtlVector<CPhysicsConstraint *> sorted;
+	visited.AddToTail(pRoot);
+
+	for (int head = 0; head < visited.Count(); head++) {
+		CPhysicsObject *pObject = visited[head];
+
+		for (int i = 0; i < numConstraints; i++) {
+			CPhysicsConstraint *pConstraint = m_constraints[i];
+			if (sorted.Find(pConstraint) != -1)
+				continue;
+
+			CPhysicsObject *pOther = NULL;
+			if (pConstraint->GetReferenceObject() == pObject)
+				pOther = (CPhysicsObject *)pConstraint->GetAttachedObject();
+			else if (pConstraint->GetAttachedObject() == pObject)
+				pOther = (CPhysicsObject *)pConstraint->GetReferenceObject();
+
+			if (!pOther)
+				continue;
+
+			sorted.AddToTail(pConstraint);
+			visited.AddToTail(pOther);
+		}
+	}
+
+	// Disconnected pieces (which would mean there's a cycle somewhere as well)
+	if (sorted.Count() != numConstraints)
+		return false;
+
+	m_constraints.RemoveAll();
+	m_constraints.AddVectorToTail(sorted);
+	return true;
+}
+
+// Purpose: Give the group's constraints the extra solver iterations the game asked for
+void CPhysicsConstraintGroup::ApplySolverIterations() {
+	m_baseIterations = m_pEnvironment->GetBulletEnvironment()->getSolverInfo().m_numIterations;
+
+	m_solverIterations = -1; // Use the world's iteration count
+	if (m_errorParams.additionalIterations > 0)
+		m_solverIterations = m_baseIterations + m_errorParams.additionalIterations;
+
+	for (int i = 0; i < m_constraints.Count(); i++) {
+		m_constraints[i]->GetConstraint()->setOverrideNumSolverIterations(m_solverIterations);
+	}
+}
+
+// UNEXPOSED
+// The override includes the world's iteration count, so it has to follow bt_solver_iterations
+void CPhysicsConstraintGroup::UpdateSolverIterations() {
+	if (m_pEnvironment->GetBulletEnvironment()->getSolverInfo().m_numIterations != m_baseIterations)
+		ApplySolverIterations();
+}
+
+/*********************************
+* CLASS CUserConstraintBatch
+*********************************/
+
+CUserConstraintBatch::CUserConstraintBatch(CPhysicsEnvironment *pEnv) {
+	m_pEnv = pEnv;
+	m_pHandler = NULL;
+}
+
+void CUserConstraintBatch::AddConstraint(CPhysicsConstraint *pConstraint) {
+	Assert(pConstraint->GetType() == CONSTRAINT_USER);
+	m_constraints.AddToTail(pConstraint);
+}
+
+void CUserConstraintBatch::RemoveConstraint(CPhysicsConstraint *pConstraint) {
+	m_constraints.FindAndRemove(pConstraint);
+	m_gathered.FindAndRemove(pConstraint);
+}
+
+void CUserConstraintBatch::Gather(float dt) {
+	// Forget the last gather, constraints we skip now aren't solved this tick
+	for (int i = 0; i < m_gathered.Count(); i++) {
+		((btUserConstraint *)m_gathered[i]->GetConstraint())->clearRows();
+	}
+
+	m_gathered.RemoveAll();
+	m_batch.RemoveAll();
+
+	for (int i = 0; i < m_constraints.Count(); i++) {
+		CPhysicsConstraint *pConstraint = m_constraints[i];
+		btUserConstraint *pUserConstraint = (btUserConstraint *)pConstraint->GetConstraint();
+		if (!pUserConstraint->isEnabled())
+			continue;
+
+		// NOTE: Constraints between sleeping objects are gathered too, their island can be woken up later in this tick
+
+		physuserconstraintrows_t &entry = m_batch[m_batch.AddToTail()];
+		entry.pUserConstraint = pUserConstraint->getUserConstraint();
+		entry.pObjA = (CPhysicsObject *)pConstraint->GetReferenceObject();
+		entry.pObjB = (CPhysicsObject *)pConstraint->GetAttachedObject();
+		entry.info.numConstraintRows = 0;
+		entry.info.nub = 0;
+		entry.pRows = NULL;
+
+		m_gathered.AddToTail(pConstraint);
+	}
+
+	if (m_batch.Count() == 0)
+		return;
+
+	// First pass: row counts
+	if (m_pHandler) {
+		m_pHandler->GetConstraintInfoBatch(m_batch.Base(), m_batch.Count());
+	} else {
+		for (int i = 0; i < m_batch.Count(); i++) {
+			m_batch[i].pUserConstraint->GetConstraintInfo(m_batch[i].pObjA, m_batch[i].pObjB, m_batch[i].info);
+		}
+	}
+
+	// All rows live in one contiguous array
+	int numRows = 0;
+	for (int i = 0; i < m_batch.Count(); i++) {
+		numRows += max(m_batch[i].info.numConstraintRows, 0);
+	}
+
+	m_rows.SetCount(numRows);
+	for (int i = 0; i < numRows; i++) {
+		m_rows[i].Defaults();
+	}
+
+	numRows = 0;
+	for (int i = 0; i < m_batch.Count(); i++) {
+		m_batch[i].pRows = m_rows.Base() + numRows;
+		numRows += max(m_batch[i].info.numConstraintRows, 0);
+	}
+
+	// Second pass: solve info
+	const float fps = dt > 0 ? 1.0f / dt : 0.0f;
+	const float erp = m_pEnv->GetBulletEnvironment()->getSolverInfo().m_erp;
+
+	if (m_pHandler) {
+		m_pHandler->GetConstraintSolveInfoBatch(m_batch.Base(), m_batch.Count(), fps, erp);
+	} else {
+		for (int i = 0; i < m_batch.Count(); i++) {
+			physuserconstraintrows_t &entry = m_batch[i];
+			if (entry.info.numConstraintRows > 0)
+				entry.pUserConstraint->GetConstraintSolveInfo(entry.pObjA, entry.pObjB, entry.pRows, entry.info.numConstraintRows, fps, erp);
+		}
+	}
+
+	for (int i = 0; i < m_batch.Count(); i++) {
+		const physuserconstraintrows_t &entry = m_batch[i];
+		((btUserConstraint *)m_gathered[i]->GetConstraint())->setRows(entry.pRows, max(entry.info.numConstraintRows, 0), entry.info.nub);
+	}
 }
 
 /************************
@@ -809,7 +1163,9 @@ CPhysicsConstraint *CreateRagdollConstraint(CPhysicsEnvironment *pEnv, IPhysicsO
 		pConstraint->setAngularOnly(true);
 	}
 	
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pConstraint, CONSTRAINT_RAGDOLL);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pConstraint, CONSTRAINT_RAGDOLL);
+	pPhysConstraint->SetBreakable(ragdoll.constraint);
+	return pPhysConstraint;
 }
 
 CPhysicsConstraint *CreateHingeConstraint(CPhysicsEnvironment *pEnv, IPhysicsObject *pReferenceObject, IPhysicsObject *pAttachedObject, IPhysicsConstraintGroup *pGroup, const constraint_hingeparams_t &hinge) {
@@ -851,7 +1207,9 @@ CPhysicsConstraint *CreateHingeConstraint(CPhysicsEnvironment *pEnv, IPhysicsObj
 	if (hinge.hingeAxis.minRotation != hinge.hingeAxis.maxRotation)
 		pHinge->setLimit(ConvertAngleToBull(hinge.hingeAxis.minRotation), ConvertAngleToBull(hinge.hingeAxis.maxRotation));
 
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pHinge, CONSTRAINT_HINGE);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pHinge, CONSTRAINT_HINGE);
+	pPhysConstraint->SetBreakable(hinge.constraint);
+	return pPhysConstraint;
 }
 
 CPhysicsConstraint *CreateFixedConstraint(CPhysicsEnvironment *pEnv, IPhysicsObject *pReferenceObject, IPhysicsObject *pAttachedObject, IPhysicsConstraintGroup *pGroup, const constraint_fixedparams_t &fixed) {
@@ -861,7 +1219,9 @@ CPhysicsConstraint *CreateFixedConstraint(CPhysicsEnvironment *pEnv, IPhysicsObj
 																pObjRef->GetObject()->getWorldTransform().inverse() * pObjAtt->GetObject()->getWorldTransform(),
 																btTransform::getIdentity());
 
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pWeld, CONSTRAINT_FIXED);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pWeld, CONSTRAINT_FIXED);
+	pPhysConstraint->SetBreakable(fixed.constraint);
+	return pPhysConstraint;
 }
 
 CPhysicsConstraint *CreateSlidingConstraint(CPhysicsEnvironment *pEnv, IPhysicsObject *pReferenceObject, IPhysicsObject *pAttachedObject, IPhysicsConstraintGroup *pGroup, const constraint_slidingparams_t &sliding) {
@@ -909,7 +1269,9 @@ CPhysicsConstraint *CreateSlidingConstraint(CPhysicsEnvironment *pEnv, IPhysicsO
 	pSlider->setLowerAngLimit(0);
 	pSlider->setUpperAngLimit(0);
 
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pSlider, CONSTRAINT_SLIDING);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pSlider, CONSTRAINT_SLIDING);
+	pPhysConstraint->SetBreakable(sliding.constraint);
+	return pPhysConstraint;
 }
 
 CPhysicsConstraint *CreateBallsocketConstraint(CPhysicsEnvironment *pEnv, IPhysicsObject *pReferenceObject, IPhysicsObject *pAttachedObject, IPhysicsConstraintGroup *pGroup, const constraint_ballsocketparams_t &ballsocket) {
@@ -924,7 +1286,9 @@ CPhysicsConstraint *CreateBallsocketConstraint(CPhysicsEnvironment *pEnv, IPhysi
 	obj2Pos -= ((btMassCenterMotionState *)pObjAtt->GetObject()->getMotionState())->m_centerOfMassOffset.getOrigin();
 
 	btPoint2PointConstraint *pBallsock = new btPoint2PointConstraint(*pObjRef->GetObject(), *pObjAtt->GetObject(), obj1Pos, obj2Pos);
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pBallsock, CONSTRAINT_BALLSOCKET);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pBallsock, CONSTRAINT_BALLSOCKET);
+	pPhysConstraint->SetBreakable(ballsocket.constraint);
+	return pPhysConstraint;
 }
 
 // NOT COMPLETE
@@ -946,7 +1310,9 @@ CPhysicsConstraint *CreateLengthConstraint(CPhysicsEnvironment *pEnv, IPhysicsOb
 	obj2Pos -= ((btMassCenterMotionState *)pObjAtt->GetObject()->getMotionState())->m_centerOfMassOffset.getOrigin();
 
 	btPoint2PointConstraint *pLength = new btLengthConstraint(*pObjRef->GetObject(), *pObjAtt->GetObject(), obj1Pos, obj2Pos, ConvertDistanceToBull(length.minLength), ConvertDistanceToBull(length.totalLength));
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pLength, CONSTRAINT_LENGTH);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pLength, CONSTRAINT_LENGTH);
+	pPhysConstraint->SetBreakable(length.constraint);
+	return pPhysConstraint;
 }
 
 CPhysicsConstraint *CreateGearConstraint(CPhysicsEnvironment *pEnv, IPhysicsObject *pReferenceObject, IPhysicsObject *pAttachedObject, IPhysicsConstraintGroup *pGroup, const constraint_gearparams_t &gear) {
@@ -959,7 +1325,9 @@ CPhysicsConstraint *CreateGearConstraint(CPhysicsEnvironment *pEnv, IPhysicsObje
 	}
 
 	btGearConstraint *pConstraint = new btGearConstraint(*pObjRef->GetObject(), *pObjAtt->GetObject(), axes[0], axes[1], gear.ratio);
-	return new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pConstraint, CONSTRAINT_GEAR);
+	CPhysicsConstraint *pPhysConstraint = new CPhysicsConstraint(pEnv, pGroup, pObjRef, pObjAtt, pConstraint, CONSTRAINT_GEAR);
+	pPhysConstraint->SetBreakable(gear.constraint);
+	return pPhysConstraint;
 }
 
 CPhysicsConstraintGroup *CreateConstraintGroup(CPhysicsEnvironment *pEnv, const constraint_groupparams_t &params) {
@@ -975,5 +1343,6 @@ CPhysicsConstraint *CreateUserConstraint(CPhysicsEnvironment *pEnv, IPhysicsObje
 
 	CPhysicsConstraint *pConstraint = new CPhysicsConstraint(pEnv, pGroup, (CPhysicsObject *)pReferenceObject, (CPhysicsObject *)pAttachedObject, constraint, CONSTRAINT_USER);
 	pConstraint->SetNotifyBroken(false); // Until an entity is hooked up or whatever
+	pEnv->GetUserConstraintBatch()->AddConstraint(pConstraint);
 	return pConstraint;
 }
\ No newline at end of file
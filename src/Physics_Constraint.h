@@ -59,6 +59,16 @@ class CPhysicsConstraint : public IPhysicsConstraint, public IObjectEventListene
 		btTypedConstraint *		GetConstraint();
 
 		void					SetNotifyBroken(bool notify) {m_bNotifyBroken = notify;}
+		bool					ShouldNotifyBroken() const {return m_bNotifyBroken;}
+
+		bool					IsRemovedFromEnv() const {return m_bRemovedFromEnv;}
+
+		// Constraints of an island are solved in this order (see CConstraintOrder)
+		void					SetSolveOrder(int order) {m_solveOrder = order;}
+		int						GetSolveOrder() const {return m_solveOrder;}
+
+		void					SetBreakable(const constraint_breakableparams_t &params);
+		bool					CheckBreak(int numSubSteps);
 
 	protected:
 		CPhysicsObject *		m_pReferenceObject;
@@ -69,6 +79,13 @@ class CPhysicsConstraint : public IPhysicsConstraint, public IObjectEventListene
 		EConstraintType			m_type;
 		bool					m_bRemovedFromEnv;
 		bool					m_bNotifyBroken; // Should we notify the game that the constraint was broken?
+		bool					m_bBreakable;
+		int						m_solveOrder;
+
+		constraint_breakableparams_t	m_breakableParams;
+		btScalar				m_forceLimit;	// Bullet units (N)
+		btScalar				m_torqueLimit;	// Bullet units (N*m)
+		btJointFeedback			m_jointFeedback; // Forces applied by the solver, summed over the substeps since the last CheckBreak
 
 		btTypedConstraint *		m_pConstraint;
 };
@@ -90,8 +107,10 @@ class CPhysicsSpring : public IPhysicsSpring, public CPhysicsConstraint {
 		IPhysicsObject *GetEndObject();
 };
 
-// FIXME: I dont think we can implement this in Bullet anyways?
-// We'll have to emulate this on bullet.
+// NOTE: Bullet has no notion of constraint groups, so we emulate them.
+// Groups that form a tree (ragdolls) are handed to the solver ordered from the root to the leaves,
+// so a single solver sweep propagates impulses down the whole skeleton.
+// NOTE: Only our sequential impulse solvers keep that order (see CConstraintOrder), the MLCP and NNCG solvers don't.
 class CPhysicsConstraintGroup : public IPhysicsConstraintGroup
 {
 	public:
@@ -110,10 +129,44 @@ class CPhysicsConstraintGroup : public IPhysicsConstraintGroup
 		void	AddConstraint(CPhysicsConstraint *pConstraint);
 		void	RemoveConstraint(CPhysicsConstraint *pConstraint);
 
+		bool	IsTree() const { return m_bIsTree; }
+
+		void	UpdateSolverIterations();
+
 	private:
+		bool	SortConstraintsByTree();
+		void	ApplySolverIterations();
+
 		CUtlVector<CPhysicsConstraint *>	m_constraints;
 		constraint_groupparams_t			m_errorParams;
 		CPhysicsEnvironment *				m_pEnvironment;
+		bool								m_bIsTree;
+		int									m_baseIterations;		// World iteration count m_solverIterations was computed from
+		int									m_solverIterations;		// Override of the constraints (-1 for none)
+};
+
+// Purpose: Gathers the solve info of all user constraints in an environment once per tick,
+// so the solver never has to call into game code.
+class CUserConstraintBatch {
+	public:
+		CUserConstraintBatch(CPhysicsEnvironment *pEnv);
+
+		void	SetHandler(IPhysicsUserConstraintBatch *pHandler) { m_pHandler = pHandler; }
+
+		void	AddConstraint(CPhysicsConstraint *pConstraint);
+		void	RemoveConstraint(CPhysicsConstraint *pConstraint);
+
+		// Call this before the solver runs
+		void	Gather(float dt);
+
+	private:
+		CPhysicsEnvironment *					m_pEnv;
+		IPhysicsUserConstraintBatch *			m_pHandler;
+
+		CUtlVector<CPhysicsConstraint *>		m_constraints;
+		CUtlVector<CPhysicsConstraint *>		m_gathered;		// Constraints matching m_batch
+		CUtlVector<physuserconstraintrows_t>	m_batch;
+		CUtlVector<physconstraintsolveinfo_t>	m_rows;
 };
 
 // CONSTRAINT CREATION FUNCTIONS
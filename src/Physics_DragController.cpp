@@ -25,58 +25,141 @@ float CPhysicsDragController::GetAirDensity() {
 }
 
 void CPhysicsDragController::RemovePhysicsObject(CPhysicsObject *obj) {
-	m_ents.FindAndRemove(obj);
+	if (!IsControlling(obj))
+		return;
+
+	// Move the last object into the hole
+	const int index = obj->GetDragIndex();
+	const int last = m_ents.Count() - 1;
+	if (index != last) {
+		m_ents[index] = m_ents[last];
+		m_ents[index]->SetDragIndex(index);
+		StoreLane(index, m_ents[index]);
+	}
+
+	StoreLane(last, NULL);
+	m_ents.Remove(last);
+	m_blocks.resize((m_ents.Count() + 3) / 4);
+
+	obj->SetDragIndex(-1);
 }
 
 void CPhysicsDragController::AddPhysicsObject(CPhysicsObject *obj) {
-	if (!IsControlling(obj)) {
-		m_ents.AddToTail(obj);
+	if (IsControlling(obj))
+		return;
+
+	const int index = m_ents.AddToTail(obj);
+	obj->SetDragIndex(index);
+
+	if (m_blocks.size() * 4 <= index) {
+		dragblock_t &block = m_blocks.expandNonInitializing();
+		memset(&block, 0, sizeof(block));
 	}
+
+	StoreLane(index, obj);
+}
+
+void CPhysicsDragController::UpdatePhysicsObject(CPhysicsObject *obj) {
+	if (IsControlling(obj))
+		StoreLane(obj->GetDragIndex(), obj);
 }
 
 bool CPhysicsDragController::IsControlling(const CPhysicsObject *obj) const {
-	return m_ents.Find((CPhysicsObject *)obj) != -1;
+	const int index = obj->GetDragIndex();
+	return index >= 0 && index < m_ents.Count() && m_ents[index] == obj;
 }
 
-void CPhysicsDragController::Tick(btScalar dt) {
-	for (int i = 0; i < m_ents.Count(); i++) {
-		CPhysicsObject *pObject = (CPhysicsObject *)m_ents[i];
-		btRigidBody *body = pObject->GetObject();
-		if (body->getActivationState() == ISLAND_SLEEPING || body->getActivationState() == DISABLE_SIMULATION)
-			continue;
+// Empty lanes (NULL) don't drag
+void CPhysicsDragController::StoreLane(int index, const CPhysicsObject *obj) {
+	dragblock_t &block = m_blocks[index / 4];
+	const int lane = index % 4;
 
-		//------------------
-		// LINEAR DRAG
-		//------------------
-		if (!btFuzzyZero(body->getLinearVelocity().length2())) {
-			btVector3 vel(0, 0, 0);
+	const btVector3 basis = obj ? obj->GetDragBasis().absolute() : btVector3(0, 0, 0);
+	const btVector3 angBasis = obj ? obj->GetAngularDragBasis().absolute() : btVector3(0, 0, 0);
+
+	SubFloat(block.dragCoefficient, lane) = obj ? obj->GetDragCoefficient() : 0;
+	SubFloat(block.angDragCoefficient, lane) = obj ? obj->GetAngularDragCoefficient() : 0;
+	for (int i = 0; i < 3; i++) {
+		SubFloat(block.dragBasis[i], lane) = basis[i];
+		SubFloat(block.angDragBasis[i], lane) = angBasis[i];
+	}
+}
 
-			float dragForce = -1 * pObject->GetDragInDirection(body->getLinearVelocity().normalized()) * m_airDensity * dt;
-			if (dragForce < -1.0f)
-				dragForce = -1.0f;
+// Velocity scale for a drag of coefficient * dot(|dir|, basis), where dir = vel * invLength.
+// Same as vel + vel * dragForce, with dragForce clamped to [-1, 0]
+static FORCEINLINE fltx4 DragFactorSIMD(const fltx4 &coefficient, const fltx4 &dot, const fltx4 &length2, const fltx4 &densityDt) {
+	const fltx4 dragForce = MulSIMD(MulSIMD(coefficient, dot), MulSIMD(ReciprocalSqrtSIMD(length2), densityDt));
+	const fltx4 factor = MaxSIMD(Four_Zeros, MinSIMD(Four_Ones, SubSIMD(Four_Ones, dragForce)));
 
-			// If the drag force actually drags
-			if (dragForce < 0)
-				vel = body->getLinearVelocity() * dragForce;
+	// Not moving (btFuzzyZero), no drag
+	return MaskedAssign(CmpGtSIMD(length2, ReplicateX4(SIMD_EPSILON)), factor, Four_Ones);
+}
 
-			body->setLinearVelocity(body->getLinearVelocity() + vel);
+void CPhysicsDragController::Tick(btScalar dt) {
+	const fltx4 densityDt = ReplicateX4(m_airDensity * dt);
+
+	for (int b = 0; b < m_blocks.size(); b++) {
+		const dragblock_t &block = m_blocks[b];
+		const int first = b * 4;
+		const int count = min(4, m_ents.Count() - first);
+
+		// Gather the velocities and orientations of this block
+		fltx4 vel[3], angVel[3], rot[3][3];
+		for (int i = 0; i < 3; i++) {
+			vel[i] = angVel[i] = Four_Zeros;
+			for (int j = 0; j < 3; j++)
+				rot[i][j] = Four_Zeros;
+		}
+
+		for (int lane = 0; lane < count; lane++) {
+			const btRigidBody *body = m_ents[first + lane]->GetObject();
+			if (body->getActivationState() == ISLAND_SLEEPING || body->getActivationState() == DISABLE_SIMULATION)
+				continue; // Zero velocity, factors come out as 1
+
+			const btVector3 &linVel = body->getLinearVelocity();
+			const btVector3 &angularVel = body->getAngularVelocity();
+			const btMatrix3x3 &basis = body->getCenterOfMassTransform().getBasis();
+			for (int i = 0; i < 3; i++) {
+				SubFloat(vel[i], lane) = linVel[i];
+				SubFloat(angVel[i], lane) = angularVel[i];
+				for (int j = 0; j < 3; j++)
+					SubFloat(rot[i][j], lane) = basis[i][j];
+			}
 		}
 
 		//------------------
-		// ANGULAR DRAG
+		// LINEAR DRAG
 		//------------------
-		if (!btFuzzyZero(body->getAngularVelocity().length2())) {
-			btVector3 ang(0, 0, 0);
-
-			float angDragForce = -1 * pObject->GetAngularDragInDirection(body->getAngularVelocity().normalized()) * m_airDensity * dt;
-			if (angDragForce < -1.0f)
-				angDragForce = -1.0f;
+		// Drag basis is in local space (see BtMatrix_vimult)
+		fltx4 dot = Four_Zeros;
+		for (int i = 0; i < 3; i++) {
+			const fltx4 local = AddSIMD(AddSIMD(MulSIMD(rot[0][i], vel[0]), MulSIMD(rot[1][i], vel[1])), MulSIMD(rot[2][i], vel[2]));
+			dot = AddSIMD(dot, MulSIMD(fabs(local), block.dragBasis[i]));
+		}
 
-			// If the drag force actually drags
-			if (angDragForce < 0)
-				ang = body->getAngularVelocity() * angDragForce;
+		const fltx4 length2 = AddSIMD(AddSIMD(MulSIMD(vel[0], vel[0]), MulSIMD(vel[1], vel[1])), MulSIMD(vel[2], vel[2]));
+		const fltx4 linFactor = DragFactorSIMD(block.dragCoefficient, dot, length2, densityDt);
 
-			body->setAngularVelocity(body->getAngularVelocity() + ang);
+		//------------------
+		// ANGULAR DRAG
+		//------------------
+		fltx4 angDot = Four_Zeros;
+		for (int i = 0; i < 3; i++)
+			angDot = AddSIMD(angDot, MulSIMD(fabs(angVel[i]), block.angDragBasis[i]));
+
+		const fltx4 angLength2 = AddSIMD(AddSIMD(MulSIMD(angVel[0], angVel[0]), MulSIMD(angVel[1], angVel[1])), MulSIMD(angVel[2], angVel[2]));
+		const fltx4 angFactor = DragFactorSIMD(block.angDragCoefficient, angDot, angLength2, densityDt);
+
+		// Scatter
+		for (int lane = 0; lane < count; lane++) {
+			const float linScale = SubFloat(linFactor, lane);
+			const float angScale = SubFloat(angFactor, lane);
+			if (linScale == 1.0f && angScale == 1.0f)
+				continue;
+
+			btRigidBody *body = m_ents[first + lane]->GetObject();
+			body->setLinearVelocity(body->getLinearVelocity() * linScale);
+			body->setAngularVelocity(body->getAngularVelocity() * angScale);
 		}
 	}
 }
\ No newline at end of file
@@ -4,8 +4,13 @@
 	#pragma once
 #endif
 
+#include <mathlib/ssemath.h>
+
 class CPhysicsObject;
 
+// Purpose: Air drag for all objects with drag enabled.
+// The drag parameters live here in blocks of 4 objects (one object per SIMD lane),
+// objects know their own index so adding and removing them doesn't search.
 class CPhysicsDragController {
 	public:
 									CPhysicsDragController();
@@ -14,12 +19,23 @@ class CPhysicsDragController {
 
 		void						AddPhysicsObject(CPhysicsObject *pObject);
 		void						RemovePhysicsObject(CPhysicsObject *pObject);
+		void						UpdatePhysicsObject(CPhysicsObject *pObject); // Drag coefficients or basis changed
 		void						Tick(btScalar dt);
 		bool						IsControlling(const CPhysicsObject *pObject) const;
 	private:
+		struct dragblock_t {
+			fltx4					dragCoefficient;
+			fltx4					angDragCoefficient;
+			fltx4					dragBasis[3];		// Absolute values, local space
+			fltx4					angDragBasis[3];	// Absolute values
+		};
+
+		void						StoreLane(int index, const CPhysicsObject *pObject);
+
 		float						m_airDensity;
 
 		CUtlVector<CPhysicsObject *>m_ents;
+		btAlignedObjectArray<dragblock_t> m_blocks;	// m_ents[i] is lane i % 4 of block i / 4
 };
 
 #endif // PHYSICS_DRAGCONTROLLER_H
\ No newline at end of file
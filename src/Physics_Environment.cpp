@@ -14,6 +14,15 @@
 #include "Physics_Constraint.h"
 #include "Physics_Collision.h"
 #include "Physics_VehicleController.h"
+#include "Physics_Solver.h"
+#include "Physics_SimulationLOD.h"
+#include "Physics_WakeQueue.h"
+#include "Physics_SpawnResolver.h"
+#include "Physics_AutoTuner.h"
+#include "Physics_ParallelActions.h"
+#include "Physics_Allocator.h"
+#include "Physics_CollisionPools.h"
+#include "Physics_TaskScheduler.h"
 #include "miscmath.h"
 #include "convert.h"
 
@@ -192,6 +201,70 @@ void SerializeWorld_f(const CCommand &args) {
 
 static ConCommand cmd_serializeworld("bt_serialize", SerializeWorld_f, "Serialize environment by index (usually 0=server, 1=client)\n\tDumps the file out to the exe directory.");
 
+void SolverStats_f(const CCommand &args) {
+	const int index = args.ArgC() > 1 ? atoi(args.Arg(1)) : 0;
+
+	CPhysicsEnvironment *pEnv = (CPhysicsEnvironment *)g_Physics.GetActiveEnvironmentByIndex(index);
+	if (pEnv) {
+		solverstats_t stats;
+		pEnv->GetSolverStats(&stats);
+
+		Msg("Solver stats for the last simulation step (environment %d):\n", index);
+		Msg("  islands: %d\n", stats.islands);
+		Msg("  iterations used: %d of %d allowed (%.2f per island)\n", stats.iterations, stats.budget, stats.islands ? (float)stats.iterations / stats.islands : 0.f);
+		Msg("  max iterations on a single island: %d\n", stats.maxIterations);
+		Msg("  islands converged early: %d\n", stats.earlyExits);
+		Msg("  contacts solved: %d of %d (after contact reduction)\n", stats.reducedContacts, stats.contacts);
+	} else {
+		Warning("Invalid environment index supplied!\n");
+	}
+}
+
+static ConCommand cmd_solverstats("bt_solver_stats", SolverStats_f, "Print how many solver iterations were used in the last simulation step\n\tUsage: bt_solver_stats <index> (usually 0=server, 1=client)");
+
+void PhaseStats_f(const CCommand &args) {
+	const int index = args.ArgC() > 1 ? atoi(args.Arg(1)) : 0;
+
+	CPhysicsEnvironment *pEnv = (CPhysicsEnvironment *)g_Physics.GetActiveEnvironmentByIndex(index);
+	if (pEnv) {
+		phasetimes_t times;
+		pEnv->GetPhaseTimes(&times);
+
+		Msg("Phase timings for the last simulation step (environment %d, %d internal steps):\n", index, times.steps);
+		Msg("  collision: %.3f ms (%d pairs)\n", times.collision * 1000, times.pairs);
+		Msg("  solver: %.3f ms (%d manifolds + constraints)\n", times.solve * 1000, times.solverRows);
+		Msg("  other: %.3f ms\n", (times.step - times.collision - times.solve) * 1000);
+		Msg("  total: %.3f ms\n", times.step * 1000);
+	} else {
+		Warning("Invalid environment index supplied!\n");
+	}
+}
+
+static ConCommand cmd_phasestats("bt_phase_stats", PhaseStats_f, "Print where the time of the last simulation step went\n\tUsage: bt_phase_stats <index> (usually 0=server, 1=client)");
+
+static void PrintPoolStats(const poolstats_t &stats) {
+	Msg("  %s (%d bytes): %d live, peak %d (%d since the last trim), %d allocated in %d chunks, %d oversized\n",
+		stats.pName, stats.elementSize, stats.live, stats.peak, stats.recentPeak, stats.capacity, stats.chunks, stats.oversized);
+}
+
+void CollisionPoolStats_f(const CCommand &args) {
+	const int index = args.ArgC() > 1 ? atoi(args.Arg(1)) : 0;
+
+	CPhysicsEnvironment *pEnv = (CPhysicsEnvironment *)g_Physics.GetActiveEnvironmentByIndex(index);
+	if (pEnv) {
+		poolstats_t manifolds, algorithms;
+		pEnv->GetCollisionPoolStats(&manifolds, &algorithms);
+
+		Msg("Collision pools (environment %d):\n", index);
+		PrintPoolStats(manifolds);
+		PrintPoolStats(algorithms);
+	} else {
+		Warning("Invalid environment index supplied!\n");
+	}
+}
+
+static ConCommand cmd_collisionpoolstats("bt_collision_pool_stats", CollisionPoolStats_f, "Print the usage and high-water marks of the manifold and collision algorithm pools\n\tUsage: bt_collision_pool_stats <index> (usually 0=server, 1=client)");
+
 /*******************************
 * CLASS CObjectTracker
 *******************************/
@@ -238,6 +311,11 @@ class CObjectTracker {
 					continue;
 				}
 
+				// Objects held by the simulation LOD are still awake as far as the game is concerned
+				if (pObj->GetLodState().held) {
+					continue;
+				}
+
 				if (colObjArray[i]->getActivationState() != pObj->GetLastActivationState()) {
 					const int newState = colObjArray[i]->getActivationState();
 
@@ -551,7 +629,7 @@ static void cvar_solver_iterations_Change(IConVar *var, const char *pOldValue, f
 
 // bt_solver_residualthreshold
 static void cvar_solver_residualthreshold_Change(IConVar *var, const char *pOldValue, float flOldValue);
-static ConVar cvar_solver_residualthreshold("bt_solver_residualthreshold", "0.0", FCVAR_REPLICATED, "Solver leastSquaresResidualThreshold (used to run fewer solver iterations when convergence is good)", true, 0.0f, true, 0.25f, cvar_solver_residualthreshold_Change);
+static ConVar cvar_solver_residualthreshold("bt_solver_residualthreshold", "0.0", FCVAR_REPLICATED, "Solver leastSquaresResidualThreshold (used to run fewer solver iterations when convergence is good, 0 to always run them all, around 0.0001 lets islands stop early)", true, 0.0f, true, 0.25f, cvar_solver_residualthreshold_Change);
 static void cvar_solver_residualthreshold_Change(IConVar *var, const char *pOldValue, float flOldValue)
 {
 	if (gBulletDynamicsWorld)
@@ -561,6 +639,19 @@ static void cvar_solver_residualthreshold_Change(IConVar *var, const char *pOldV
 	}
 }
 
+// bt_speculative_margin
+static void cvar_speculative_margin_Change(IConVar *var, const char *pOldValue, float flOldValue);
+static ConVar cvar_speculative_margin("bt_speculative_margin", "2", FCVAR_REPLICATED, "Distance (in inches) at which contacts are created before objects touch, so the solver can stop them without penetrating. Applies to new contacts", true, 0.1f, true, 16.0f, cvar_speculative_margin_Change);
+static void cvar_speculative_margin_Change(IConVar *var, const char *pOldValue, float flOldValue)
+{
+	for (int i = 0; i < g_Physics.GetActiveEnvironmentCount(); i++) {
+		CPhysicsEnvironment *pEnv = (CPhysicsEnvironment *)g_Physics.GetActiveEnvironmentByIndex(i);
+		pEnv->SetContactBreakingThreshold(ConvertDistanceToBull(cvar_speculative_margin.GetFloat()));
+	}
+
+	Msg("Speculative contact margin is changed from %f to %f\n", flOldValue, cvar_speculative_margin.GetFloat());
+}
+
 // bt_substeps
 static ConVar cvar_world_substeps("bt_world_substeps", "1", FCVAR_REPLICATED, "The amount of simulation substeps (higher number means higher precision)", true, 1, true, 8);
 
@@ -569,7 +660,7 @@ static ConVar cvar_world_substeps("bt_world_substeps", "1", FCVAR_REPLICATED, "T
 
 // bt_threadcount
 static void cvar_threadcount_Change(IConVar *var, const char *pOldValue, float flOldValue);
-static ConVar cvar_threadcount("bt_threadcount", "1", FCVAR_REPLICATED, "Number of cores utilized by bullet task scheduler. By default, TBB sets this to optimal value", true, 1, true, static_cast<float>(BT_MAX_THREAD_COUNT), cvar_threadcount_Change);
+static ConVar cvar_threadcount("bt_threadcount", "1", FCVAR_REPLICATED, "Number of cores utilized by the physics task scheduler. Defaults to all logical cores (or all threads of the engine's thread provider)", true, 1, true, static_cast<float>(BT_MAX_THREAD_COUNT), cvar_threadcount_Change);
 static void cvar_threadcount_Change(IConVar *var, const char *pOldValue, float flOldValue)
 {
 	const int newNumThreads = min(cvar_threadcount.GetInt(), int(BT_MAX_THREAD_COUNT));
@@ -584,7 +675,7 @@ static void cvar_threadcount_Change(IConVar *var, const char *pOldValue, float f
 
 // bt_island_batchingthreshold
 static void cvar_island_batchingthreshold_Change(IConVar *var, const char *pOldValue, float flOldValue);
-static ConVar cvar_island_batchingthreshold("bt_solver_islandbatchingthreshold", std::to_string(btSequentialImpulseConstraintSolverMt::s_minimumContactManifoldsForBatching).c_str(), FCVAR_REPLICATED, "If the number of manifolds that an island have reaches to that value, they will get batched", true, 1, true, 2000, cvar_island_batchingthreshold_Change);
+static ConVar cvar_island_batchingthreshold("bt_solver_islandbatchingthreshold", std::to_string(btSequentialImpulseConstraintSolverMt::s_minimumContactManifoldsForBatching).c_str(), FCVAR_REPLICATED, "Islands with at least this many manifolds + constraints are split into batches and solved on all threads", true, 1, true, 2000, cvar_island_batchingthreshold_Change);
 static void cvar_island_batchingthreshold_Change(IConVar *var, const char *pOldValue, float flOldValue)
 {
 	btSequentialImpulseConstraintSolverMt::s_minimumContactManifoldsForBatching = cvar_island_batchingthreshold.GetInt();
@@ -627,6 +718,7 @@ static void cvar_solver_maxbatchsize_Change(IConVar *var, const char *pOldValue,
 CPhysicsEnvironment::CPhysicsEnvironment() {
 	m_multithreadedWorld = false;
 	m_multithreadCapable = false;
+	m_poolThreadCount = 0;
 	m_deleteQuick		= false;
 	m_bUseDeleteQueue	= false;
 	m_inSimulation		= false;
@@ -641,21 +733,25 @@ CPhysicsEnvironment::CPhysicsEnvironment() {
 	m_pBulletBroadphase		= NULL;
 	m_pBulletConfiguration	= NULL;
 	m_pBulletDispatcher		= NULL;
+	m_pDispatcherPools		= NULL;
 	m_pBulletDynamicsWorld	= NULL;
 	m_pBulletGhostCallback	= NULL;
 	m_pBulletSolver			= NULL;
+	m_pPhaseTimer			= NULL;
+	m_pAutoTuner			= NULL;
 
 	m_timestep = 0.f;
+	m_nextSolveOrder = 0;
 	m_invPSIScale = 0.f;
 	m_simPSICurrent = 0;
 	m_simPSI = 0;
 
 #ifdef BT_THREADSAFE
-	// Initilize task scheduler, we will be using TBB
+	// Initilize task scheduler, we use our own (see CTaskScheduler)
 	// btSetTaskScheduler(btGetSequentialTaskScheduler()); // Can be used for debugging purposes
-	btSetTaskScheduler(btGetTBBTaskScheduler());
-	const int maxNumThreads = btGetTBBTaskScheduler()->getMaxNumThreads();
-	btGetTBBTaskScheduler()->setNumThreads(maxNumThreads);
+	btSetTaskScheduler(GetPhysicsTaskScheduler());
+	const int maxNumThreads = btGetTaskScheduler()->getMaxNumThreads();
+	btGetTaskScheduler()->setNumThreads(maxNumThreads);
 	cvar_threadcount.SetValue(maxNumThreads);
 #endif
 	
@@ -678,6 +774,13 @@ CPhysicsEnvironment::~CPhysicsEnvironment() {
 
 	delete m_pDeleteQueue;
 	delete m_pPhysicsDragController;
+	delete m_pUserConstraintBatch;
+	delete m_pSimulationLOD;
+	delete m_pWakeQueue;
+	delete m_pSpawnResolver;
+	m_pBulletDynamicsWorld->removeAction(m_pVehicleRaycastBatch);
+	delete m_pVehicleRaycastBatch;
+	delete m_pAutoTuner; // Restores tuned values, before the dispatcher goes away
 
 	delete m_pBulletDynamicsWorld;
 	delete m_pBulletSolver;
@@ -691,15 +794,103 @@ CPhysicsEnvironment::~CPhysicsEnvironment() {
 	delete m_pObjectTracker;
 }
 
+// Purpose: Collision dispatcher that takes its manifolds and collision algorithms from growable pools.
+// btPoolAllocator can't be swapped out, so the allocation hooks are overridden and the manifold bookkeeping
+// of btCollisionDispatcher is done here.
+class CCollisionDispatcher : public btCollisionDispatcher, public CDispatcherPools {
+	public:
+		CCollisionDispatcher(btCollisionConfiguration *config) : btCollisionDispatcher(config), CDispatcherPools(config) {}
+
+		btPersistentManifold *getNewManifold(const btCollisionObject *body0, const btCollisionObject *body1) override {
+			btPersistentManifold *manifold = NewManifold(body0, body1, m_dispatcherFlags);
+			manifold->m_index1a = m_manifoldsPtr.size();
+			m_manifoldsPtr.push_back(manifold);
+			return manifold;
+		}
+
+		void releaseManifold(btPersistentManifold *manifold) override {
+			clearManifold(manifold);
+
+			const int findIndex = manifold->m_index1a;
+			btAssert(findIndex < m_manifoldsPtr.size());
+			m_manifoldsPtr.swap(findIndex, m_manifoldsPtr.size() - 1);
+			m_manifoldsPtr[findIndex]->m_index1a = findIndex;
+			m_manifoldsPtr.pop_back();
+
+			DeleteManifold(manifold);
+		}
+
+		void *allocateCollisionAlgorithm(int size) override { return AllocAlgorithm(size); }
+		void freeCollisionAlgorithm(void *ptr) override { FreeAlgorithm(ptr); }
+};
+
+#ifdef BT_THREADSAFE
+// Dispatcher generates around 360 pair objects on average. Maximize thread usage by using this value
+static int ComputeDispatcherGrainSize(int numThreads) {
+	return 360 / max(numThreads, 1) + 1;
+}
+
+// Purpose: btCollisionDispatcherMt sizes its per thread manifold lists and grain size only once,
+// this one can be retuned between steps when the thread count changes. Uses the growable pools too.
+class CCollisionDispatcherMt : public btCollisionDispatcherMt, public CDispatcherPools {
+	public:
+		CCollisionDispatcherMt(btCollisionConfiguration *config, int numThreads) : btCollisionDispatcherMt(config, ComputeDispatcherGrainSize(numThreads)), CDispatcherPools(config) {}
+
+		// While dispatching, new and released manifolds go to the per thread lists and are merged afterwards
+		btPersistentManifold *getNewManifold(const btCollisionObject *body0, const btCollisionObject *body1) override {
+			btPersistentManifold *manifold = NewManifold(body0, body1, m_dispatcherFlags);
+			if (m_batchUpdating) {
+				m_batchManifoldsPtr[GetPhysicsThreadSlot()].push_back(manifold);
+			} else {
+				manifold->m_index1a = m_manifoldsPtr.size();
+				m_manifoldsPtr.push_back(manifold);
+			}
+
+			return manifold;
+		}
+
+		void releaseManifold(btPersistentManifold *manifold) override {
+			clearManifold(manifold);
+
+			// Released again once the batch is merged
+			if (m_batchUpdating) {
+				m_batchReleasePtr[GetPhysicsThreadSlot()].push_back(manifold);
+				return;
+			}
+
+			const int findIndex = manifold->m_index1a;
+			btAssert(findIndex < m_manifoldsPtr.size());
+			m_manifoldsPtr.swap(findIndex, m_manifoldsPtr.size() - 1);
+			m_manifoldsPtr[findIndex]->m_index1a = findIndex;
+			m_manifoldsPtr.pop_back();
+
+			DeleteManifold(manifold);
+		}
+
+		void *allocateCollisionAlgorithm(int size) override { return AllocAlgorithm(size); }
+		void freeCollisionAlgorithm(void *ptr) override { FreeAlgorithm(ptr); }
+
+		// NOTE: Never call this while dispatching, the per thread lists must be empty
+		void SetNumThreads(int numThreads) {
+			m_batchManifoldsPtr.resize(numThreads);
+			m_batchReleasePtr.resize(numThreads);
+			m_grainSize = ComputeDispatcherGrainSize(numThreads);
+		}
+
+		// For the auto-tuner
+		int &GetGrainSize() { return m_grainSize; }
+};
+#endif
+
 btConstraintSolver* createSolverByType(SolverType t)
 {
 	btMLCPSolverInterface* mlcpSolver = NULL;
 	switch (t)
 	{
 		case SOLVER_TYPE_SEQUENTIAL_IMPULSE:
-			return new btSequentialImpulseConstraintSolver();
+			return new CAdaptiveSolver<btSequentialImpulseConstraintSolver>();
 		case SOLVER_TYPE_SEQUENTIAL_IMPULSE_MT:
-			return new btSequentialImpulseConstraintSolverMt();
+			return new CParallelIslandSolver();
 		case SOLVER_TYPE_NNCG:
 			return new btNNCGConstraintSolver();
 		case SOLVER_TYPE_MLCP_PGS:
@@ -736,6 +927,7 @@ void CPhysicsEnvironment::CreateEmptyDynamicsWorld()
 	m_pCollisionListener = new CCollisionEventListener(this);
 	
 	m_solverType = gSolverType;
+	m_pWakeQueue = new CWakeQueue(this); // Hooked into the world
 #ifdef BT_THREADSAFE
 	btAssert(btGetTaskScheduler() != NULL);
 	if (btGetTaskScheduler() != NULL && btGetTaskScheduler()->getNumThreads() > 1)
@@ -750,50 +942,47 @@ void CPhysicsEnvironment::CreateEmptyDynamicsWorld()
 
 		m_pBulletDispatcher = NULL;
 		btDefaultCollisionConstructionInfo cci;
-		cci.m_defaultMaxPersistentManifoldPoolSize = 80000;
-		cci.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+		cci.m_defaultMaxPersistentManifoldPoolSize = 1;	// The dispatcher has its own growable pools
+		cci.m_defaultMaxCollisionAlgorithmPoolSize = 1;
 		m_pBulletConfiguration = new btDefaultCollisionConfiguration(cci);
 
-		// Dispatcher generates around 360 pair objects on average. Maximize thread usage by using this value
-		m_pBulletDispatcher = new btCollisionDispatcherMt(m_pBulletConfiguration, 360 / cvar_threadcount.GetInt() + 1);
+		const int threadCount = btGetTaskScheduler()->getNumThreads();
+		CCollisionDispatcherMt *pDispatcher = new CCollisionDispatcherMt(m_pBulletConfiguration, threadCount);
+		m_pBulletDispatcher = pDispatcher;
+		m_pDispatcherPools = pDispatcher;
 		m_pBulletBroadphase = new btDbvtBroadphase();
 
 		// Enable deferred collide, increases performance with many collisions calculations going on at the same time
 		static_cast<btDbvtBroadphase*>(m_pBulletBroadphase)->m_deferedcollide = true;
 
-		btConstraintSolverPoolMt* solverPool;
-		{
-			SolverType poolSolverType = m_solverType;
-			if (poolSolverType == SOLVER_TYPE_SEQUENTIAL_IMPULSE_MT)
-			{
-				// pool solvers shouldn't be parallel solvers, we don't allow that kind of
-				// nested parallelism because of performance issues
-				poolSolverType = SOLVER_TYPE_SEQUENTIAL_IMPULSE;
-			}
-			CUtlVector<btConstraintSolver*> solvers;
-			const int threadCount = cvar_threadcount.GetInt();
-			for (int i = 0; i < threadCount; ++i)
-			{
-				auto solver = createSolverByType(poolSolverType);
-				solver->setSolveCallback(m_pCollisionListener);
-				solvers.AddToTail(solver);
-			}
-			solverPool = new btConstraintSolverPoolMt(solvers.Base(), threadCount);
-			m_pBulletSolver = solverPool;
-			
-			m_pBulletSolver->setSolveCallback(m_pCollisionListener);
-		}
+		btConstraintSolverPoolMt* solverPool = CreateSolverPool(threadCount);
+		m_pBulletSolver = solverPool;
+
 		btSequentialImpulseConstraintSolverMt* solverMt = NULL;
 		if (m_solverType == SOLVER_TYPE_SEQUENTIAL_IMPULSE_MT)
 		{
-			solverMt = new btSequentialImpulseConstraintSolverMt();
+			solverMt = static_cast<btSequentialImpulseConstraintSolverMt*>(createSolverByType(SOLVER_TYPE_SEQUENTIAL_IMPULSE_MT));
+			solverMt->setSolveCallback(m_pCollisionListener); // Large islands raise collision events too
+			AddSolverStatsTracker(solverMt);
+			ApplySolverBatchingMethod();
 		}
-		btDiscreteDynamicsWorld* world = new btDiscreteDynamicsWorldMt(m_pBulletDispatcher, m_pBulletBroadphase, solverPool, solverMt, m_pBulletConfiguration);
+		CTimedDynamicsWorld<CParallelActionWorld<CWakeBudgetWorld<btDiscreteDynamicsWorldMt> > >* world = new CTimedDynamicsWorld<CParallelActionWorld<CWakeBudgetWorld<btDiscreteDynamicsWorldMt> > >(m_pBulletDispatcher, m_pBulletBroadphase, solverPool, solverMt, m_pBulletConfiguration);
 		m_pBulletDynamicsWorld = world;
+		m_pPhaseTimer = world;
+		world->SetWakeQueue(m_pWakeQueue);
+
+		// Giant islands (piles) are solved in parallel too, not just many small ones
+		static_cast<btSimulationIslandManagerMt*>(world->getSimulationIslandManager())->setIslandDispatchFunction(LargeIslandDispatch);
 		m_pBulletDynamicsWorld->setForceUpdateAllAabbs(false);
 		
 		gBulletDynamicsWorld = world; // Also keep a static ref for ConVar callbacks
 		m_multithreadedWorld = true;
+
+		m_pAutoTuner = new CAutoTuner;
+		m_pAutoTuner->AddParameter("dispatcher grain size", &static_cast<CCollisionDispatcherMt*>(m_pBulletDispatcher)->GetGrainSize(), 1, 1000, TUNER_PHASE_COLLISION, false);
+		m_pAutoTuner->AddParameter("solver min batch size", &btSequentialImpulseConstraintSolverMt::s_minBatchSize, 1, 1000, TUNER_PHASE_SOLVE, true, NULL, &btSequentialImpulseConstraintSolverMt::s_maxBatchSize);
+		m_pAutoTuner->AddParameter("solver max batch size", &btSequentialImpulseConstraintSolverMt::s_maxBatchSize, 1, 1000, TUNER_PHASE_SOLVE, true, &btSequentialImpulseConstraintSolverMt::s_minBatchSize, NULL);
+		m_pAutoTuner->AddParameter("island batching threshold", &btSequentialImpulseConstraintSolverMt::s_minimumContactManifoldsForBatching, 1, 2000, TUNER_PHASE_SOLVE, true);
 #endif  // #if BT_THREADSAFE
 	}
 	else
@@ -802,10 +991,14 @@ void CPhysicsEnvironment::CreateEmptyDynamicsWorld()
 		m_multithreadedWorld = false;
 
 		///collision configuration contains default setup for memory, collision setup
-		m_pBulletConfiguration = new btDefaultCollisionConfiguration();
+		btDefaultCollisionConstructionInfo cci;
+		cci.m_defaultMaxPersistentManifoldPoolSize = 1;	// The dispatcher has its own growable pools
+		cci.m_defaultMaxCollisionAlgorithmPoolSize = 1;
+		m_pBulletConfiguration = new btDefaultCollisionConfiguration(cci);
 
-		// Use the default collision dispatcher. For parallel processing you can use a different dispatcher (see Extras/BulletMultiThreaded)
-		m_pBulletDispatcher = new btCollisionDispatcher(m_pBulletConfiguration);
+		CCollisionDispatcher *pDispatcher = new CCollisionDispatcher(m_pBulletConfiguration);
+		m_pBulletDispatcher = pDispatcher;
+		m_pDispatcherPools = pDispatcher;
 
 		m_pBulletBroadphase = new btDbvtBroadphase();
 
@@ -818,11 +1011,19 @@ void CPhysicsEnvironment::CreateEmptyDynamicsWorld()
 		}
 		m_pBulletSolver = createSolverByType(solverType);
 		m_pBulletSolver->setSolveCallback(m_pCollisionListener);
+		AddSolverStatsTracker(m_pBulletSolver);
+
+		CTimedDynamicsWorld<CParallelActionWorld<CWakeBudgetWorld<btDiscreteDynamicsWorld> > >* world = new CTimedDynamicsWorld<CParallelActionWorld<CWakeBudgetWorld<btDiscreteDynamicsWorld> > >(m_pBulletDispatcher, m_pBulletBroadphase, m_pBulletSolver, m_pBulletConfiguration);
+		m_pBulletDynamicsWorld = world;
+		m_pPhaseTimer = world;
+		world->SetWakeQueue(m_pWakeQueue);
 
-		m_pBulletDynamicsWorld = new btDiscreteDynamicsWorld(m_pBulletDispatcher, m_pBulletBroadphase, m_pBulletSolver, m_pBulletConfiguration);
+		// Nothing to tune here
+		m_pAutoTuner = new CAutoTuner;
 	}
 	m_pBulletDynamicsWorld->getSolverInfo().m_solverMode = gSolverMode;
 	m_pBulletDynamicsWorld->getSolverInfo().m_numIterations = cvar_solver_iterations.GetInt();
+	m_pBulletDynamicsWorld->getSolverInfo().m_leastSquaresResidualThreshold = cvar_solver_residualthreshold.GetFloat();
 	
 	m_pBulletGhostCallback = new btGhostPairCallback;
 	m_pCollisionSolver = new CCollisionSolver(this);
@@ -831,6 +1032,14 @@ void CPhysicsEnvironment::CreateEmptyDynamicsWorld()
 
 	m_pDeleteQueue = new CDeleteQueue;
 	m_pPhysicsDragController = new CPhysicsDragController;
+	m_pUserConstraintBatch = new CUserConstraintBatch(this);
+	m_pSimulationLOD = new CSimulationLOD(this);
+	m_pSpawnResolver = new CSpawnResolver(this);
+
+	// Before any vehicle, actions are updated in the order they were added
+	m_pVehicleRaycastBatch = new CVehicleRaycastBatch(this);
+	m_pBulletDynamicsWorld->addAction(m_pVehicleRaycastBatch);
+
 	m_pObjectTracker = new CObjectTracker(this, NULL);
 
 	m_perfparams.Defaults();
@@ -841,7 +1050,16 @@ void CPhysicsEnvironment::CreateEmptyDynamicsWorld()
 	m_pBulletDynamicsWorld->getDispatchInfo().m_allowedCcdPenetration = 0.0001f;
 	m_pBulletDynamicsWorld->setApplySpeculativeContactRestitution(true);
 
+	// Contacts closer than this are solved speculatively (positive distance), this is what keeps
+	// objects from tunneling when CCD doesn't kick in (see CPhysicsObject::ComputeCcdParams)
+	SetContactBreakingThreshold(ConvertDistanceToBull(cvar_speculative_margin.GetFloat()));
+
+	// The margin is a distance, not a factor of the object's size (Bullet's default would scale it down to almost
+	// nothing on the small objects it matters most for)
+	m_pBulletDispatcher->setDispatcherFlags(m_pBulletDispatcher->getDispatcherFlags() & ~btCollisionDispatcher::CD_USE_RELATIVE_CONTACT_BREAKING_THRESHOLD);
+
 	m_pBulletDynamicsWorld->setInternalTickCallback(TickCallback, (void *)this);
+	m_pBulletDynamicsWorld->setInternalTickCallback(PreTickCallback, (void *)this, true);
 
 #if DEBUG_DRAW
 	m_debugdraw = new CDebugDrawer(m_pBulletDynamicsWorld);
@@ -861,6 +1079,15 @@ void CPhysicsEnvironment::TickCallback(btDynamicsWorld *world, btScalar timeStep
 		pEnv->BulletTick(timeStep);
 }
 
+// Don't call this directly
+void CPhysicsEnvironment::PreTickCallback(btDynamicsWorld *world, btScalar timeStep) {
+	if (!world) return;
+
+	CPhysicsEnvironment *pEnv = static_cast<CPhysicsEnvironment*>(world->getWorldUserInfo());
+	if (pEnv)
+		pEnv->BulletPreTick(timeStep);
+}
+
 IVPhysicsDebugOverlay *g_pDebugOverlay = NULL;
 void CPhysicsEnvironment::SetDebugOverlay(CreateInterfaceFn debugOverlayFactory) {
 	if (debugOverlayFactory && !g_pDebugOverlay)
@@ -904,8 +1131,9 @@ float CPhysicsEnvironment::GetAirDensity() const {
 }
 
 IPhysicsObject *CPhysicsEnvironment::CreatePolyObject(const CPhysCollide *pCollisionModel, int materialIndex, const Vector &position, const QAngle &angles, objectparams_t *pParams) {
-	IPhysicsObject *pObject = CreatePhysicsObject(this, pCollisionModel, materialIndex, position, angles, pParams, false);
+	CPhysicsObject *pObject = CreatePhysicsObject(this, pCollisionModel, materialIndex, position, angles, pParams, false);
 	m_objects.AddToTail(pObject);
+	m_pSpawnResolver->ObjectCreated(pObject);
 	return pObject;
 }
 
@@ -917,8 +1145,11 @@ IPhysicsObject *CPhysicsEnvironment::CreatePolyObjectStatic(const CPhysCollide *
 
 // Deprecated. Create a sphere model using collision interface.
 IPhysicsObject *CPhysicsEnvironment::CreateSphereObject(float radius, int materialIndex, const Vector &position, const QAngle &angles, objectparams_t *pParams, bool isStatic) {
-	IPhysicsObject *pObject = CreatePhysicsSphere(this, radius, materialIndex, position, angles, pParams, isStatic);
+	CPhysicsObject *pObject = CreatePhysicsSphere(this, radius, materialIndex, position, angles, pParams, isStatic);
 	m_objects.AddToTail(pObject);
+	if (!isStatic)
+		m_pSpawnResolver->ObjectCreated(pObject);
+
 	return pObject;
 }
 
@@ -928,6 +1159,9 @@ void CPhysicsEnvironment::DestroyObject(IPhysicsObject *pObject) {
 
 	m_objects.FindAndRemove(pObject);
 	m_pObjectTracker->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
+	m_pWakeQueue->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
+	m_pSpawnResolver->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
+	m_pVehicleRaycastBatch->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
 
 	if (m_inSimulation || m_bUseDeleteQueue) {
 		// We're still in the simulation, so deleting an object would be disastrous here. Queue it!
@@ -1036,17 +1270,20 @@ void CPhysicsEnvironment::DestroyConstraint(IPhysicsConstraint *pConstraint) {
 }
 
 IPhysicsConstraintGroup *CPhysicsEnvironment::CreateConstraintGroup(const constraint_groupparams_t &groupParams) {
-	return ::CreateConstraintGroup(this, groupParams);
+	CPhysicsConstraintGroup *pGroup = ::CreateConstraintGroup(this, groupParams);
+	m_constraintGroups.AddToTail(pGroup);
+	return pGroup;
 }
 
 void CPhysicsEnvironment::DestroyConstraintGroup(IPhysicsConstraintGroup *pGroup) {
+	m_constraintGroups.FindAndRemove((CPhysicsConstraintGroup *)pGroup);
 	delete pGroup;
 }
 
 IPhysicsShadowController *CPhysicsEnvironment::CreateShadowController(IPhysicsObject *pObject, bool allowTranslation, bool allowRotation) {
 	CShadowController *pController = ::CreateShadowController(pObject, allowTranslation, allowRotation);
 	if (pController)
-		m_controllers.AddToTail(pController);
+		m_shadowControllers.AddToTail(pController);
 
 	return pController;
 }
@@ -1054,14 +1291,14 @@ IPhysicsShadowController *CPhysicsEnvironment::CreateShadowController(IPhysicsOb
 void CPhysicsEnvironment::DestroyShadowController(IPhysicsShadowController *pController) {
 	if (!pController) return;
 
-	m_controllers.FindAndRemove(static_cast<CShadowController*>(pController));
+	m_shadowControllers.FindAndRemove(static_cast<CShadowController*>(pController));
 	delete pController;
 }
 
 IPhysicsPlayerController *CPhysicsEnvironment::CreatePlayerController(IPhysicsObject *pObject) {
 	CPlayerController *pController = ::CreatePlayerController(this, pObject);
 	if (pController)
-		m_controllers.AddToTail(pController);
+		m_playerControllers.AddToTail(pController);
 
 	return pController;
 }
@@ -1069,7 +1306,7 @@ IPhysicsPlayerController *CPhysicsEnvironment::CreatePlayerController(IPhysicsOb
 void CPhysicsEnvironment::DestroyPlayerController(IPhysicsPlayerController *pController) {
 	if (!pController) return;
 
-	m_controllers.FindAndRemove(dynamic_cast<CPlayerController*>(pController));
+	m_playerControllers.FindAndRemove(dynamic_cast<CPlayerController*>(pController));
 	delete pController;
 }
 
@@ -1119,6 +1356,21 @@ void CPhysicsEnvironment::Simulate(float deltaTime) {
 	m_simPSICurrent = m_simPSI; // Substeps left in this step
 	m_numSubSteps = m_simPSI;
 	m_curSubStep = 0;
+
+	// Pick up bt_threadcount changes before the step (the solvers and dispatcher are idle now)
+	UpdateThreadCount();
+
+	// Solver stats are reported per simulation step
+	for (int i = 0; i < m_solverStatsTrackers.Count(); i++)
+		m_solverStatsTrackers[i]->ClearStats();
+
+	// Constraint groups add their extra iterations on top of bt_solver_iterations
+	for (int i = 0; i < m_constraintGroups.Count(); i++)
+		m_constraintGroups[i]->UpdateSolverIterations();
+
+	// So are broken constraints and phase timings
+	m_brokenConstraints.RemoveAll();
+	m_pPhaseTimer->ClearPhaseTimes();
 	
 	// Simulate no less than 1 ms
 	if (deltaTime > 0.0001) {
@@ -1126,6 +1378,9 @@ void CPhysicsEnvironment::Simulate(float deltaTime) {
 		// so we don't end up doing stupid things like deleting objects still in use
 		m_inSimulation = true;
 
+		// Transient allocations of the step come from the frame arenas
+		CAllocatorFrame allocatorFrame;
+
 		m_subStepTime = m_timestep;
 		
 		// Okay, how this fixed timestep shit works:
@@ -1137,8 +1392,19 @@ void CPhysicsEnvironment::Simulate(float deltaTime) {
 
 		// No longer in simulation!
 		m_inSimulation = false;
+
+		if (m_curSubStep > 0) {
+			CheckBreakableConstraints(m_curSubStep);
+			m_pAutoTuner->Tick(m_pPhaseTimer->GetPhaseTimes());
+			m_pDispatcherPools->Tick();
+		}
 	}
 
+#ifdef BT_THREADSAFE
+	// The game runs until the next step, don't keep the workers spinning
+	btGetTaskScheduler()->sleepWorkerThreadsHint();
+#endif
+
 #if DEBUG_DRAW
 	m_debugdraw->DrawWorld();
 #endif
@@ -1222,6 +1488,9 @@ bool CPhysicsEnvironment::TransferObject(IPhysicsObject *pObject, IPhysicsEnviro
 		return true;
 	} else {
 		m_objects.FindAndRemove(pObject);
+		m_pWakeQueue->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
+		m_pSpawnResolver->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
+		m_pVehicleRaycastBatch->ObjectRemoved(dynamic_cast<CPhysicsObject*>(pObject));
 		if (pObject->IsFluid())
 			m_fluids.FindAndRemove(dynamic_cast<CPhysicsObject*>(pObject)->GetFluidController());
 
@@ -1396,6 +1665,43 @@ void CPhysicsEnvironment::DebugCheckContacts() {
 	
 }
 
+void CPhysicsEnvironment::SetUserConstraintBatchHandler(IPhysicsUserConstraintBatch *pHandler) {
+	m_pUserConstraintBatch->SetHandler(pHandler);
+}
+
+void CPhysicsEnvironment::SetSimulationViewers(const Vector *pPositions, int count) {
+	m_pSimulationLOD->SetViewers(pPositions, count);
+}
+
+void CPhysicsEnvironment::UpdateShadowControllers(IPhysicsShadowController **pControllers, const Vector *pPositions, const QAngle *pAngles, const float *pTimeOffsets, int count) {
+	if (!pControllers || !pPositions || !pAngles || !pTimeOffsets) return;
+
+	for (int i = 0; i < count; i++) {
+		if (pControllers[i])
+			static_cast<CShadowController *>(pControllers[i])->CShadowController::Update(pPositions[i], pAngles[i], pTimeOffsets[i]);
+	}
+}
+
+void CPhysicsEnvironment::SetMotionEventBatchHandler(IPhysicsMotionController *pController, IMotionEventBatch *pHandler) {
+	if (!pController) return;
+
+	static_cast<CPhysicsMotionController *>(pController)->SetBatchHandler(pHandler);
+}
+
+int CPhysicsEnvironment::GetBrokenConstraintCount() const {
+	return m_brokenConstraints.Count();
+}
+
+int CPhysicsEnvironment::GetBrokenConstraints(IPhysicsConstraint **pOutputConstraintList, int maxCount) const {
+	if (!pOutputConstraintList) return 0;
+
+	const int count = min(maxCount, m_brokenConstraints.Count());
+	for (int i = 0; i < count; i++)
+		pOutputConstraintList[i] = m_brokenConstraints[i];
+
+	return count;
+}
+
 // UNEXPOSED
 btDiscreteDynamicsWorld *CPhysicsEnvironment::GetBulletEnvironment() const
 {
@@ -1408,6 +1714,22 @@ float CPhysicsEnvironment::GetInvPSIScale() const
 	return m_invPSIScale;
 }
 
+// UNEXPOSED
+// Called before each internal simulation step (before collision detection and the solver)
+void CPhysicsEnvironment::BulletPreTick(btScalar dt) {
+	// Hold/release far away objects before anything looks at them
+	m_pSimulationLOD->PreTick(dt);
+
+	// Wake up objects that were kept asleep by the wake budget in earlier ticks
+	m_pWakeQueue->PreTick();
+
+	// Get new objects out of whatever they were spawned into before the first collision detection
+	m_pSpawnResolver->PreTick();
+
+	// Evaluate the user constraints here, so the solver doesn't have to call into the game
+	m_pUserConstraintBatch->Gather(dt);
+}
+
 // UNEXPOSED
 void CPhysicsEnvironment::BulletTick(btScalar dt) {
 	// Dirty hack to spread the controllers throughout the current simulation step
@@ -1420,6 +1742,9 @@ void CPhysicsEnvironment::BulletTick(btScalar dt) {
 
 	m_pPhysicsDragController->Tick(dt);
 
+	TickShadowControllers(m_shadowControllers.Base(), m_shadowControllers.Count(), dt);
+	TickPlayerControllers(this, m_playerControllers.Base(), m_playerControllers.Count(), dt);
+
 	for (int i = 0; i < m_controllers.Count(); i++)
 		m_controllers[i]->Tick(dt);
 
@@ -1444,6 +1769,150 @@ void CPhysicsEnvironment::BulletTick(btScalar dt) {
 	m_curSubStep++;
 }
 
+// UNEXPOSED
+void CPhysicsEnvironment::AddSolverStatsTracker(btConstraintSolver *pSolver) {
+	// Only our own solvers keep track of their iterations
+	CSolverStatsTracker *pTracker = dynamic_cast<CSolverStatsTracker*>(pSolver);
+	if (pTracker)
+		m_solverStatsTrackers.AddToTail(pTracker);
+}
+
+// UNEXPOSED
+void CPhysicsEnvironment::RemoveSolverStatsTracker(btConstraintSolver *pSolver) {
+	CSolverStatsTracker *pTracker = dynamic_cast<CSolverStatsTracker*>(pSolver);
+	if (pTracker)
+		m_solverStatsTrackers.FindAndRemove(pTracker);
+}
+
+#ifdef BT_THREADSAFE
+// UNEXPOSED
+btConstraintSolverPoolMt *CPhysicsEnvironment::CreateSolverPool(int numThreads) {
+	SolverType poolSolverType = m_solverType;
+	if (poolSolverType == SOLVER_TYPE_SEQUENTIAL_IMPULSE_MT) {
+		// pool solvers shouldn't be parallel solvers, we don't allow that kind of
+		// nested parallelism because of performance issues
+		poolSolverType = SOLVER_TYPE_SEQUENTIAL_IMPULSE;
+	}
+
+	m_poolSolvers.RemoveAll();
+	for (int i = 0; i < numThreads; ++i) {
+		btConstraintSolver *pSolver = createSolverByType(poolSolverType);
+		pSolver->setSolveCallback(m_pCollisionListener);
+		m_poolSolvers.AddToTail(pSolver);
+		AddSolverStatsTracker(pSolver);
+	}
+
+	btConstraintSolverPoolMt *pSolverPool = new btConstraintSolverPoolMt(m_poolSolvers.Base(), numThreads);
+	pSolverPool->setSolveCallback(m_pCollisionListener);
+	m_poolThreadCount = numThreads;
+	return pSolverPool;
+}
+#endif
+
+// UNEXPOSED
+// Retune everything that was sized for the thread count when the world was created.
+// Called between steps, so nothing is being dispatched or solved right now.
+void CPhysicsEnvironment::UpdateThreadCount() {
+#ifdef BT_THREADSAFE
+	if (!m_multithreadedWorld)
+		return;
+
+	const int numThreads = btGetTaskScheduler()->getNumThreads();
+	if (numThreads == m_poolThreadCount)
+		return;
+
+	const int oldNumThreads = m_poolThreadCount;
+
+	// The pool owns its solvers
+	for (int i = 0; i < m_poolSolvers.Count(); i++)
+		RemoveSolverStatsTracker(m_poolSolvers[i]);
+
+	btConstraintSolverPoolMt *pSolverPool = CreateSolverPool(numThreads);
+	m_pBulletDynamicsWorld->setConstraintSolver(pSolverPool);
+	delete m_pBulletSolver;
+	m_pBulletSolver = pSolverPool;
+
+	static_cast<CCollisionDispatcherMt *>(m_pBulletDispatcher)->SetNumThreads(numThreads);
+	m_pAutoTuner->Reset();
+
+	DevMsg("Physics environment retuned from %i to %i threads\n", oldNumThreads, numThreads);
+#endif
+}
+
+// UNEXPOSED
+void CPhysicsEnvironment::AddBreakableConstraint(CPhysicsConstraint *pConstraint) {
+	if (m_breakableConstraints.Find(pConstraint) == -1)
+		m_breakableConstraints.AddToTail(pConstraint);
+}
+
+// UNEXPOSED
+void CPhysicsEnvironment::RemoveBreakableConstraint(CPhysicsConstraint *pConstraint) {
+	m_breakableConstraints.FindAndRemove(pConstraint);
+	m_brokenConstraints.FindAndRemove(pConstraint);
+}
+
+// UNEXPOSED
+// Called once after the simulation step, with the forces the solver applied summed over all substeps.
+void CPhysicsEnvironment::CheckBreakableConstraints(int numSubSteps) {
+	for (int i = 0; i < m_breakableConstraints.Count(); i++) {
+		CPhysicsConstraint *pConstraint = m_breakableConstraints[i];
+		if (pConstraint->CheckBreak(numSubSteps)) {
+			pConstraint->Deactivate();
+			m_brokenConstraints.AddToTail(pConstraint);
+		}
+	}
+
+	// Notify the game after the pass, as it may destroy constraints from the callback.
+	// Destroyed constraints are removed from m_brokenConstraints, so walk a copy and skip the ones that are gone.
+	CUtlVector<IPhysicsConstraint *> broken;
+	broken.AddVectorToTail(m_brokenConstraints);
+
+	for (int i = 0; i < broken.Count(); i++) {
+		if (m_brokenConstraints.Find(broken[i]) == -1)
+			continue;
+
+		CPhysicsConstraint *pConstraint = (CPhysicsConstraint *)broken[i];
+		if (pConstraint->ShouldNotifyBroken())
+			HandleConstraintBroken(pConstraint);
+	}
+}
+
+// UNEXPOSED
+void CPhysicsEnvironment::GetPhaseTimes(phasetimes_t *pOutput) const {
+	if (!pOutput) return;
+
+	*pOutput = m_pPhaseTimer->GetPhaseTimes();
+}
+
+// UNEXPOSED
+// Only affects manifolds created from now on
+void CPhysicsEnvironment::SetContactBreakingThreshold(btScalar threshold) {
+	m_pDispatcherPools->SetContactBreakingThreshold(threshold);
+}
+
+// UNEXPOSED
+void CPhysicsEnvironment::GetCollisionPoolStats(poolstats_t *pManifolds, poolstats_t *pAlgorithms) const {
+	m_pDispatcherPools->GetManifoldPoolStats(pManifolds);
+	m_pDispatcherPools->GetAlgorithmPoolStats(pAlgorithms);
+}
+
+// UNEXPOSED
+void CPhysicsEnvironment::GetSolverStats(solverstats_t *pOutput) const {
+	if (!pOutput) return;
+
+	memset(pOutput, 0, sizeof(*pOutput));
+	for (int i = 0; i < m_solverStatsTrackers.Count(); i++) {
+		const solverstats_t &stats = m_solverStatsTrackers[i]->GetStats();
+		pOutput->islands += stats.islands;
+		pOutput->iterations += stats.iterations;
+		pOutput->budget += stats.budget;
+		pOutput->earlyExits += stats.earlyExits;
+		pOutput->contacts += stats.contacts;
+		pOutput->reducedContacts += stats.reducedContacts;
+		pOutput->maxIterations = max(pOutput->maxIterations, stats.maxIterations);
+	}
+}
+
 // UNEXPOSED
 CPhysicsDragController *CPhysicsEnvironment::GetDragController() const
 {
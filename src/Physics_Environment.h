@@ -21,11 +21,26 @@ class CCollisionSolver;
 class CObjectTracker;
 class CCollisionEventListener;
 class CPhysicsFluidController;
+class CShadowController;
+class CPlayerController;
 class CPhysicsDragController;
 class CPhysicsEnvironment;
 class CPhysicsConstraint;
+class CPhysicsConstraintGroup;
+class CUserConstraintBatch;
+class CSimulationLOD;
+class CWakeQueue;
+class CSpawnResolver;
+class CVehicleRaycastBatch;
+class CDispatcherPools;
 class CPhysicsObject;
 class btConstraintSolverPoolMt;
+class CSolverStatsTracker;
+struct solverstats_t;
+struct phasetimes_t;
+struct poolstats_t;
+class CPhaseTimer;
+class CAutoTuner;
 
 class CDebugDrawer;
 
@@ -157,6 +172,16 @@ public:
 
 	void									EnableConstraintNotify(bool bEnable);
 	void									DebugCheckContacts();
+
+	void									SetUserConstraintBatchHandler(IPhysicsUserConstraintBatch *pHandler);
+
+	void									SetSimulationViewers(const Vector *pPositions, int count);
+
+	void									UpdateShadowControllers(IPhysicsShadowController **pControllers, const Vector *pPositions, const QAngle *pAngles, const float *pTimeOffsets, int count);
+	void									SetMotionEventBatchHandler(IPhysicsMotionController *pController, IMotionEventBatch *pHandler);
+
+	int										GetBrokenConstraintCount() const;
+	int										GetBrokenConstraints(IPhysicsConstraint **pOutputConstraintList, int maxCount) const;
 public:
 	// Unexposed functions
 	btDiscreteDynamicsWorld*				GetBulletEnvironment() const;
@@ -169,12 +194,23 @@ public:
 
 	CPhysicsDragController *				GetDragController() const;
 	CCollisionSolver *						GetCollisionSolver() const;
+	CUserConstraintBatch *					GetUserConstraintBatch() const { return m_pUserConstraintBatch; }
+	CVehicleRaycastBatch *					GetVehicleRaycastBatch() const { return m_pVehicleRaycastBatch; }
+
+	void									GetSolverStats(solverstats_t *pOutput) const; // Solver work done in the last simulation step
+	void									GetPhaseTimes(phasetimes_t *pOutput) const; // Where the time of the last simulation step went
+	void									GetCollisionPoolStats(poolstats_t *pManifolds, poolstats_t *pAlgorithms) const;
+	void									SetContactBreakingThreshold(btScalar threshold); // Speculative contact margin of this environment
+	int										NextConstraintSolveOrder() { return m_nextSolveOrder++; } // Constraints are solved in the order they got theirs
 
 	physics_performanceparams_t &			GetPerformanceSettings() { return m_perfparams; }
 	const physics_performanceparams_t &		GetPerformanceSettings() const { return m_perfparams; }
 	btVector3								GetMaxLinearVelocity() const;
 	btVector3								GetMaxAngularVelocity() const;
 
+	void									AddBreakableConstraint(CPhysicsConstraint *pConstraint);
+	void									RemoveBreakableConstraint(CPhysicsConstraint *pConstraint);
+
 	void									HandleConstraintBroken(CPhysicsConstraint *pConstraint) const; // Call this if you're a constraint that was just disabled/broken.
 	void									HandleFluidStartTouch(CPhysicsFluidController *pController, CPhysicsObject *pObject) const;
 	void									HandleFluidEndTouch(CPhysicsFluidController *pController, CPhysicsObject *pObject) const;
@@ -196,9 +232,11 @@ private:
 	int										m_numSubSteps;
 	int										m_curSubStep;
 	float									m_subStepTime;
+	int										m_nextSolveOrder;
 
 	btCollisionConfiguration *				m_pBulletConfiguration;
 	btCollisionDispatcher *					m_pBulletDispatcher;
+	CDispatcherPools *						m_pDispatcherPools;		// Same object as m_pBulletDispatcher
 	btBroadphaseInterface *					m_pBulletBroadphase;
 	btConstraintSolver *					m_pBulletSolver;
 	btDiscreteDynamicsWorld *				m_pBulletDynamicsWorld;
@@ -209,12 +247,21 @@ private:
 
 	CUtlVector<CPhysicsFluidController *>	m_fluids;
 	CUtlVector<IController *>				m_controllers;
+	CUtlVector<CShadowController *>			m_shadowControllers;	// Ticked in parallel, not in m_controllers
+	CUtlVector<CPlayerController *>			m_playerControllers;	// Same
 
 	CCollisionEventListener *				m_pCollisionListener;
 	CCollisionSolver *						m_pCollisionSolver;
 	CDeleteQueue *							m_pDeleteQueue;
 	CObjectTracker *						m_pObjectTracker;
 	CPhysicsDragController *				m_pPhysicsDragController;
+	CUserConstraintBatch *					m_pUserConstraintBatch;
+	CSimulationLOD *						m_pSimulationLOD;
+	CWakeQueue *							m_pWakeQueue;
+	CSpawnResolver *						m_pSpawnResolver;
+	CVehicleRaycastBatch *					m_pVehicleRaycastBatch;
+	CPhaseTimer *							m_pPhaseTimer;
+	CAutoTuner *							m_pAutoTuner;
 	IVPhysicsDebugOverlay *					m_pDebugOverlay;
 
 	IPhysicsCollisionEvent *				m_pCollisionEvent;
@@ -228,12 +275,27 @@ private:
 
 	CPhysThreadManager*						m_pThreadManager;
 
+	CUtlVector<CSolverStatsTracker *>		m_solverStatsTrackers;
+	CUtlVector<btConstraintSolver *>		m_poolSolvers;		// Owned by the solver pool
+	int										m_poolThreadCount;	// Thread count the solver pool and dispatcher are tuned for
+
+	CUtlVector<CPhysicsConstraint *>		m_breakableConstraints;
+	CUtlVector<CPhysicsConstraintGroup *>	m_constraintGroups;
+	CUtlVector<IPhysicsConstraint *>		m_brokenConstraints; // Constraints broken during the last Simulate call
+
 private:
 	static void								TickCallback(btDynamicsWorld *world, btScalar timestep);
+	static void								PreTickCallback(btDynamicsWorld *world, btScalar timestep);
 	void									BulletTick(btScalar timeStep);
+	void									BulletPreTick(btScalar timeStep);
 	void									DoCollisionEvents(float dt);
 	void									Simulate(float deltaTime);
 	void									CreateEmptyDynamicsWorld();
+	void									AddSolverStatsTracker(btConstraintSolver *pSolver);
+	void									RemoveSolverStatsTracker(btConstraintSolver *pSolver);
+	btConstraintSolverPoolMt *				CreateSolverPool(int numThreads);
+	void									UpdateThreadCount();
+	void									CheckBreakableConstraints(int numSubSteps);
 };
 
 #endif // PHYSICS_ENVIRONMENT_H
@@ -10,31 +10,40 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+static ConVar cvar_buoyancy_tolerance("bt_buoyancy_tolerance", "0.002", FCVAR_REPLICATED, "Reuse the submerged volume of an object until the water surface moved this far (meters) relative to it", true, 0, false, 0);
+
 /********************************
-* CLASS CPhysicsFluidCallback
+* CLASS CFluidGhostObject
 ********************************/
 
-class CPhysicsFluidCallback : public btGhostObjectCallback {
+// Keeps no overlap list of its own, the controller keeps a sorted one with the objects' buoyancy data
+class CFluidGhostObject : public btGhostObject {
 	public:
-		CPhysicsFluidCallback(CPhysicsFluidController *pController) {
+		CFluidGhostObject(CPhysicsFluidController *pController) {
 			m_pController = pController;
 		}
 
-		void addedOverlappingObject(btCollisionObject *pObject) {
-			CPhysicsObject *pPhys = (CPhysicsObject *)pObject->getUserPointer();
+		void addOverlappingObjectInternal(btBroadphaseProxy *otherProxy, btBroadphaseProxy *thisProxy) override {
+			CPhysicsObject *pPhys = GetPhysicsObject(otherProxy);
 			if (!pPhys) return;
 
 			m_pController->ObjectAdded(pPhys);
 		}
 
-		void removedOverlappingObject(btCollisionObject *pObject) {
-			CPhysicsObject *pPhys = (CPhysicsObject *)pObject->getUserPointer();
+		void removeOverlappingObjectInternal(btBroadphaseProxy *otherProxy, btDispatcher *dispatcher, btBroadphaseProxy *thisProxy) override {
+			CPhysicsObject *pPhys = GetPhysicsObject(otherProxy);
 			if (!pPhys) return;
 
 			m_pController->ObjectRemoved(pPhys);
 		}
 
 	private:
+		static CPhysicsObject *GetPhysicsObject(btBroadphaseProxy *pProxy) {
+			// Only rigid bodies float (triggers are ghosts too)
+			btRigidBody *pBody = btRigidBody::upcast((btCollisionObject *)pProxy->m_clientObject);
+			return pBody ? (CPhysicsObject *)pBody->getUserPointer() : NULL;
+		}
+
 		CPhysicsFluidController *m_pController;
 };
 
@@ -65,11 +74,8 @@ CPhysicsFluidController::CPhysicsFluidController(CPhysicsEnvironment *pEnv, CPhy
 	pFluidObject->SetContents(m_iContents);
 	pFluidObject->SetFluidController(this);
 
-	m_pCallback = new CPhysicsFluidCallback(this);
-
-	m_pGhostObject = new btGhostObject;
+	m_pGhostObject = new CFluidGhostObject(this);
 	m_pGhostObject->setUserPointer(pFluidObject);
-	m_pGhostObject->setCallback(m_pCallback);
 	m_pGhostObject->setCollisionShape(pFluidObject->GetObject()->getCollisionShape());
 	m_pGhostObject->setWorldTransform(pFluidObject->GetObject()->getWorldTransform());
 	m_pGhostObject->setCollisionFlags(m_pGhostObject->getCollisionFlags() | btCollisionObject::CF_NO_CONTACT_RESPONSE | btCollisionObject::CF_STATIC_OBJECT | btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT);
@@ -79,17 +85,11 @@ CPhysicsFluidController::CPhysicsFluidController(CPhysicsEnvironment *pEnv, CPhy
 CPhysicsFluidController::~CPhysicsFluidController() {
 	m_pEnv->GetBulletEnvironment()->removeCollisionObject(m_pGhostObject);
 	delete m_pGhostObject;
-	delete m_pCallback;
 }
 
 void CPhysicsFluidController::WakeAllSleepingObjects() {
-	int count = m_pGhostObject->getNumOverlappingObjects();
-	for (int i = 0; i < count; i++) {
-		btRigidBody *body = btRigidBody::upcast(m_pGhostObject->getOverlappingObject(i));
-		if (!body)
-			continue;
-
-		body->activate(true);
+	for (int i = 0; i < m_objects.size(); i++) {
+		m_objects[i].pObject->GetObject()->activate(true);
 	}
 }
 
@@ -119,161 +119,258 @@ int	CPhysicsFluidController::GetContents() const {
 	return m_iContents;
 }
 
-static btVector3 calcConvexCenter(btConvexHullShape *pShape, btVector3 &planePos, btVector3 &planeNorm) {
-	// Basic average
-	btVector3 sum(0, 0, 0);
+// Four points, one per lane
+struct point4_t {
+	fltx4	x, y, z;
+};
 
-	if (pShape->getNumPoints() > 0) {
-		for (int i = 0; i < pShape->getNumPoints(); i++) {
-			btVector3 point = pShape->getScaledPoint(i);
-			point -= planePos;
+// a . (b x c)
+static FORCEINLINE fltx4 TripleProductSIMD(const point4_t &a, const point4_t &b, const point4_t &c) {
+	const fltx4 cx = SubSIMD(MulSIMD(b.y, c.z), MulSIMD(b.z, c.y));
+	const fltx4 cy = SubSIMD(MulSIMD(b.z, c.x), MulSIMD(b.x, c.z));
+	const fltx4 cz = SubSIMD(MulSIMD(b.x, c.y), MulSIMD(b.y, c.x));
+	return AddSIMD(AddSIMD(MulSIMD(a.x, cx), MulSIMD(a.y, cy)), MulSIMD(a.z, cz));
+}
+
+// Point where the edge from a (plane distance da) to b (plane distance db) crosses the plane
+static FORCEINLINE point4_t ClipEdgeSIMD(const point4_t &a, const point4_t &b, const fltx4 &da, const fltx4 &db) {
+	// Edges that don't cross get masked out by the caller, just keep them finite
+	fltx4 denom = SubSIMD(da, db);
+	denom = MaskedAssign(CmpEqSIMD(denom, Four_Zeros), Four_Ones, denom);
+	const fltx4 t = DivSIMD(da, denom);
+
+	point4_t p;
+	p.x = AddSIMD(a.x, MulSIMD(SubSIMD(b.x, a.x), t));
+	p.y = AddSIMD(a.y, MulSIMD(SubSIMD(b.y, a.y), t));
+	p.z = AddSIMD(a.z, MulSIMD(SubSIMD(b.z, a.z), t));
+	return p;
+}
 
-			// Only add the point if it's submerged
-			if (point.dot(planeNorm) < 0)
-				sum += pShape->getScaledPoint(i);
+// Volume and centroid of the part of the hulls below the plane (normal . x = dist).
+// The tetrahedra from a point on the plane to the clipped triangles add up to the submerged volume.
+// The missing cap on the plane doesn't need to be built, its tetrahedra are flat.
+static btScalar ClipTrianglesToPlane(const btAlignedObjectArray<trianglepack_t> &packs, const btVector3 &normal, btScalar dist, btVector3 &center) {
+	const btVector3 apex = normal * dist;
+	const fltx4 apexX = ReplicateX4(apex.x()), apexY = ReplicateX4(apex.y()), apexZ = ReplicateX4(apex.z());
+	const fltx4 normX = ReplicateX4(normal.x()), normY = ReplicateX4(normal.y()), normZ = ReplicateX4(normal.z());
+
+	// Volume (times 6) and first moment (times 24) relative to the apex
+	fltx4 volume = Four_Zeros;
+	point4_t moment = {Four_Zeros, Four_Zeros, Four_Zeros};
+
+	for (int i = 0; i < packs.size(); i++) {
+		const trianglepack_t &pack = packs[i];
+
+		point4_t v[3];
+		fltx4 d[3], below[3], above[3];
+		for (int k = 0; k < 3; k++) {
+			v[k].x = SubSIMD(pack.x[k], apexX);
+			v[k].y = SubSIMD(pack.y[k], apexY);
+			v[k].z = SubSIMD(pack.z[k], apexZ);
+
+			d[k] = AddSIMD(AddSIMD(MulSIMD(v[k].x, normX), MulSIMD(v[k].y, normY)), MulSIMD(v[k].z, normZ));
+			below[k] = CmpLtSIMD(d[k], Four_Zeros);
+			above[k] = CmpGeSIMD(d[k], Four_Zeros);
 		}
 
-		sum /= static_cast<btScalar>(pShape->getNumPoints());
+		const fltx4 fullVol = TripleProductSIMD(v[0], v[1], v[2]);
+		point4_t fullMoment;
+		fullMoment.x = MulSIMD(fullVol, AddSIMD(AddSIMD(v[0].x, v[1].x), v[2].x));
+		fullMoment.y = MulSIMD(fullVol, AddSIMD(AddSIMD(v[0].y, v[1].y), v[2].y));
+		fullMoment.z = MulSIMD(fullVol, AddSIMD(AddSIMD(v[0].z, v[1].z), v[2].z));
+
+		const fltx4 allBelow = AndSIMD(below[0], AndSIMD(below[1], below[2]));
+		volume = AddSIMD(volume, AndSIMD(allBelow, fullVol));
+		moment.x = AddSIMD(moment.x, AndSIMD(allBelow, fullMoment.x));
+		moment.y = AddSIMD(moment.y, AndSIMD(allBelow, fullMoment.y));
+		moment.z = AddSIMD(moment.z, AndSIMD(allBelow, fullMoment.z));
+
+		// A triangle crossing the plane has one vertex alone on its side. The corner cut off at that vertex
+		// is either all of the triangle that's submerged, or all of it that isn't.
+		for (int k = 0; k < 3; k++) {
+			const int a = (k + 1) % 3;
+			const int b = (k + 2) % 3;
+
+			const point4_t pa = ClipEdgeSIMD(v[k], v[a], d[k], d[a]);
+			const point4_t pb = ClipEdgeSIMD(v[k], v[b], d[k], d[b]);
+			const fltx4 cornerVol = TripleProductSIMD(v[k], pa, pb);
+			point4_t cornerMoment;
+			cornerMoment.x = MulSIMD(cornerVol, AddSIMD(AddSIMD(v[k].x, pa.x), pb.x));
+			cornerMoment.y = MulSIMD(cornerVol, AddSIMD(AddSIMD(v[k].y, pa.y), pb.y));
+			cornerMoment.z = MulSIMD(cornerVol, AddSIMD(AddSIMD(v[k].z, pa.z), pb.z));
+
+			const fltx4 cornerBelow = AndSIMD(below[k], AndSIMD(above[a], above[b]));
+			const fltx4 cornerAbove = AndSIMD(above[k], AndSIMD(below[a], below[b]));
+
+			volume = AddSIMD(volume, OrSIMD(AndSIMD(cornerBelow, cornerVol), AndSIMD(cornerAbove, SubSIMD(fullVol, cornerVol))));
+			moment.x = AddSIMD(moment.x, OrSIMD(AndSIMD(cornerBelow, cornerMoment.x), AndSIMD(cornerAbove, SubSIMD(fullMoment.x, cornerMoment.x))));
+			moment.y = AddSIMD(moment.y, OrSIMD(AndSIMD(cornerBelow, cornerMoment.y), AndSIMD(cornerAbove, SubSIMD(fullMoment.y, cornerMoment.y))));
+			moment.z = AddSIMD(moment.z, OrSIMD(AndSIMD(cornerBelow, cornerMoment.z), AndSIMD(cornerAbove, SubSIMD(fullMoment.z, cornerMoment.z))));
+		}
+	}
+
+	btScalar vol6 = 0;
+	btVector3 sum(0, 0, 0);
+	for (int lane = 0; lane < 4; lane++) {
+		vol6 += SubFloat(volume, lane);
+		sum += btVector3(SubFloat(moment.x, lane), SubFloat(moment.y, lane), SubFloat(moment.z, lane));
+	}
+
+	if (vol6 <= 0) {
+		center = apex;
+		return 0;
 	}
 
-	return sum;
+	center = apex + sum / (4 * vol6);
+	return vol6 / 6;
 }
 
-// Find the object's center of buoyancy
-// This would be the center of all submerged points
-// You can bisect the object by the plane of the water surface to get all points
-// submerged, then calculate the center of all those points
-// planePos: World space plane position
-// planeNorm: World space plane normal
-static btVector3 calculateBuoyantCenter(btRigidBody *pBody, btVector3 &planePos, btVector3 &planeNorm) {
-	btVector3 center(0, 0, 0);
-
-	btVector3 relPlanePos = pBody->getWorldTransform().inverse() * planePos;
-	btVector3 relNorm = quatRotate(pBody->getWorldTransform().getRotation().inverse(), planeNorm);
-
-	btCollisionShape *pShape = pBody->getCollisionShape();
-	if (pShape->getShapeType() == COMPOUND_SHAPE_PROXYTYPE) {
-		btCompoundShape *pCompound = (btCompoundShape *)pShape;
-		for (int i = 0; i < pCompound->getNumChildShapes(); i++) {
-			btCollisionShape *pChild = pCompound->getChildShape(i);
-			if (pChild->getShapeType() == CONVEX_HULL_SHAPE_PROXYTYPE) {
-				center += calcConvexCenter((btConvexHullShape *)pChild, relPlanePos, relNorm);
-			}
-		}
+// UNEXPOSED
+void CPhysicsFluidController::UpdateSubmergedVolume(fluidobject_t &obj, const btVector3 &surfNorm, btScalar surfDist) {
+	const btRigidBody *body = obj.pObject->GetObject();
+	const btTransform &trans = body->getWorldTransform();
+
+	// Surface plane in the object's space
+	const btVector3 normal = surfNorm * trans.getBasis();
+	const btScalar dist = surfDist - surfNorm.dot(trans.getOrigin());
+
+	if (obj.valid) {
+		// How far the plane moved anywhere within the object
+		btVector3 sphereCenter;
+		btScalar radius;
+		body->getCollisionShape()->getBoundingSphere(sphereCenter, radius);
+
+		const btScalar moved = (normal - obj.planeNormal).length() * (sphereCenter.length() + radius) + btFabs(dist - obj.planeDist);
+		if (moved < cvar_buoyancy_tolerance.GetFloat())
+			return;
+	}
+
+	obj.planeNormal = normal;
+	obj.planeDist = dist;
+	obj.valid = true;
 
-		if (pCompound->getNumChildShapes() > 0)
-			center /= static_cast<btScalar>(pCompound->getNumChildShapes());
+	const CPhysCollide *pCollide = obj.pObject->GetCollide();
+	const btScalar totalVolume = pCollide ? pCollide->GetTrianglePackVolume() : 0;
+	if (totalVolume <= 0) {
+		obj.volume = 0;
+		return;
 	}
 
-	return center;
+	obj.volume = ClipTrianglesToPlane(pCollide->GetTrianglePacks(), normal, dist, obj.center) / totalVolume;
 }
 
-// TODO: Refactor this code to be less messy.
 void CPhysicsFluidController::Tick(float dt) {
-	// TODO: Buoyancy calculation
-	int numObjects = m_pGhostObject->getNumOverlappingObjects();
-	for (int i = 0; i < numObjects; i++) {
-		btRigidBody *body = btRigidBody::upcast(m_pGhostObject->getOverlappingObject(i));
-		Assert(body);
-		if (!body) continue;
+	// Surface plane, same for every object
+	btVector3 surfNorm;
+	ConvertDirectionToBull(m_vSurfacePlane.AsVector3D(), surfNorm);
+	const btScalar surfDist = ConvertDistanceToBull(m_vSurfacePlane.w);
 
-		CPhysicsObject *pObject = (CPhysicsObject *)body->getUserPointer();
-		Assert(pObject);
+	for (int i = 0; i < m_entered.Count(); i++)
+		m_pEnv->HandleFluidStartTouch(this, m_entered[i]);
 
-		// Find the surface plane's world pos (center at the very top)
-		btVector3 surfPos = m_pGhostObject->getWorldTransform().getOrigin();
-		btVector3 surfNorm;
-		ConvertDirectionToBull(m_vSurfacePlane.AsVector3D(), surfNorm);
+	for (int i = 0; i < m_exited.Count(); i++)
+		m_pEnv->HandleFluidEndTouch(this, m_exited[i]);
 
-		// btScalar fluidLen = ConvertDistanceToBull(m_vSurfacePlane.w);
+	m_entered.RemoveAll();
+	m_exited.RemoveAll();
 
-		btVector3 omins, omaxs;
-		m_pGhostObject->getCollisionShape()->getAabb(m_pGhostObject->getWorldTransform(), omins, omaxs);
-		btScalar height = omaxs.y() - omins.y();
+	for (int i = 0; i < m_objects.size(); i++) {
+		fluidobject_t &obj = m_objects[i];
+		btRigidBody *body = obj.pObject->GetObject();
 
-		surfPos += surfNorm * (height / 2);
+		// Sleeping objects keep floating where they are, their cached volume stays valid for when they wake up
+		if (!body->isActive())
+			continue;
+
+		UpdateSubmergedVolume(obj, surfNorm, surfDist);
+		if (obj.volume <= 0)
+			continue;
 
-		btVector3 center = calculateBuoyantCenter(body, surfPos, surfNorm);
-		center = body->getWorldTransform() * center; // Convert back into world space
+		const btVector3 center = body->getWorldTransform() * obj.center;
 
-		btVector3 offset = center - surfPos;
-		btScalar submerged = surfNorm.dot(offset);
+		// Scaled to the object's volume, which the game may have overridden
+		// density units kg/m^3
+		const btScalar vol = obj.volume * obj.pObject->GetVolume();
+		const btVector3 force = (m_fDensity * -body->getGravity() * vol) * obj.pObject->GetBuoyancyRatio();
+		body->applyForce(force, center - body->getWorldTransform().getOrigin());
 
 #ifdef _DEBUG
 		IVPhysicsDebugOverlay *pOverlay = m_pEnv->GetDebugOverlay();
 		if (pOverlay) {
 			Vector pos;
-			ConvertPosToHL(surfPos, pos);
-			pOverlay->AddBoxOverlay(pos, Vector(-8), Vector(8), QAngle(0, 0, 0), 255, 0, 0, 255, 0.f);
-			pOverlay->AddLineOverlay(pos, pos + m_vSurfacePlane.AsVector3D() * 32, 255, 0, 0, false, 0.f);
-
 			ConvertPosToHL(center, pos);
 			pOverlay->AddBoxOverlay(pos, Vector(-8), Vector(8), QAngle(0, 0, 0), 0, 0, 255, 255, 0.f);
-
-			if (submerged < 0) {
-				pOverlay->AddTextOverlay(pos, 0.f, "submerged %+04.2f", submerged);
-			}
+			pOverlay->AddLineOverlay(pos, pos + m_vSurfacePlane.AsVector3D() * 32, 255, 0, 0, false, 0.f);
+			pOverlay->AddTextOverlay(pos, 0.f, "submerged %.2f", obj.volume);
 		}
 #endif
+	}
+}
 
-		if (submerged < 0) {
-			btVector3 mins, maxs;
-			body->getAabb(mins, maxs);
-
-			// Calc the volume coefficient
-			btScalar dist = -submerged;
-			float p = clamp(dist / 1.2f, 0.f, 1.f);
-			btScalar vol = p * pObject->GetVolume();
-
-			// TODO: Need a way to calculate this properly
-			// Force should be exactly equal to -gravity when submerged distance is 0
-			// density units kg/m^3
-			btVector3 force = (m_fDensity * -body->getGravity() * vol) * pObject->GetBuoyancyRatio();
-
-			btVector3 relPos = center - body->getWorldTransform().getOrigin();
-			body->applyForce(force, relPos);
-		}
-
-		// Old code that actually works better
-		/*
-		btVector3 mins, maxs, omins, omaxs;
-		body->getAabb(mins, maxs);
-		m_pGhostObject->getCollisionShape()->getAabb(m_pGhostObject->getWorldTransform(), omins, omaxs);
-
-		float height = maxs.y() - mins.y(); // If the plane for the surface can be non-upwards I'm going to murder something
-		//float height = abs(ConvertDistanceToBull(m_vSurfacePlane.w));
-		float dist = omaxs.y() - mins.y(); // Distance between top of water and bottom of object (how much of object is in water)
-		float p = clamp(dist / height, 0.0f, 1.0f);
-		float vol = (pObject->GetVolume() * p); // / 64; // Submerged volume
-
-		// TODO: We need to calculate this force at several points on the object (How do we determine what points?).
-		// Maybe have the points determined by the extents of the shape at 4 directions parallel to our surface
-		// Simulate buoyant force per convex or just on the compound?
-
-		// Simulate buoyant force per point submerged
-		// Divide it over all of the points that are submerged
-
-		// IVP calculates this force per triangle
-		btVector3 force = (m_fDensity * -body->getGravity() * vol) * pObject->GetBuoyancyRatio();
-		body->applyCentralForce(force);
-
-		// Damping
-		// FIXME: Damping would be way too much for an object only partially touching our surface (ex. giant fucking bridge with like 1 pixel in the water)
-		body->setLinearVelocity(body->getLinearVelocity() * (1.0f - (0.75f * dt)));
-		body->setAngularVelocity(body->getAngularVelocity() * (1.0f - (0.75f * dt)));
-		*/
+// UNEXPOSED
+int CPhysicsFluidController::FindObject(const CPhysicsObject *pObject) const {
+	// Lower bound
+	int lo = 0, hi = m_objects.size();
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+		if (m_objects[mid].pObject < pObject)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+
+	return lo;
 }
 
 // UNEXPOSED
 void CPhysicsFluidController::ObjectAdded(CPhysicsObject *pObject) {
-	m_pEnv->HandleFluidStartTouch(this, pObject);
+	int index = FindObject(pObject);
+	if (index < m_objects.size() && m_objects[index].pObject == pObject)
+		return;
+
+	fluidobject_t obj;
+	obj.pObject = pObject;
+	obj.planeNormal.setZero();
+	obj.planeDist = 0;
+	obj.center.setZero();
+	obj.volume = 0;
+	obj.valid = false;
+
+	m_objects.push_back(obj);
+	for (int i = m_objects.size() - 1; i > index; i--)
+		m_objects.swap(i, i - 1);
+
+	// Left and came back within a step, as far as the game knows nothing happened
+	if (m_exited.FindAndRemove(pObject))
+		return;
+
+	if (m_pEnv->IsInSimulation())
+		m_entered.AddToTail(pObject);
+	else
+		m_pEnv->HandleFluidStartTouch(this, pObject);
 }
 
 // UNEXPOSED
 void CPhysicsFluidController::ObjectRemoved(CPhysicsObject *pObject) {
+	int index = FindObject(pObject);
+	if (index >= m_objects.size() || m_objects[index].pObject != pObject)
+		return;
+
+	for (int i = index; i < m_objects.size() - 1; i++)
+		m_objects.swap(i, i + 1);
+
+	m_objects.pop_back();
+
+	if (m_entered.FindAndRemove(pObject))
+		return;
+
 	// Don't send the callback on objects that are being removed
-	if (!pObject->IsBeingRemoved())
+	if (pObject->IsBeingRemoved())
+		return;
+
+	if (m_pEnv->IsInSimulation())
+		m_exited.AddToTail(pObject);
+	else
 		m_pEnv->HandleFluidEndTouch(this, pObject);
 }
 
@@ -7,7 +7,6 @@
 #include "IController.h"
 
 class CPhysicsEnvironment;
-class CPhysicsFluidCallback;
 class CPhysicsObject;
 
 class CPhysicsFluidController : public IPhysicsFluidController, public IController
@@ -32,6 +31,19 @@ class CPhysicsFluidController : public IPhysicsFluidController, public IControll
 
 		void					TransferToEnvironment(CPhysicsEnvironment *pDest);
 	private:
+		// Submerged volume of an object, cached for as long as the surface plane doesn't move relative to it
+		struct fluidobject_t {
+			CPhysicsObject *	pObject;
+			btVector3			planeNormal;	// Surface plane in the object's space
+			btScalar			planeDist;
+			btVector3			center;			// Center of buoyancy in the object's space
+			btScalar			volume;			// Fraction of the object's volume that's submerged
+			bool				valid;
+		};
+
+		void					UpdateSubmergedVolume(fluidobject_t &obj, const btVector3 &surfNorm, btScalar surfDist);
+		int						FindObject(const CPhysicsObject *pObject) const;
+
 		void *					m_pGameData;
 		int						m_iContents;
 		float					m_fDensity;
@@ -41,7 +53,10 @@ class CPhysicsFluidController : public IPhysicsFluidController, public IControll
 		btVector3				m_currentVelocity; // Velocity of water current
 		CPhysicsEnvironment *	m_pEnv;
 		btGhostObject *			m_pGhostObject;
-		CPhysicsFluidCallback *	m_pCallback;
+
+		btAlignedObjectArray<fluidobject_t> m_objects;	// Sorted by object, only changes on broadphase pair add/remove
+		CUtlVector<CPhysicsObject *> m_entered;			// Since the last tick, the game hears about them all at once
+		CUtlVector<CPhysicsObject *> m_exited;
 };
 
 CPhysicsFluidController *CreateFluidController(CPhysicsEnvironment *pEnv, CPhysicsObject *pFluidObject, fluidparams_t *pParams);
@@ -4,6 +4,8 @@
 #include "Physics_Object.h"
 #include "convert.h"
 
+#include <mathlib/ssemath.h>
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -20,6 +22,7 @@ IPhysicsMotionController *CreateMotionController(CPhysicsEnvironment *pEnv, IMot
 
 CPhysicsMotionController::CPhysicsMotionController(IMotionEvent *pHandler, CPhysicsEnvironment *pEnv) {
 	m_handler = pHandler;
+	m_pBatchHandler = NULL;
 	m_pEnv = pEnv;
 }
 
@@ -30,6 +33,11 @@ CPhysicsMotionController::~CPhysicsMotionController() {
 }
 
 void CPhysicsMotionController::Tick(float deltaTime) {
+	if (m_pBatchHandler) {
+		TickBatch(deltaTime);
+		return;
+	}
+
 	if (!m_handler) return;
 
 	for (int i = 0; i < m_objectList.Count(); i++) {
@@ -42,42 +50,164 @@ void CPhysicsMotionController::Tick(float deltaTime) {
 		speed *= deltaTime;
 		rot *= deltaTime;
 
-		Vector curVel, curAngVel;
-		pObject->GetVelocity(&curVel, &curAngVel);
+		btVector3 linear, angular;
+		ConvertPosToBull(speed, linear);
+		ConvertAngularImpulseToBull(rot, angular);
 
-		switch (ret) {
-			case IMotionEvent::SIM_NOTHING: {
-				break;
-			}
-			case IMotionEvent::SIM_LOCAL_ACCELERATION: {
-				// Convert velocity to world space
-				Vector newVel;
-				pObject->LocalToWorldVector(&newVel, speed);
+		ApplyResult(pObject, ret, linear, angular);
+	}
+}
 
-				pObject->AddVelocity(&newVel, &rot); // Rotation already in local space.
-				break;
-			}
-			case IMotionEvent::SIM_LOCAL_FORCE: {
-				Vector newVel;
-				pObject->LocalToWorldVector(&newVel, speed);
+// Bullet (x, y, z) is HL (x, -z, y)
+static FORCEINLINE void ConvertToHLSIMD(const fltx4 *bull, const fltx4 &scale, fltx4 *hl) {
+	hl[0] = MulSIMD(bull[0], scale);
+	hl[1] = SubSIMD(Four_Zeros, MulSIMD(bull[2], scale));
+	hl[2] = MulSIMD(bull[1], scale);
+}
 
-				pObject->ApplyForceCenter(newVel);
-				pObject->ApplyTorqueCenter(rot);
-				break;
-			}
-			case IMotionEvent::SIM_GLOBAL_ACCELERATION: {
-				pObject->AddVelocity(&speed, &rot);
-				break;
+// HL (x, y, z) is bullet (x, z, -y)
+static FORCEINLINE void ConvertToBullSIMD(const fltx4 *hl, const fltx4 &scale, fltx4 *bull) {
+	bull[0] = MulSIMD(hl[0], scale);
+	bull[1] = MulSIMD(hl[2], scale);
+	bull[2] = SubSIMD(Four_Zeros, MulSIMD(hl[1], scale));
+}
+
+// UNEXPOSED
+// Same as the loop above, but the game gets all objects at once. Conversions are done 4 objects at a time.
+void CPhysicsMotionController::TickBatch(float deltaTime) {
+	const int count = m_objectList.Count();
+	if (count == 0) return;
+
+	m_states.SetCount(count);
+	m_linear.SetCount(count);
+	m_angular.SetCount(count);
+	m_results.SetCount(count);
+
+	const fltx4 posToHL = ReplicateX4(BULL2HL(1.0f));
+	const fltx4 angToHL = ReplicateX4(RAD2DEG(1.0f));
+
+	for (int first = 0; first < count; first += 4) {
+		const int lanes = min(4, count - first);
+
+		fltx4 pos[3], vel[3], angVel[3], rot[3][3];
+		for (int i = 0; i < 3; i++) {
+			pos[i] = vel[i] = angVel[i] = Four_Zeros;
+			rot[i][0] = rot[i][1] = rot[i][2] = Four_Zeros;
+		}
+
+		for (int lane = 0; lane < lanes; lane++) {
+			btRigidBody *body = m_objectList[first + lane]->GetObject();
+
+			btTransform transform;
+			((btMassCenterMotionState *)body->getMotionState())->getGraphicTransform(transform);
+
+			const btMatrix3x3 &basis = body->getWorldTransform().getBasis();
+			const btVector3 &linVel = body->getLinearVelocity();
+			const btVector3 &angular = body->getAngularVelocity();
+			for (int i = 0; i < 3; i++) {
+				SubFloat(pos[i], lane) = transform.getOrigin()[i];
+				SubFloat(vel[i], lane) = linVel[i];
+				SubFloat(angVel[i], lane) = angular[i];
+				for (int j = 0; j < 3; j++)
+					SubFloat(rot[i][j], lane) = basis[i][j];
 			}
-			case IMotionEvent::SIM_GLOBAL_FORCE: {
-				pObject->ApplyForceCenter(speed);
-				pObject->ApplyTorqueCenter(rot);
-				break;
+		}
+
+		// Angular velocity is supplied in local space
+		fltx4 localAngVel[3];
+		for (int i = 0; i < 3; i++)
+			localAngVel[i] = AddSIMD(AddSIMD(MulSIMD(rot[0][i], angVel[0]), MulSIMD(rot[1][i], angVel[1])), MulSIMD(rot[2][i], angVel[2]));
+
+		fltx4 hlPos[3], hlVel[3], hlAngVel[3];
+		ConvertToHLSIMD(pos, posToHL, hlPos);
+		ConvertToHLSIMD(vel, posToHL, hlVel);
+		ConvertToHLSIMD(localAngVel, angToHL, hlAngVel);
+
+		for (int lane = 0; lane < lanes; lane++) {
+			motionstate_t &state = m_states[first + lane];
+			state.pObject = m_objectList[first + lane];
+			for (int i = 0; i < 3; i++) {
+				state.position[i] = SubFloat(hlPos[i], lane);
+				state.velocity[i] = SubFloat(hlVel[i], lane);
+				state.angularVelocity[i] = SubFloat(hlAngVel[i], lane);
 			}
-			default: {
-				DevWarning("VPhysics: Invalid motion controller event type returned (%d)\n", ret);
+
+			m_linear[first + lane].Init();
+			m_angular[first + lane].Init();
+			m_results[first + lane] = IMotionEvent::SIM_NOTHING;
+		}
+	}
+
+	m_pBatchHandler->SimulateBatch(this, m_states.Base(), count, deltaTime, m_linear.Base(), m_angular.Base(), m_results.Base());
+
+	if (m_objectList.Count() != count) {
+		DevWarning("VPhysics: Objects attached to/detached from a motion controller during SimulateBatch, results ignored\n");
+		return;
+	}
+
+	// Outputs are per second
+	const fltx4 posToBull = ReplicateX4(HL2BULL(deltaTime));
+	const fltx4 angToBull = ReplicateX4(DEG2RAD(deltaTime));
+
+	for (int first = 0; first < count; first += 4) {
+		const int lanes = min(4, count - first);
+
+		fltx4 hlLinear[3], hlAngular[3];
+		for (int i = 0; i < 3; i++)
+			hlLinear[i] = hlAngular[i] = Four_Zeros;
+
+		for (int lane = 0; lane < lanes; lane++) {
+			for (int i = 0; i < 3; i++) {
+				SubFloat(hlLinear[i], lane) = m_linear[first + lane][i];
+				SubFloat(hlAngular[i], lane) = m_angular[first + lane][i];
 			}
 		}
+
+		fltx4 linear[3], angular[3];
+		ConvertToBullSIMD(hlLinear, posToBull, linear);
+		ConvertToBullSIMD(hlAngular, angToBull, angular);
+
+		for (int lane = 0; lane < lanes; lane++) {
+			const btVector3 lin(SubFloat(linear[0], lane), SubFloat(linear[1], lane), SubFloat(linear[2], lane));
+			const btVector3 ang(SubFloat(angular[0], lane), SubFloat(angular[1], lane), SubFloat(angular[2], lane));
+			ApplyResult(m_objectList[first + lane], m_results[first + lane], lin, ang);
+		}
+	}
+}
+
+// UNEXPOSED
+// linear and angular are in bullet units, already scaled by the timestep
+void CPhysicsMotionController::ApplyResult(CPhysicsObject *pObject, IMotionEvent::simresult_e ret, const btVector3 &linear, const btVector3 &angular) {
+	switch (ret) {
+		case IMotionEvent::SIM_NOTHING: {
+			break;
+		}
+		case IMotionEvent::SIM_LOCAL_ACCELERATION: {
+			// Convert velocity to world space
+			const btVector3 newVel = pObject->GetObject()->getWorldTransform().getBasis() * linear;
+
+			pObject->AddVelocityBull(&newVel, &angular); // Rotation already in local space.
+			break;
+		}
+		case IMotionEvent::SIM_LOCAL_FORCE: {
+			const btVector3 newVel = pObject->GetObject()->getWorldTransform().getBasis() * linear;
+
+			pObject->ApplyForceCenterBull(newVel);
+			pObject->ApplyTorqueCenterBull(angular);
+			break;
+		}
+		case IMotionEvent::SIM_GLOBAL_ACCELERATION: {
+			pObject->AddVelocityBull(&linear, &angular);
+			break;
+		}
+		case IMotionEvent::SIM_GLOBAL_FORCE: {
+			pObject->ApplyForceCenterBull(linear);
+			pObject->ApplyTorqueCenterBull(angular);
+			break;
+		}
+		default: {
+			DevWarning("VPhysics: Invalid motion controller event type returned (%d)\n", ret);
+		}
 	}
 }
 
@@ -89,6 +219,11 @@ void CPhysicsMotionController::SetEventHandler(IMotionEvent *handler) {
 	m_handler = handler;
 }
 
+// UNEXPOSED
+void CPhysicsMotionController::SetBatchHandler(IMotionEventBatch *pHandler) {
+	m_pBatchHandler = pHandler;
+}
+
 void CPhysicsMotionController::AttachObject(IPhysicsObject *pObject, bool checkIfAlreadyAttached) {
 	Assert(pObject);
 	if (!pObject || pObject->IsStatic()) return;
@@ -30,11 +30,23 @@ class CPhysicsMotionController : public IController, public IPhysicsMotionContro
 		void							Tick(float deltaTime);
 		void							ObjectDestroyed(CPhysicsObject *pObject);
 
+		void							SetBatchHandler(IMotionEventBatch *pHandler);
+
 	private:
+		void							TickBatch(float deltaTime);
+		void							ApplyResult(CPhysicsObject *pObject, IMotionEvent::simresult_e ret, const btVector3 &linear, const btVector3 &angular);
+
 		IMotionEvent *					m_handler;
+		IMotionEventBatch *				m_pBatchHandler;
 		CUtlVector<CPhysicsObject *>	m_objectList;
 		CPhysicsEnvironment *			m_pEnv;
 
+		// Batch buffers, kept around between ticks
+		CUtlVector<motionstate_t>		m_states;
+		CUtlVector<Vector>				m_linear;
+		CUtlVector<AngularImpulse>		m_angular;
+		CUtlVector<IMotionEvent::simresult_e> m_results;
+
 		int								m_priority;
 };
 
@@ -12,11 +12,14 @@
 #include "Physics_DragController.h"
 #include "Physics_SurfaceProps.h"
 #include "Physics_VehicleController.h"
+#include "Physics_SimulationLOD.h"
 #include "convert.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+static ConVar cvar_ccd("bt_ccd", "1", FCVAR_REPLICATED, "Sweep objects that move further than their own thickness in a single step (prevents tunneling). Applied to newly created objects");
+
 /*****************************
 * CLASS CGhostTriggerCallback
 * Purpose: For BecomeTrigger, etc.
@@ -57,6 +60,7 @@ CPhysicsObject::CPhysicsObject() {
 	m_pShadow = NULL;
 	m_pFluidController = NULL;
 	m_pVehicleController = NULL;
+	m_pPlayerController = NULL;
 	m_pEnv = NULL;
 
 	m_contents = 0;
@@ -72,6 +76,14 @@ CPhysicsObject::CPhysicsObject() {
 	m_pName = "UNINITIALIZED";
 
 	m_bRemoving = false;
+	m_dragIndex = -1;
+
+	m_lodState.held = false;
+	m_lodState.cooldown = 0;
+	m_lodState.linVel.setZero();
+	m_lodState.angVel.setZero();
+
+	m_wakeState.deferred = false;
 }
 
 CPhysicsObject::~CPhysicsObject() {
@@ -111,6 +123,10 @@ bool CPhysicsObject::IsStatic() const {
 }
 
 bool CPhysicsObject::IsAsleep() const {
+	// Held by the simulation LOD, the game should still see it as awake
+	if (m_lodState.held)
+		return false;
+
 	return m_pObject->getActivationState() == ISLAND_SLEEPING || m_pObject->getActivationState() == DISABLE_SIMULATION;
 }
 
@@ -254,6 +270,15 @@ void CPhysicsObject::Wake() {
 	if (IsStatic())
 		return;
 
+	// Held by the simulation LOD, give it its velocity back
+	CSimulationLOD::Promote(this);
+
+	// Waiting in the wake queue, the game wants it now
+	if (m_wakeState.deferred) {
+		m_wakeState.deferred = false;
+		m_pObject->forceActivationState(ACTIVE_TAG);
+	}
+
 	m_pObject->setDeactivationTime(0);
 	m_pObject->setActivationState(ACTIVE_TAG);
 }
@@ -263,6 +288,7 @@ void CPhysicsObject::Sleep() {
 	if (IsStatic())
 		return;
 
+	m_lodState.held = false; // Really asleep now
 	m_pObject->setActivationState(ISLAND_SLEEPING);
 }
 
@@ -395,6 +421,9 @@ void CPhysicsObject::SetDragCoefficient(float *pDrag, float *pAngularDrag) {
 
 	if (pAngularDrag)
 		m_angDragCoefficient = *pAngularDrag;
+
+	if (IsDragEnabled())
+		m_pEnv->GetDragController()->UpdatePhysicsObject(this);
 }
 
 void CPhysicsObject::SetBuoyancyRatio(float ratio) {
@@ -486,8 +515,10 @@ void CPhysicsObject::SetPosition(const Vector &worldPosition, const QAngle &angl
 
 	// Assumed this is the behavior of IVP. If you teleport an object, you don't want it to be stupidly frozen in the air.
 	// Change this if behavior of IVP is different!
-	if (isTeleport)
+	if (isTeleport) {
+		CSimulationLOD::Promote(this);
 		m_pObject->activate();
+	}
 }
 
 void CPhysicsObject::SetPositionMatrix(const matrix3x4_t &matrix, bool isTeleport) {
@@ -498,8 +529,10 @@ void CPhysicsObject::SetPositionMatrix(const matrix3x4_t &matrix, bool isTelepor
 	// Update the motion state too...
 	((btMassCenterMotionState *)m_pObject->getMotionState())->setGraphicTransform(trans);
 
-	if (isTeleport)
+	if (isTeleport) {
+		CSimulationLOD::Promote(this);
 		m_pObject->activate();
+	}
 }
 
 void CPhysicsObject::GetPosition(Vector *worldPosition, QAngle *angles) const {
@@ -565,22 +598,30 @@ void CPhysicsObject::GetVelocity(Vector *velocity, AngularImpulse *angularVeloci
 void CPhysicsObject::AddVelocity(const Vector *velocity, const AngularImpulse *angularVelocity) {
 	if (!velocity && !angularVelocity) return;
 
+	btVector3 bullvelocity, bullangular;
+	if (velocity)
+		ConvertPosToBull(*velocity, bullvelocity);
+
+	if (angularVelocity)
+		ConvertAngularImpulseToBull(*angularVelocity, bullangular);
+
+	AddVelocityBull(velocity ? &bullvelocity : NULL, angularVelocity ? &bullangular : NULL);
+}
+
+// UNEXPOSED
+void CPhysicsObject::AddVelocityBull(const btVector3 *pVelocity, const btVector3 *pLocalAngularVelocity) {
 	if (!IsMoveable() || !IsMotionEnabled()) {
 		return;
 	}
 	Wake();
 
-	btVector3 bullvelocity, bullangular;
-	if (velocity) {
-		ConvertPosToBull(*velocity, bullvelocity);
-		m_pObject->setLinearVelocity(m_pObject->getLinearVelocity() + bullvelocity);
+	if (pVelocity) {
+		m_pObject->setLinearVelocity(m_pObject->getLinearVelocity() + *pVelocity);
 	}
 
 	// Angular velocity is supplied in local space.
-	if (angularVelocity) {
-		ConvertAngularImpulseToBull(*angularVelocity, bullangular);
-		bullangular = m_pObject->getWorldTransform().getBasis() * bullangular;
-
+	if (pLocalAngularVelocity) {
+		btVector3 bullangular = m_pObject->getWorldTransform().getBasis() * *pLocalAngularVelocity;
 		m_pObject->setAngularVelocity(m_pObject->getAngularVelocity() + bullangular);
 	}
 }
@@ -642,16 +683,20 @@ void CPhysicsObject::WorldToLocalVector(Vector *localVector, const Vector &world
 }
 
 void CPhysicsObject::ApplyForceCenter(const Vector &forceVector) {
-	if (!IsMoveable() || !IsMotionEnabled()) {
-		return;
-	}
-	Wake();
-
 	// forceVector is in kg*in/s*time
 	// bullet takes forces in newtons, aka kg*m/s*time
 
 	btVector3 force;
 	ConvertForceImpulseToBull(forceVector, force);
+	ApplyForceCenterBull(force);
+}
+
+// UNEXPOSED
+void CPhysicsObject::ApplyForceCenterBull(const btVector3 &force) {
+	if (!IsMoveable() || !IsMotionEnabled()) {
+		return;
+	}
+	Wake();
 
 	btVector3 linVel, angVel;
 	linVel = m_pObject->getLinearVelocity();
@@ -721,14 +766,19 @@ void CPhysicsObject::ApplyForceOffset(const Vector &forceVector, const Vector &w
 
 // FIXME: Is torque in local or world space?
 void CPhysicsObject::ApplyTorqueCenter(const AngularImpulse &torque) {
+	btVector3 bullTorque;
+	ConvertAngularImpulseToBull(torque, bullTorque);
+	ApplyTorqueCenterBull(bullTorque);
+}
+
+// UNEXPOSED
+void CPhysicsObject::ApplyTorqueCenterBull(const btVector3 &torque) {
 	if (!IsMoveable() || !IsMotionEnabled()) {
 		return;
 	}
 	Wake();
 
-	btVector3 bullTorque;
-	ConvertAngularImpulseToBull(torque, bullTorque);
-	m_pObject->applyTorqueImpulse(bullTorque);
+	m_pObject->applyTorqueImpulse(torque);
 }
 
 // Output passed to ApplyForceCenter/ApplyTorqueCenter
@@ -908,6 +958,8 @@ void CPhysicsObject::UpdateCollide() {
 
 	m_pObject->setMassProps(m_fMass, inertia);
 	m_pObject->updateInertiaTensor();
+
+	ComputeCcdParams(IsStatic());
 }
 
 const CPhysCollide *CPhysicsObject::GetCollide() const {
@@ -930,6 +982,8 @@ void CPhysicsObject::SetCollide(CPhysCollide *pCollide) {
 	m_pObject->setMassProps(m_fMass, inertia);
 	m_pObject->updateInertiaTensor();
 
+	ComputeCcdParams(IsStatic());
+
 	// Remove/add object to update contact points
 	m_pEnv->GetBulletEnvironment()->addRigidBody(m_pObject);
 }
@@ -1136,34 +1190,15 @@ void CPhysicsObject::Init(CPhysicsEnvironment *pEnv, btRigidBody *pObject, int m
 
 	ComputeDragBasis(isStatic);
 
-	if (!isStatic && drag != 0.0f) {
-		EnableDrag(true);
-	}
-
 	m_dragCoefficient = drag;
 	m_angDragCoefficient = angDrag;
 
-	// Compute our continuous collision detection stuff (for fast moving objects, prevents tunneling)
-	// This doesn't work on compound objects! see: btDiscreteDynamicsWorld::integrateTransforms
-	// TODO: Add support for object specific CCD enable/disable. We only want objects able to move very fast use CCD
-	if (!isStatic) 
-	{
-		btScalar radius(1.0);
-		if (m_pObject->getCollisionShape()) {
-			btVector3 center;
-			m_pObject->getCollisionShape()->getBoundingSphere(center, radius);
-		}
-
-		m_pObject->setCcdMotionThreshold(1e-7);
-		m_pObject->setCcdSweptSphereRadius(radius * 0.2);
-	}
-	else
-	{
-		// Disable CCD
-		m_pObject->setCcdMotionThreshold(10000.0f);
-		m_pObject->setCcdSweptSphereRadius(0.0f);
+	if (!isStatic && drag != 0.0f) {
+		EnableDrag(true);
 	}
 
+	ComputeCcdParams(isStatic);
+
 	if (isStatic) 
 	{
 		m_pObject->setCollisionFlags(m_pObject->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
@@ -1230,6 +1265,32 @@ float CPhysicsObject::GetAngularDragInDirection(const btVector3 &dir) const {
 	return m_angDragCoefficient * dir.absolute().dot(m_angDragBasis.absolute());
 }
 
+// UNEXPOSED
+// Purpose: Continuous collision detection (for fast moving objects, prevents tunneling)
+// Bullet only sweeps an object in a step where it moves further than its motion threshold, so
+// we set that to half of the object's thickness. Slower objects can't pass through anything
+// within a step, and are handled by the speculative contacts (see bt_speculative_margin).
+// NOTE: This doesn't work on compound objects! see: btDiscreteDynamicsWorld::integrateTransforms
+void CPhysicsObject::ComputeCcdParams(bool isStatic) {
+	btCollisionShape *pShape = m_pObject->getCollisionShape();
+	if (isStatic || !pShape || !cvar_ccd.GetBool()) {
+		// Disable CCD
+		m_pObject->setCcdMotionThreshold(0.0f);
+		m_pObject->setCcdSweptSphereRadius(0.0f);
+		return;
+	}
+
+	btVector3 min, max;
+	pShape->getAabb(btTransform::getIdentity(), min, max);
+
+	const btVector3 extents = (max - min).absolute();
+	const btScalar thickness = extents[extents.minAxis()];
+
+	// The swept sphere must fit inside the object, or it'll collide with things the object doesn't touch
+	m_pObject->setCcdMotionThreshold(thickness * 0.5f);
+	m_pObject->setCcdSweptSphereRadius(thickness * 0.4f);
+}
+
 // UNEXPOSED
 void CPhysicsObject::ComputeDragBasis(bool isStatic) {
 	m_dragBasis.setZero();
@@ -1246,9 +1307,12 @@ void CPhysicsObject::ComputeDragBasis(bool isStatic) {
 		delta = max - min;
 		delta = delta.absolute();
 
-		m_dragBasis.setX(delta.y() * delta.z());
-		m_dragBasis.setY(delta.x() * delta.z());
-		m_dragBasis.setZ(delta.x() * delta.y());
+		// Only the part of each face the shape actually covers drags (long thin or rotated props don't fill their box)
+		const btVector3 &areas = GetCollide()->GetOrthographicAreas();
+
+		m_dragBasis.setX(delta.y() * delta.z() * areas.x());
+		m_dragBasis.setY(delta.x() * delta.z() * areas.y());
+		m_dragBasis.setZ(delta.x() * delta.y() * areas.z());
 		m_dragBasis *= GetInvMass();
 
 		btVector3 ang = m_pObject->getInvInertiaDiagLocal();
@@ -1258,6 +1322,9 @@ void CPhysicsObject::ComputeDragBasis(bool isStatic) {
 		m_angDragBasis.setY(AngDragIntegral(ang[1], delta.y(), delta.x(), delta.z()) + AngDragIntegral(ang[1], delta.y(), delta.z(), delta.x()));
 		m_angDragBasis.setZ(AngDragIntegral(ang[2], delta.z(), delta.x(), delta.y()) + AngDragIntegral(ang[2], delta.z(), delta.y(), delta.x()));
 	}
+
+	if (IsDragEnabled())
+		m_pEnv->GetDragController()->UpdatePhysicsObject(this);
 }
 
 btVector3 CPhysicsObject::GetBullMassCenterOffset() const {
@@ -1265,10 +1332,18 @@ btVector3 CPhysicsObject::GetBullMassCenterOffset() const {
 }
 
 void CPhysicsObject::TransferToEnvironment(CPhysicsEnvironment *pDest) {
+	// Drag controllers are per environment
+	const bool drag = IsDragEnabled();
+	if (drag)
+		m_pEnv->GetDragController()->RemovePhysicsObject(this);
+
 	m_pEnv->GetBulletEnvironment()->removeRigidBody(m_pObject);
 	m_pEnv = pDest;
 
 	m_pEnv->GetBulletEnvironment()->addRigidBody(m_pObject);
+
+	if (drag)
+		m_pEnv->GetDragController()->AddPhysicsObject(this);
 }
 
 /************************
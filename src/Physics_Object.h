@@ -8,6 +8,7 @@ class CPhysicsEnvironment;
 class CPhysicsVehicleController;
 class CShadowController;
 class CPhysicsFluidController;
+class CPlayerController;
 class CPhysicsConstraint;
 class IController;
 
@@ -29,6 +30,19 @@ struct btMassCenterMotionState : public btMotionState {
 	void setGraphicTransform(const btTransform &graphTrans) { m_worldTrans = graphTrans * m_centerOfMassOffset; }			// HL -> Bullet
 };
 
+// Simulation LOD state of an object (see CSimulationLOD)
+struct simlodstate_t {
+	bool		held;		// Put to sleep by the simulation LOD (not by bullet or the game)
+	int			cooldown;	// Ticks left at full rate after being woken up
+	btVector3	linVel;		// Velocity when we were held
+	btVector3	angVel;
+};
+
+// Wake budget state of an object (see CWakeQueue)
+struct wakestate_t {
+	bool		deferred;	// Kept asleep, waiting in the wake queue
+};
+
 class CPhysicsObject;
 class IObjectEventListener {
 	public:
@@ -170,6 +184,11 @@ class CPhysicsObject : public IPhysicsObject32 {
 		CPhysicsEnvironment *				GetVPhysicsEnvironment();
 		btRigidBody *						GetObject();
 
+		// Same as the HL unit versions, in bullet units
+		void								AddVelocityBull(const btVector3 *pVelocity, const btVector3 *pLocalAngularVelocity);
+		void								ApplyForceCenterBull(const btVector3 &force);
+		void								ApplyTorqueCenterBull(const btVector3 &torque);
+
 		void								AttachedToConstraint(CPhysicsConstraint *pConstraint);
 		void								DetachedFromConstraint(CPhysicsConstraint *pConstraint);
 
@@ -185,6 +204,13 @@ class CPhysicsObject : public IPhysicsObject32 {
 		float								GetDragInDirection(const btVector3 &direction) const; // Function is not interfaced anymore
 		float								GetAngularDragInDirection(const btVector3 &direction) const;
 		void								ComputeDragBasis(bool isStatic);
+		float								GetDragCoefficient() const { return m_dragCoefficient; }
+		float								GetAngularDragCoefficient() const { return m_angDragCoefficient; }
+		const btVector3 &					GetDragBasis() const { return m_dragBasis; }
+		const btVector3 &					GetAngularDragBasis() const { return m_angDragBasis; }
+		int									GetDragIndex() const { return m_dragIndex; } // Index in the drag controller, -1 if drag is disabled
+		void								SetDragIndex(int index) { m_dragIndex = index; }
+		void								ComputeCcdParams(bool isStatic);
 
 		float								GetVolume() const { return m_fVolume; }
 		float								GetBuoyancyRatio() const { return m_fBuoyancyRatio; } // [0..1] value
@@ -202,8 +228,15 @@ class CPhysicsObject : public IPhysicsObject32 {
 
 		void								SetVehicleController(CPhysicsVehicleController *pController) { m_pVehicleController = pController; }
 
+		CPlayerController *					GetPlayerController() const { return m_pPlayerController; }
+		void								SetPlayerController(CPlayerController *pController) { m_pPlayerController = pController; }
+
 		bool								IsBeingRemoved() { return m_bRemoving; }
 
+		simlodstate_t &						GetLodState() { return m_lodState; }
+		const simlodstate_t &				GetLodState() const { return m_lodState; }
+		wakestate_t &						GetWakeState() { return m_wakeState; }
+
 		void								TransferToEnvironment(CPhysicsEnvironment *pDest);
 
 	private:
@@ -231,15 +264,19 @@ class CPhysicsObject : public IPhysicsObject32 {
 		float								m_angDragCoefficient;
 		btVector3							m_dragBasis;
 		btVector3							m_angDragBasis;
+		int									m_dragIndex;
 		Vector								m_massCenterOverride;
 		CShadowController *					m_pShadow;
 		CPhysicsVehicleController *			m_pVehicleController;
 		CPhysicsFluidController *			m_pFluidController;
+		CPlayerController *					m_pPlayerController;
 		CUtlVector<CPhysicsConstraint *>	m_pConstraintVec;
 		CUtlVector<IController *>			m_pControllers;
 		CUtlVector<IObjectEventListener *>	m_pEventListeners;
 
 		int									m_iLastActivationState;
+		simlodstate_t						m_lodState;
+		wakestate_t							m_wakeState;
 };
 
 CPhysicsObject *CreatePhysicsObject(CPhysicsEnvironment *pEnvironment, const CPhysCollide *pCollisionModel, int materialIndex, const Vector &position, const QAngle &angles, objectparams_t *pParams, bool isStatic);
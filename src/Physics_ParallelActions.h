@@ -0,0 +1,76 @@
+#ifndef PHYSICS_PARALLELACTIONS_H
+#define PHYSICS_PARALLELACTIONS_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+#include <LinearMath/btThreads.h>
+
+#define PARALLEL_ACTION_GRAIN_SIZE	1	// Actions per task, an action is a whole vehicle
+
+// Purpose: Implemented by actions (btActionInterface) that can be updated at the same time as other actions.
+class IParallelAction {
+	public:
+		// Called on the main thread before the actions are updated. Return true if updateAction won't
+		// write to anything but the action's own state and bodies this step, and only makes thread safe world queries.
+		virtual bool					IsParallelSafe() const = 0;
+
+		// Called on the main thread for the actions that are about to be updated in parallel
+		virtual void					PrepareParallelUpdate() {}
+};
+
+class CParallelActionLoop : public btIParallelForBody {
+	public:
+		CParallelActionLoop(btCollisionWorld *pWorld, btActionInterface *const *ppActions, btScalar dt)
+			: m_pWorld(pWorld), m_ppActions(ppActions), m_dt(dt) {
+		}
+
+		void forLoop(int iBegin, int iEnd) const override {
+			for (int i = iBegin; i < iEnd; i++)
+				m_ppActions[i]->updateAction(m_pWorld, m_dt);
+		}
+
+	private:
+		btCollisionWorld *				m_pWorld;
+		btActionInterface *const *		m_ppActions;
+		btScalar						m_dt;
+};
+
+// Purpose: Dynamics world that updates the parallel safe actions with the task scheduler.
+// The other actions are updated first, one after another and in the order they were added, then the parallel safe ones.
+template <class T>
+class CParallelActionWorld : public T {
+	public:
+		template <class A, class B, class C, class D>
+		CParallelActionWorld(A a, B b, C c, D d) : T(a, b, c, d) {}
+
+		template <class A, class B, class C, class D, class E>
+		CParallelActionWorld(A a, B b, C c, D d, E e) : T(a, b, c, d, e) {}
+
+	protected:
+		void updateActions(btScalar timeStep) override {
+			BT_PROFILE("updateActions");
+
+			m_parallelActions.resize(0);
+			for (int i = 0; i < this->m_actions.size(); i++) {
+				btActionInterface *pAction = this->m_actions[i];
+				IParallelAction *pParallel = dynamic_cast<IParallelAction *>(pAction);
+				if (pParallel && pParallel->IsParallelSafe()) {
+					pParallel->PrepareParallelUpdate();
+					m_parallelActions.push_back(pAction);
+				} else {
+					pAction->updateAction(this, timeStep);
+				}
+			}
+
+			if (m_parallelActions.size() > 0) {
+				CParallelActionLoop loop(this, &m_parallelActions[0], timeStep);
+				btParallelFor(0, m_parallelActions.size(), PARALLEL_ACTION_GRAIN_SIZE, loop);
+			}
+		}
+
+	private:
+		btAlignedObjectArray<btActionInterface *> m_parallelActions;
+};
+
+#endif // PHYSICS_PARALLELACTIONS_H
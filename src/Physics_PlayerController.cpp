@@ -46,6 +46,11 @@ CPlayerController::CPlayerController(CPhysicsEnvironment *pEnv, CPhysicsObject *
 	m_lastImpulse = btVector3(0, 0, 0);
 	m_secondsToArrival = 0;
 
+	m_bInContact = false;
+	m_pGroundContact = NULL;
+	m_groundVelocity.setZero();
+	m_bTicking = false;
+
 	AttachObject();
 }
 
@@ -111,34 +116,7 @@ void CPlayerController::SetEventHandler(IPhysicsPlayerControllerEvent *handler)
 }
 
 bool CPlayerController::IsInContact() {
-	btDispatcher *pDispatcher = m_pEnv->GetBulletEnvironment()->getDispatcher();
-
-	int numManifolds = pDispatcher->getNumManifolds();
-	for (int i = 0; i < numManifolds; i++) {
-		btPersistentManifold *contactManifold = pDispatcher->getManifoldByIndexInternal(i);
-		const btCollisionObject *obA = contactManifold->getBody0();
-		const btCollisionObject *obB = contactManifold->getBody1();
-		CPhysicsObject *pPhysUs = NULL;
-		CPhysicsObject *pPhysOther = NULL;
-
-		if (contactManifold->getNumContacts() > 0 && (obA == m_pObject->GetObject() || obB == m_pObject->GetObject())) {
-			if (obA == m_pObject->GetObject()) {
-				pPhysUs = (CPhysicsObject *)obA->getUserPointer();
-				pPhysOther = (CPhysicsObject *)obB->getUserPointer();
-			} else if (obB == m_pObject->GetObject()) {
-				pPhysUs = (CPhysicsObject *)obB->getUserPointer();
-				pPhysOther = (CPhysicsObject *)obA->getUserPointer();
-			}
-
-			// If it's static or controlled by the game
-			if (pPhysOther->IsStatic() || !pPhysOther->IsMotionEnabled() || (pPhysOther->GetCallbackFlags() & CALLBACK_SHADOW_COLLISION))
-				continue;
-
-			return true;
-		}
-	}
-
-	return false;
+	return m_bInContact;
 }
 
 // Purpose: Calculate the maximum speed we can accelerate.
@@ -233,62 +211,57 @@ void CPlayerController::GetLastImpulse(Vector *pOut) {
 	ConvertForceImpulseToHL(m_lastImpulse, *pOut);
 }
 
-// Purpose: Loop through all of our contact points and see if we're standing on ground anywhere
+// Purpose: Returns what we're standing on, as of the last contact update
 // Returns NULL if we're not standing on ground or if we're standing on a static/frozen object (or game physics object)
 CPhysicsObject *CPlayerController::GetGroundObject() {
-	btDispatcher *pDispatcher = m_pEnv->GetBulletEnvironment()->getDispatcher();
-
-	// Loop through the collision pair manifolds
-	int numManifolds = pDispatcher->getNumManifolds();
-	for (int i = 0; i < numManifolds; i++) {
-		btPersistentManifold *pManifold = pDispatcher->getManifoldByIndexInternal(i);
-		if (pManifold->getNumContacts() <= 0)
-			continue;
+	return m_pGroundContact;
+}
 
-		const btCollisionObject *objA = pManifold->getBody0();
-		const btCollisionObject *objB = pManifold->getBody1();
+// UNEXPOSED
+void CPlayerController::ClearContacts() {
+	m_bInContact = false;
+	m_pGroundContact = NULL;
+}
 
-		// Skip if one object is static/kinematic
-		if (objA->isStaticOrKinematicObject() || objB->isStaticOrKinematicObject())
-			continue;
+// UNEXPOSED
+void CPlayerController::AddContact(const btPersistentManifold *pManifold, int ourID) {
+	const btCollisionObject *pOther = ourID == 0 ? pManifold->getBody1() : pManifold->getBody0();
+	CPhysicsObject *pPhysOther = (CPhysicsObject *)pOther->getUserPointer();
+	if (!pPhysOther)
+		return;
 
-		CPhysicsObject *pPhysA = (CPhysicsObject *)objA->getUserPointer();
-		CPhysicsObject *pPhysB = (CPhysicsObject *)objB->getUserPointer();
+	// Unless it's static or controlled by the game
+	if (!pPhysOther->IsStatic() && pPhysOther->IsMotionEnabled() && !(pPhysOther->GetCallbackFlags() & CALLBACK_SHADOW_COLLISION))
+		m_bInContact = true;
 
-		// Collision that involves us!
-		if (objA == m_pObject->GetObject() || objB == m_pObject->GetObject()) {
-			int ourID = m_pObject->GetObject() == objA ? 0 : 1;
+	// Ground is the first dynamic object under us
+	if (m_pGroundContact || pOther->isStaticOrKinematicObject() || m_pObject->GetObject()->isStaticOrKinematicObject())
+		return;
 
-			for (int i = 0; i < pManifold->getNumContacts(); i++) {
-				btManifoldPoint &point = pManifold->getContactPoint(i);
+	for (int i = 0; i < pManifold->getNumContacts(); i++) {
+		const btManifoldPoint &point = pManifold->getContactPoint(i);
 
-				btVector3 norm = point.m_normalWorldOnB; // Normal worldspace A->B
-				if (ourID == 1) {
-					// Flip it because we're object B and we need norm B->A.
-					norm *= -1;
-				}
+		btVector3 norm = point.m_normalWorldOnB; // Normal worldspace A->B
+		if (ourID == 1) {
+			// Flip it because we're object B and we need norm B->A.
+			norm *= -1;
+		}
 
-				// HACK: Guessing which way is up (as currently defined in our implementation y is up)
-				// If the normal is up enough then assume it's some sort of ground
-				if (norm.y() > 0.8) {
-					return ourID == 0 ? pPhysB : pPhysA;
-				}
-			}
+		// HACK: Guessing which way is up (as currently defined in our implementation y is up)
+		// If the normal is up enough then assume it's some sort of ground
+		if (norm.y() > 0.8) {
+			m_pGroundContact = pPhysOther;
+			return;
 		}
 	}
-
-	return NULL;
 }
 
-void CPlayerController::Tick(float deltaTime) {
+// UNEXPOSED
+void CPlayerController::PreTick() {
+	m_bTicking = false;
 	if (!m_enable)
 		return;
 
-	// HACK: Only run this controller once per step (until I can figure out the math to fix per-tick simulation)
-	if (m_pEnv->GetCurSubStep() != 0)
-		return;
-	deltaTime *= m_pEnv->GetNumSubSteps();
-
 	btRigidBody *body = m_pObject->GetObject();
 	btMassCenterMotionState *motionState = (btMassCenterMotionState *)body->getMotionState();
 
@@ -303,6 +276,25 @@ void CPlayerController::Tick(float deltaTime) {
 		return;
 	}
 
+	// Are we walking on some sort of vphysics ground? Add their velocity in as a base then
+	// because the game doesn't do this for us!
+	// Taken here, the ground may be another player whose velocity changes in Tick.
+	m_groundVelocity.setZero();
+	if (m_pGroundContact) {
+		btTransform relTrans = m_pGroundContact->GetObject()->getWorldTransform().inverse() * body->getWorldTransform();
+		btVector3 relPos = relTrans.getOrigin();
+
+		m_groundVelocity = m_pGroundContact->GetObject()->getVelocityInLocalPoint(relPos);
+	}
+
+	m_bTicking = true;
+}
+
+// Runs in parallel with the other players, only touches our own object
+void CPlayerController::Tick(float deltaTime) {
+	if (!m_bTicking)
+		return;
+
 	CalculateVelocity(deltaTime);
 
 	m_ticksSinceUpdate++;
@@ -335,18 +327,7 @@ void CPlayerController::CalculateVelocity(float dt) {
 	((btMassCenterMotionState *)body->getMotionState())->getGraphicTransform(transform);
 	btVector3 deltaPos = m_targetPosition - transform.getOrigin();
 
-	btVector3 baseVelocity(0);
-
-	// Are we walking on some sort of vphysics ground? Add their velocity in as a base then
-	// because the game doesn't do this for us!
-	CPhysicsObject *pGround = GetGroundObject();
-	if (pGround) {
-		btTransform relTrans = pGround->GetObject()->getWorldTransform().inverse() * m_pObject->GetObject()->getWorldTransform();
-		btVector3 relPos = relTrans.getOrigin();
-
-		baseVelocity = pGround->GetObject()->getVelocityInLocalPoint(relPos);
-	}
-
+	const btVector3 &baseVelocity = m_groundVelocity;
 	btVector3 linVel = body->getLinearVelocity() - baseVelocity;
 	if (m_ticksSinceUpdate == 0) {
 		// TODO: We're applying too high acceleration when we get closer to the target position!
@@ -400,6 +381,7 @@ void CPlayerController::AttachObject() {
 	body->setAngularFactor(0);
 
 	m_pObject->AddCallbackFlags(CALLBACK_IS_PLAYER_CONTROLLER);
+	m_pObject->SetPlayerController(this);
 
 	body->setActivationState(DISABLE_DEACTIVATION, true);
 }
@@ -410,6 +392,7 @@ void CPlayerController::DetachObject() {
 	body->setActivationState(ACTIVE_TAG, true);
 
 	m_pObject->RemoveCallbackFlags(CALLBACK_IS_PLAYER_CONTROLLER);
+	m_pObject->SetPlayerController(NULL);
 
 	m_pObject = NULL;
 }
@@ -439,6 +422,58 @@ bool CPlayerController::WasFrozen() {
 	return false;
 }
 
+#define PLAYER_CONTROLLER_GRAIN_SIZE	8	// Controllers per task
+
+class CPlayerControllerLoop : public btIParallelForBody {
+	public:
+		CPlayerControllerLoop(CPlayerController *const *ppControllers, float dt)
+			: m_ppControllers(ppControllers), m_dt(dt) {
+		}
+
+		void forLoop(int iBegin, int iEnd) const override {
+			for (int i = iBegin; i < iEnd; i++)
+				m_ppControllers[i]->Tick(m_dt);
+		}
+
+	private:
+		CPlayerController *const *	m_ppControllers;
+		float						m_dt;
+};
+
+void TickPlayerControllers(CPhysicsEnvironment *pEnv, CPlayerController *const *ppControllers, int count, float dt) {
+	if (count <= 0) return;
+
+	// One pass over the manifolds for all players, instead of one per player and query
+	for (int i = 0; i < count; i++)
+		ppControllers[i]->ClearContacts();
+
+	btDispatcher *pDispatcher = pEnv->GetBulletEnvironment()->getDispatcher();
+	const int numManifolds = pDispatcher->getNumManifolds();
+	for (int i = 0; i < numManifolds; i++) {
+		const btPersistentManifold *pManifold = pDispatcher->getManifoldByIndexInternal(i);
+		if (pManifold->getNumContacts() <= 0)
+			continue;
+
+		for (int j = 0; j < 2; j++) {
+			const btCollisionObject *pObj = j == 0 ? pManifold->getBody0() : pManifold->getBody1();
+			CPhysicsObject *pPhys = (CPhysicsObject *)pObj->getUserPointer();
+			if (pPhys && pPhys->GetPlayerController())
+				pPhys->GetPlayerController()->AddContact(pManifold, j);
+		}
+	}
+
+	// HACK: Only run the controllers once per step (until I can figure out the math to fix per-tick simulation)
+	if (pEnv->GetCurSubStep() != 0)
+		return;
+	dt *= pEnv->GetNumSubSteps();
+
+	for (int i = 0; i < count; i++)
+		ppControllers[i]->PreTick();
+
+	CPlayerControllerLoop loop(ppControllers, dt);
+	btParallelFor(0, count, PLAYER_CONTROLLER_GRAIN_SIZE, loop);
+}
+
 /***********************
 * CREATION FUNCTIONS
 ***********************/
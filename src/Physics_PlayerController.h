@@ -45,6 +45,11 @@ class CPlayerController : public IController, public IPhysicsPlayerController, p
 	public:
 		CPhysicsObject *				GetGroundObject();
 
+		// Contact state, rebuilt every step from one pass over all manifolds for all players
+		void							ClearContacts();
+		void							AddContact(const btPersistentManifold *pManifold, int ourID);
+
+		void							PreTick(); // Serial part of the tick (calls into the game)
 		void							Tick(float deltaTime);
 		void							ObjectDestroyed(CPhysicsObject *pObject);
 
@@ -61,6 +66,11 @@ class CPlayerController : public IController, public IPhysicsPlayerController, p
 		CPhysicsObject *				m_pGround;
 		btVector3						m_groundPos;
 
+		bool							m_bInContact;		// Touching something the game doesn't control
+		CPhysicsObject *				m_pGroundContact;	// Object we're standing on, from this step's contacts
+		btVector3						m_groundVelocity;	// Its velocity under us, taken before the players run
+		bool							m_bTicking;			// PreTick left the velocity to Tick
+
 		CPhysicsObject *				m_pObject;
 		CPhysicsEnvironment *			m_pEnv;
 		btVector3						m_saveRot;
@@ -84,6 +94,9 @@ class CPlayerController : public IController, public IPhysicsPlayerController, p
 
 void ComputeController(btVector3 &currentSpeed, const btVector3 &delta, const btVector3 &maxSpeed, float scaleDelta, float damping, btVector3 *accelOut = NULL);
 
+// Gathers the contacts of all players in one pass, then runs the controllers in parallel
+void TickPlayerControllers(CPhysicsEnvironment *pEnv, CPlayerController *const *ppControllers, int count, float dt);
+
 CPlayerController *CreatePlayerController(CPhysicsEnvironment *pEnv, IPhysicsObject *pObject);
 
 #endif // PHYSICS_PLAYERCONTROLLER_H
@@ -363,6 +363,31 @@ int CShadowController::GetTicksSinceUpdate() {
 	return m_ticksSinceUpdate;
 }
 
+#define SHADOW_CONTROLLER_GRAIN_SIZE	16	// Controllers per task
+
+class CShadowControllerLoop : public btIParallelForBody {
+	public:
+		CShadowControllerLoop(CShadowController *const *ppControllers, float dt)
+			: m_ppControllers(ppControllers), m_dt(dt) {
+		}
+
+		void forLoop(int iBegin, int iEnd) const override {
+			for (int i = iBegin; i < iEnd; i++)
+				m_ppControllers[i]->Tick(m_dt);
+		}
+
+	private:
+		CShadowController *const *	m_ppControllers;
+		float						m_dt;
+};
+
+void TickShadowControllers(CShadowController *const *ppControllers, int count, float dt) {
+	if (count <= 0) return;
+
+	CShadowControllerLoop loop(ppControllers, dt);
+	btParallelFor(0, count, SHADOW_CONTROLLER_GRAIN_SIZE, loop);
+}
+
 /*************************
 * CREATION FUNCTIONS
 *************************/
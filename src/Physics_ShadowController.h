@@ -79,6 +79,9 @@ class CShadowController : public IController, public IPhysicsShadowController, p
 		shadowcontrol_params_t	m_shadow;
 };
 
+// Ticks the controllers in parallel, each one only touches its own object
+void TickShadowControllers(CShadowController *const *ppControllers, int count, float dt);
+
 float ComputeShadowControllerHL(CPhysicsObject *pObject, const hlshadowcontrol_params_t &params, float secondsToArrival, float dt);
 
 CShadowController *CreateShadowController(IPhysicsObject *pObject, bool allowPhysicsMovement, bool allowPhysicsRotation);
@@ -0,0 +1,232 @@
+#include "StdAfx.h"
+
+#include "Physics_SimulationLOD.h"
+#include "Physics_Environment.h"
+#include "Physics_Object.h"
+#include "convert.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cvar_simlod("bt_simlod", "1", FCVAR_REPLICATED, "Simulate objects far away from the viewers at a reduced rate (only when the game supplies viewer positions)");
+static ConVar cvar_simlod_distance("bt_simlod_distance", "2048", FCVAR_REPLICATED, "Objects within this distance (in inches) of a viewer are simulated at full rate");
+static ConVar cvar_simlod_freezedistance("bt_simlod_freezedistance", "6144", FCVAR_REPLICATED, "Objects further than this distance (in inches) from every viewer are frozen");
+static ConVar cvar_simlod_interval("bt_simlod_interval", "4", FCVAR_REPLICATED, "Objects at reduced rate are simulated every Nth tick", true, 1, true, 16);
+static ConVar cvar_simlod_maxspeed("bt_simlod_maxspeed", "100", FCVAR_REPLICATED, "Objects moving faster than this (in inches/s) are always simulated at full rate");
+static ConVar cvar_simlod_promoteticks("bt_simlod_promoteticks", "66", FCVAR_REPLICATED, "Ticks an object stays at full rate after it's been woken up or touched", true, 0, false, 0);
+
+/*******************************
+* CLASS CSimulationLOD
+*******************************/
+
+CSimulationLOD::CSimulationLOD(CPhysicsEnvironment *pEnv) {
+	m_pEnv = pEnv;
+	m_tick = 0;
+	m_bActive = false;
+}
+
+void CSimulationLOD::SetViewers(const Vector *pPositions, int count) {
+	m_viewers.resize(0);
+	if (!pPositions) return;
+
+	for (int i = 0; i < count; i++) {
+		btVector3 pos;
+		ConvertPosToBull(pPositions[i], pos);
+		m_viewers.push_back(pos);
+	}
+}
+
+static int CompareIslandTags(const int *a, const int *b) {
+	return *a - *b;
+}
+
+void CSimulationLOD::PreTick(btScalar dt) {
+	if (!cvar_simlod.GetBool() || m_viewers.size() == 0) {
+		if (m_bActive)
+			ReleaseAll();
+
+		return;
+	}
+
+	m_bActive = true;
+	m_tick++;
+
+	const unsigned int interval = cvar_simlod_interval.GetInt();
+	const int promoteTicks = cvar_simlod_promoteticks.GetInt();
+
+	int numObjects;
+	const IPhysicsObject **pObjects = m_pEnv->GetObjectList(&numObjects);
+
+	// First pass: find the islands that have to run at full rate. Island tags are from the last step,
+	// which is what Bullet is going to wake up together anyway.
+	m_fullRateIslands.RemoveAll();
+	for (int i = 0; i < numObjects; i++) {
+		CPhysicsObject *pObject = (CPhysicsObject *)pObjects[i];
+		btRigidBody *pBody = pObject->GetObject();
+		simlodstate_t &lod = pObject->GetLodState();
+
+		if (lod.held) {
+			if (pBody->getActivationState() == ISLAND_SLEEPING)
+				continue;
+
+			// Woken up by something touching it
+			Release(pObject);
+			lod.cooldown = promoteTicks;
+		}
+
+		// Asleep on its own, nothing to save
+		if (!pBody->isActive())
+			continue;
+
+		if (lod.cooldown > 0 || Classify(pObject) == LOD_FULL) {
+			if (pBody->getIslandTag() >= 0)
+				m_fullRateIslands.AddToTail(pBody->getIslandTag());
+		}
+	}
+
+	m_fullRateIslands.Sort(CompareIslandTags);
+
+	// Second pass: hold or release everything else, one island at a time
+	for (int i = 0; i < numObjects; i++) {
+		CPhysicsObject *pObject = (CPhysicsObject *)pObjects[i];
+		btRigidBody *pBody = pObject->GetObject();
+		simlodstate_t &lod = pObject->GetLodState();
+
+		if (lod.cooldown > 0) {
+			lod.cooldown--;
+			continue;
+		}
+
+		if (!lod.held && !pBody->isActive())
+			continue;
+
+		const int islandTag = pBody->getIslandTag();
+		if (islandTag >= 0 && IsFullRateIsland(islandTag)) {
+			// Touching something that runs at full rate
+			if (lod.held) {
+				Release(pObject);
+				lod.cooldown = promoteTicks;
+			}
+
+			continue;
+		}
+
+		switch (Classify(pObject)) {
+			case LOD_FULL:
+				if (lod.held)
+					Release(pObject);
+
+				break;
+			case LOD_REDUCED: {
+				// Spread the islands over the interval, so we don't step all of them on the same tick
+				const unsigned int slot = islandTag >= 0 ? islandTag : i;
+				if ((m_tick + slot) % interval == 0) {
+					if (lod.held)
+						Release(pObject);
+				} else if (!lod.held) {
+					Hold(pObject);
+				}
+
+				break;
+			}
+			case LOD_FROZEN:
+				if (!lod.held)
+					Hold(pObject);
+
+				break;
+		}
+	}
+}
+
+bool CSimulationLOD::IsFullRateIsland(int islandTag) const {
+	int lo = 0, hi = m_fullRateIslands.Count() - 1;
+	while (lo <= hi) {
+		const int mid = (lo + hi) / 2;
+		if (m_fullRateIslands[mid] == islandTag)
+			return true;
+
+		if (m_fullRateIslands[mid] < islandTag)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return false;
+}
+
+void CSimulationLOD::Promote(CPhysicsObject *pObject) {
+	simlodstate_t &lod = pObject->GetLodState();
+	if (!lod.held)
+		return;
+
+	Release(pObject);
+	lod.cooldown = cvar_simlod_promoteticks.GetInt();
+}
+
+CSimulationLOD::ELodLevel CSimulationLOD::Classify(CPhysicsObject *pObject) const {
+	// Only plain props, anything the game drives directly has to be simulated every tick
+	if (pObject->IsStatic() || !pObject->IsMotionEnabled() || pObject->IsTrigger() || pObject->IsFluid()
+		|| pObject->GetShadowController() || pObject->GetVehicleController()
+		|| pObject->GetCallbackFlags() & (CALLBACK_IS_PLAYER_CONTROLLER | CALLBACK_MARKED_FOR_DELETE)) {
+		return LOD_FULL;
+	}
+
+	const simlodstate_t &lod = pObject->GetLodState();
+	const btRigidBody *pBody = pObject->GetObject();
+
+	const btScalar maxSpeed = ConvertDistanceToBull(cvar_simlod_maxspeed.GetFloat());
+	const btVector3 &linVel = lod.held ? lod.linVel : pBody->getLinearVelocity();
+	if (linVel.length2() > maxSpeed * maxSpeed)
+		return LOD_FULL;
+
+	const btVector3 &pos = pBody->getWorldTransform().getOrigin();
+	btScalar minDistSqr = BT_LARGE_FLOAT;
+	for (int i = 0; i < m_viewers.size(); i++)
+		minDistSqr = btMin(minDistSqr, pos.distance2(m_viewers[i]));
+
+	const btScalar nearDist = ConvertDistanceToBull(cvar_simlod_distance.GetFloat());
+	if (minDistSqr <= nearDist * nearDist)
+		return LOD_FULL;
+
+	const btScalar freezeDist = ConvertDistanceToBull(cvar_simlod_freezedistance.GetFloat());
+	if (minDistSqr <= freezeDist * freezeDist)
+		return LOD_REDUCED;
+
+	return LOD_FROZEN;
+}
+
+void CSimulationLOD::Hold(CPhysicsObject *pObject) {
+	btRigidBody *pBody = pObject->GetObject();
+	simlodstate_t &lod = pObject->GetLodState();
+
+	// Bullet clears the velocity of slow sleeping objects, keep it so we can restore it
+	lod.linVel = pBody->getLinearVelocity();
+	lod.angVel = pBody->getAngularVelocity();
+	lod.held = true;
+
+	pBody->setActivationState(ISLAND_SLEEPING);
+}
+
+void CSimulationLOD::Release(CPhysicsObject *pObject) {
+	btRigidBody *pBody = pObject->GetObject();
+	simlodstate_t &lod = pObject->GetLodState();
+
+	lod.held = false;
+
+	pBody->setActivationState(ACTIVE_TAG);
+	pBody->setDeactivationTime(0);
+	pBody->setLinearVelocity(lod.linVel);
+	pBody->setAngularVelocity(lod.angVel);
+}
+
+void CSimulationLOD::ReleaseAll() {
+	int numObjects;
+	const IPhysicsObject **pObjects = m_pEnv->GetObjectList(&numObjects);
+	for (int i = 0; i < numObjects; i++) {
+		CPhysicsObject *pObject = (CPhysicsObject *)pObjects[i];
+		if (pObject->GetLodState().held)
+			Release(pObject);
+	}
+
+	m_bActive = false;
+}
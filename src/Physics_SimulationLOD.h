@@ -0,0 +1,49 @@
+#ifndef PHYSICS_SIMULATIONLOD_H
+#define PHYSICS_SIMULATIONLOD_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+class CPhysicsEnvironment;
+class CPhysicsObject;
+
+// Purpose: Distance based simulation level of detail.
+// Objects far away from every viewer are only stepped every bt_simlod_interval ticks and frozen in between
+// (so they run in slow motion, but never move without collision detection), objects even further away are
+// frozen until a viewer comes close or something touches them.
+// Held objects are put to sleep in bullet, so they cost nothing in the collision detection and the solver.
+// Decisions are made per simulation island, so objects touching each other are always stepped together.
+class CSimulationLOD {
+	public:
+		CSimulationLOD(CPhysicsEnvironment *pEnv);
+
+		void						SetViewers(const Vector *pPositions, int count);
+
+		// Called before each simulation tick
+		void						PreTick(btScalar dt);
+
+		// The game woke up, teleported or pushed the object. Runs it at full rate for a while,
+		// with the velocity it had when it was held.
+		static void					Promote(CPhysicsObject *pObject);
+
+	private:
+		enum ELodLevel {
+			LOD_FULL = 0,
+			LOD_REDUCED,
+			LOD_FROZEN,
+		};
+
+		ELodLevel					Classify(CPhysicsObject *pObject) const;
+		bool						IsFullRateIsland(int islandTag) const;
+		static void					Hold(CPhysicsObject *pObject);
+		static void					Release(CPhysicsObject *pObject);
+		void						ReleaseAll();
+
+		CPhysicsEnvironment *		m_pEnv;
+		btAlignedObjectArray<btVector3> m_viewers; // Bullet space
+		CUtlVector<int>				m_fullRateIslands;	// Sorted island tags of the last step's islands that run at full rate
+		unsigned int				m_tick;
+		bool						m_bActive;	// Did we hold anything since we were last disabled?
+};
+
+#endif // PHYSICS_SIMULATIONLOD_H
@@ -0,0 +1,552 @@
+#include "StdAfx.h"
+
+#include "Physics_Solver.h"
+#include "Physics_Constraint.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cvar_solver_adaptive("bt_solver_adaptive", "1", FCVAR_REPLICATED, "Give large, deeply stacked islands extra solver iterations (up to bt_solver_adaptive_maxiterations)");
+static ConVar cvar_solver_adaptive_maxiterations("bt_solver_adaptive_maxiterations", "16", FCVAR_REPLICATED, "Maximum number of solver iterations a single island can use in adaptive mode", true, 1, true, 64);
+static ConVar cvar_solver_contactreduction("bt_solver_contactreduction", "1", FCVAR_REPLICATED, "Merge all contact manifolds between two objects into a single manifold of up to 4 points before solving");
+static void cvar_solver_batchingmethod_Change(IConVar *var, const char *pOldValue, float flOldValue);
+static ConVar cvar_solver_batchingmethod("bt_solver_batchingmethod", "1", FCVAR_REPLICATED, "How large islands are split into batches that can be solved in parallel (0 = 2D grid, 1 = 3D grid, better for piles)", true, 0, true, 1, cvar_solver_batchingmethod_Change);
+static void cvar_solver_batchingmethod_Change(IConVar *var, const char *pOldValue, float flOldValue)
+{
+	ApplySolverBatchingMethod();
+	Msg("Solver batching method is changed from %i to %i\n", static_cast<int>(flOldValue), cvar_solver_batchingmethod.GetInt());
+}
+
+static ConVar cvar_solver_adaptive_islandsize("bt_solver_adaptive_islandsize", "32", FCVAR_REPLICATED, "Islands with at least this many manifolds + constraints are considered for extra solver iterations", true, 1, true, 10000);
+
+/*******************************
+* CLASS CSolverStatsTracker
+*******************************/
+
+void CSolverStatsTracker::RecordIsland(int iterations, int budget) {
+	m_solverStats.islands++;
+	m_solverStats.iterations += iterations;
+	m_solverStats.budget += budget;
+
+	if (iterations > m_solverStats.maxIterations)
+		m_solverStats.maxIterations = iterations;
+
+	if (iterations < budget)
+		m_solverStats.earlyExits++;
+}
+
+void CSolverStatsTracker::RecordContacts(int contacts, int reducedContacts) {
+	m_solverStats.contacts += contacts;
+	m_solverStats.reducedContacts += reducedContacts;
+}
+
+/*******************************
+* CLASS CContactReducer
+*******************************/
+
+CContactReducer::CContactReducer() {
+	m_numUsedManifolds = 0;
+	m_numContacts = 0;
+	m_numReducedContacts = 0;
+}
+
+CContactReducer::~CContactReducer() {
+	m_manifoldPool.PurgeAndDeleteElements();
+}
+
+btPersistentManifold *CContactReducer::AllocManifold() {
+	if (m_numUsedManifolds == m_manifoldPool.Count())
+		m_manifoldPool.AddToTail(new btPersistentManifold);
+
+	return m_manifoldPool[m_numUsedManifolds++];
+}
+
+int CContactReducer::CompareManifoldRefs(const manifoldref_t *a, const manifoldref_t *b) {
+	if (a->pObj0 != b->pObj0)
+		return a->pObj0 < b->pObj0 ? -1 : 1;
+	if (a->pObj1 != b->pObj1)
+		return a->pObj1 < b->pObj1 ? -1 : 1;
+
+	return a->index - b->index;
+}
+
+int CContactReducer::Reduce(btPersistentManifold **manifolds, int numManifolds, btPersistentManifold **&pOutManifolds) {
+	m_numUsedManifolds = 0;
+	m_outManifolds.RemoveAll();
+	m_pointRefs.RemoveAll();
+	m_droppedPoints.RemoveAll();
+
+	m_numContacts = 0;
+	for (int i = 0; i < numManifolds; i++)
+		m_numContacts += manifolds[i]->getNumContacts();
+
+	m_numReducedContacts = m_numContacts;
+	pOutManifolds = manifolds;
+
+	if (!cvar_solver_contactreduction.GetBool() || numManifolds < 2)
+		return numManifolds;
+
+	m_refs.SetCount(numManifolds);
+	for (int i = 0; i < numManifolds; i++) {
+		const btCollisionObject *pObj0 = manifolds[i]->getBody0();
+		const btCollisionObject *pObj1 = manifolds[i]->getBody1();
+
+		m_refs[i].pObj0 = pObj0 < pObj1 ? pObj0 : pObj1;
+		m_refs[i].pObj1 = pObj0 < pObj1 ? pObj1 : pObj0;
+		m_refs[i].index = i;
+	}
+
+	m_refs.Sort(CompareManifoldRefs);
+
+	// Each pair is solved in place of its first manifold, so the solve order stays deterministic
+	m_outManifolds.SetCount(numManifolds);
+	for (int i = 0; i < numManifolds; i++)
+		m_outManifolds[i] = NULL;
+
+	bool reduced = false;
+	for (int start = 0; start < numManifolds;) {
+		int end = start + 1;
+		while (end < numManifolds && m_refs[end].pObj0 == m_refs[start].pObj0 && m_refs[end].pObj1 == m_refs[start].pObj1)
+			end++;
+
+		if (end - start > 1) {
+			m_outManifolds[m_refs[start].index] = ReducePair(manifolds, &m_refs[start], end - start);
+			reduced = true;
+		} else {
+			m_outManifolds[m_refs[start].index] = manifolds[m_refs[start].index];
+		}
+
+		start = end;
+	}
+
+	if (!reduced) {
+		m_outManifolds.RemoveAll();
+		return numManifolds;
+	}
+
+	int numOut = 0;
+	m_numReducedContacts = 0;
+	for (int i = 0; i < numManifolds; i++) {
+		if (!m_outManifolds[i])
+			continue;
+
+		m_numReducedContacts += m_outManifolds[i]->getNumContacts();
+		m_outManifolds[numOut++] = m_outManifolds[i];
+	}
+
+	m_outManifolds.RemoveMultiple(numOut, numManifolds - numOut);
+
+	pOutManifolds = m_outManifolds.Base();
+	return numOut;
+}
+
+// Gathers the points of all manifolds of a pair (in the frame of the first manifold) and picks up to 4 of them
+// Returns NULL if none of the manifolds have any points to solve
+btPersistentManifold *CContactReducer::ReducePair(btPersistentManifold **manifolds, const manifoldref_t *refs, int numRefs) {
+	const btPersistentManifold *pFirst = manifolds[refs[0].index];
+
+	m_points.resize(0);
+	m_pointOrigins.RemoveAll();
+
+	btScalar totalImpulse = 0;
+	for (int i = 0; i < numRefs; i++) {
+		btPersistentManifold *pManifold = manifolds[refs[i].index];
+		const bool swapped = pManifold->getBody0() != pFirst->getBody0();
+
+		for (int j = 0; j < pManifold->getNumContacts(); j++) {
+			btManifoldPoint &original = pManifold->getContactPoint(j);
+			if (original.getDistance() > pManifold->getContactProcessingThreshold()) {
+				m_droppedPoints.AddToTail(&original);
+				continue;
+			}
+
+			btManifoldPoint &pt = m_points.expandNonInitializing();
+			pt = original;
+			pt.m_userPersistentData = NULL; // Belongs to the original point
+			if (swapped) {
+				btSwap(pt.m_localPointA, pt.m_localPointB);
+				btSwap(pt.m_positionWorldOnA, pt.m_positionWorldOnB);
+				btSwap(pt.m_partId0, pt.m_partId1);
+				btSwap(pt.m_index0, pt.m_index1);
+				pt.m_normalWorldOnB = -pt.m_normalWorldOnB;
+				pt.m_contactPointFlags &= ~BT_CONTACT_FLAG_LATERAL_FRICTION_INITIALIZED;
+			}
+
+			m_pointOrigins.AddToTail(&original);
+			totalImpulse += original.m_appliedImpulse;
+		}
+	}
+
+	const int numPoints = m_points.size();
+	if (numPoints == 0)
+		return NULL;
+
+	int selected[MANIFOLD_CACHE_SIZE];
+	int numSelected = 0;
+
+	// Deepest point first, so we keep the penetration depth
+	int best = 0;
+	for (int i = 1; i < numPoints; i++) {
+		if (m_points[i].getDistance() < m_points[best].getDistance())
+			best = i;
+	}
+	selected[numSelected++] = best;
+
+	// Then the point furthest away from it
+	const btVector3 p0 = m_points[selected[0]].m_positionWorldOnB;
+	btScalar bestValue = SIMD_EPSILON;
+	best = -1;
+	for (int i = 0; i < numPoints; i++) {
+		const btScalar distSqr = (m_points[i].m_positionWorldOnB - p0).length2();
+		if (distSqr > bestValue) {
+			bestValue = distSqr;
+			best = i;
+		}
+	}
+
+	if (best != -1) {
+		selected[numSelected++] = best;
+
+		// Then the point that spans the largest triangle with them
+		const btVector3 p1 = m_points[selected[1]].m_positionWorldOnB;
+		bestValue = SIMD_EPSILON;
+		best = -1;
+		for (int i = 0; i < numPoints; i++) {
+			const btScalar areaSqr = (p1 - p0).cross(m_points[i].m_positionWorldOnB - p0).length2();
+			if (areaSqr > bestValue) {
+				bestValue = areaSqr;
+				best = i;
+			}
+		}
+
+		if (best != -1) {
+			selected[numSelected++] = best;
+
+			// And the point furthest outside of that triangle, so we cover as much of the support polygon as we can
+			const btVector3 p2 = m_points[selected[2]].m_positionWorldOnB;
+			const btVector3 normal = (p1 - p0).cross(p2 - p0);
+			const btVector3 tri[3] = {p0, p1, p2};
+
+			bestValue = SIMD_EPSILON;
+			best = -1;
+			for (int i = 0; i < numPoints; i++) {
+				const btVector3 &p = m_points[i].m_positionWorldOnB;
+
+				btScalar outside = 0;
+				for (int e = 0; e < 3; e++) {
+					const btVector3 &a = tri[e];
+					const btVector3 &b = tri[(e + 1) % 3];
+					outside = btMax(outside, -(b - a).cross(p - a).dot(normal));
+				}
+
+				if (outside > bestValue) {
+					bestValue = outside;
+					best = i;
+				}
+			}
+
+			if (best != -1)
+				selected[numSelected++] = best;
+		}
+	}
+
+	// The selected points carry the load of all of the pair's points now
+	btScalar selectedImpulse = 0;
+	for (int i = 0; i < numSelected; i++)
+		selectedImpulse += m_points[selected[i]].m_appliedImpulse;
+
+	const btScalar impulseScale = selectedImpulse > SIMD_EPSILON ? totalImpulse / selectedImpulse : btScalar(1);
+
+	btPersistentManifold *pReduced = AllocManifold();
+	pReduced->setBodies(pFirst->getBody0(), pFirst->getBody1());
+	pReduced->setContactBreakingThreshold(pFirst->getContactBreakingThreshold());
+	pReduced->setContactProcessingThreshold(pFirst->getContactProcessingThreshold());
+	pReduced->m_companionIdA = pFirst->m_companionIdA;
+	pReduced->m_companionIdB = pFirst->m_companionIdB;
+
+	for (int i = 0; i < numSelected; i++) {
+		btManifoldPoint pt = m_points[selected[i]];
+		pt.m_appliedImpulse *= impulseScale;
+
+		pointref_t &ref = m_pointRefs[m_pointRefs.AddToTail()];
+		ref.pReduced = pReduced;
+		ref.reducedIndex = pReduced->addManifoldPoint(pt);
+		ref.pOriginal = m_pointOrigins[selected[i]];
+	}
+
+	// Points that didn't make it won't be solved this step
+	for (int i = 0; i < numPoints; i++) {
+		bool wasSelected = false;
+		for (int j = 0; j < numSelected && !wasSelected; j++)
+			wasSelected = selected[j] == i;
+
+		if (!wasSelected)
+			m_droppedPoints.AddToTail(m_pointOrigins[i]);
+	}
+
+	return pReduced;
+}
+
+void CContactReducer::WriteBack() {
+	for (int i = 0; i < m_pointRefs.Count(); i++) {
+		const btManifoldPoint &solved = m_pointRefs[i].pReduced->getContactPoint(m_pointRefs[i].reducedIndex);
+		btManifoldPoint *pOriginal = m_pointRefs[i].pOriginal;
+
+		pOriginal->m_appliedImpulse = solved.m_appliedImpulse;
+		pOriginal->m_appliedImpulseLateral1 = solved.m_appliedImpulseLateral1;
+		pOriginal->m_appliedImpulseLateral2 = solved.m_appliedImpulseLateral2;
+	}
+
+	// Don't warmstart with impulses from before they were dropped
+	for (int i = 0; i < m_droppedPoints.Count(); i++) {
+		m_droppedPoints[i]->m_appliedImpulse = 0;
+		m_droppedPoints[i]->m_appliedImpulseLateral1 = 0;
+		m_droppedPoints[i]->m_appliedImpulseLateral2 = 0;
+	}
+
+	for (int i = 0; i < m_numUsedManifolds; i++)
+		m_manifoldPool[i]->clearManifold();
+
+	m_numUsedManifolds = 0;
+}
+
+/*******************************
+* ADAPTIVE ITERATIONS
+*******************************/
+
+// Solver body index of a dynamic object, -1 for static and kinematic objects (which are shared between islands)
+static inline int GetSolverBodyId(const btCollisionObject *pObject, int numSolverBodies) {
+	if (pObject->isStaticOrKinematicObject())
+		return -1;
+
+	const int id = pObject->getCompanionId();
+	return id < numSolverBodies ? id : -1;
+}
+
+// Relaxes the depth of both sides of an edge. Returns true if anything changed.
+static inline bool RelaxEdge(CUtlVector<int> &depth, int id0, int id1) {
+	if (id0 < 0 || id1 < 0)
+		return false;
+
+	if (depth[id0] + 1 < depth[id1]) {
+		depth[id1] = depth[id0] + 1;
+		return true;
+	} else if (depth[id1] + 1 < depth[id0]) {
+		depth[id0] = depth[id1] + 1;
+		return true;
+	}
+
+	return false;
+}
+
+int ComputeIslandIterations(int baseIterations, int numSolverBodies, btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints, CUtlVector<int> &depth) {
+	if (!cvar_solver_adaptive.GetBool() || numSolverBodies <= 0)
+		return baseIterations;
+
+	// Small islands converge fine with the base iteration count
+	if (numManifolds + numConstraints < cvar_solver_adaptive_islandsize.GetInt())
+		return baseIterations;
+
+	// Depth beyond this wouldn't buy any more iterations, so don't bother measuring it
+	const int maxExtra = cvar_solver_adaptive_maxiterations.GetInt() - baseIterations;
+	if (maxExtra <= 0)
+		return baseIterations;
+
+	// Estimate how deep the island is stacked: the length of the longest chain of contacts/constraints
+	// from a body resting on something static. Impulses need about one iteration per link to propagate.
+	depth.SetCount(numSolverBodies);
+	for (int i = 0; i < numSolverBodies; i++)
+		depth[i] = INT_MAX / 2;
+
+	bool hasRoot = false;
+	for (int i = 0; i < numManifolds; i++) {
+		const btCollisionObject *pObj0 = manifolds[i]->getBody0();
+		const btCollisionObject *pObj1 = manifolds[i]->getBody1();
+		const int id0 = GetSolverBodyId(pObj0, numSolverBodies);
+		const int id1 = GetSolverBodyId(pObj1, numSolverBodies);
+
+		if (id0 >= 0 && id1 < 0 && pObj1->isStaticOrKinematicObject()) {
+			depth[id0] = 0;
+			hasRoot = true;
+		} else if (id1 >= 0 && id0 < 0 && pObj0->isStaticOrKinematicObject()) {
+			depth[id1] = 0;
+			hasRoot = true;
+		}
+	}
+
+	// Free floating island (ragdoll tangle in the air), measure from any body
+	if (!hasRoot) {
+		for (int i = 0; i < numManifolds && !hasRoot; i++) {
+			const int id = GetSolverBodyId(manifolds[i]->getBody0(), numSolverBodies);
+			if (id >= 0) {
+				depth[id] = 0;
+				hasRoot = true;
+			}
+		}
+
+		for (int i = 0; i < numConstraints && !hasRoot; i++) {
+			const int id = GetSolverBodyId(&constraints[i]->getRigidBodyA(), numSolverBodies);
+			if (id >= 0) {
+				depth[id] = 0;
+				hasRoot = true;
+			}
+		}
+
+		if (!hasRoot)
+			return baseIterations;
+	}
+
+	// Bounded relaxation over the island graph, at most maxExtra passes
+	bool converged = false;
+	for (int pass = 0; pass < maxExtra && !converged; pass++) {
+		bool changed = false;
+
+		for (int i = 0; i < numManifolds; i++) {
+			if (manifolds[i]->getNumContacts() <= 0)
+				continue;
+
+			changed |= RelaxEdge(depth, GetSolverBodyId(manifolds[i]->getBody0(), numSolverBodies), GetSolverBodyId(manifolds[i]->getBody1(), numSolverBodies));
+		}
+
+		for (int i = 0; i < numConstraints; i++) {
+			if (!constraints[i]->isEnabled())
+				continue;
+
+			changed |= RelaxEdge(depth, GetSolverBodyId(&constraints[i]->getRigidBodyA(), numSolverBodies), GetSolverBodyId(&constraints[i]->getRigidBodyB(), numSolverBodies));
+		}
+
+		converged = !changed;
+	}
+
+	// Still propagating after maxExtra passes, so the island is at least that deep
+	if (!converged)
+		return baseIterations + maxExtra;
+
+	// NOTE: The solver body pool also holds the shared fixed/kinematic bodies, which are never reached
+	int islandDepth = 0;
+	for (int i = 0; i < numSolverBodies; i++) {
+		if (depth[i] < INT_MAX / 2 && depth[i] > islandDepth)
+			islandDepth = depth[i];
+	}
+
+	return baseIterations + islandDepth;
+}
+
+/*******************************
+* CLASS CParallelIslandSolver
+*******************************/
+
+CParallelIslandSolver::CParallelIslandSolver() {
+	m_minBatchingManifolds = 1;
+}
+
+// Same as btSequentialImpulseConstraintSolverMt::solveGroupCacheFriendlySetup, with our own batching threshold
+// instead of s_minimumContactManifoldsForBatching (which is shared by every environment and the pool solvers)
+btScalar CParallelIslandSolver::solveGroupCacheFriendlySetup(btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints, const btContactSolverInfo &infoGlobal, btIDebugDraw *debugDrawer) {
+	BT_PROFILE("solveGroupCacheFriendlySetup");
+
+	m_useBatching = false;
+	if (numManifolds >= m_minBatchingManifolds && (s_allowNestedParallelForLoops || !btThreadsAreRunning())) {
+		m_useBatching = true;
+		m_batchedContactConstraints.m_debugDrawer = debugDrawer;
+		m_batchedJointConstraints.m_debugDrawer = debugDrawer;
+	}
+
+	btSequentialImpulseConstraintSolver::solveGroupCacheFriendlySetup(bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, infoGlobal, debugDrawer);
+	return 0.f;
+}
+
+void ApplySolverBatchingMethod() {
+	const btBatchedConstraints::BatchingMethod method = cvar_solver_batchingmethod.GetBool() ? btBatchedConstraints::BATCHING_METHOD_SPATIAL_GRID_3D : btBatchedConstraints::BATCHING_METHOD_SPATIAL_GRID_2D;
+	btSequentialImpulseConstraintSolverMt::s_contactBatchingMethod = method;
+	btSequentialImpulseConstraintSolverMt::s_jointBatchingMethod = method;
+}
+
+/*******************************
+* CLASS CConstraintOrder
+*******************************/
+
+// Every constraint in the world belongs to a CPhysicsConstraint
+static inline int GetSolveOrder(const btTypedConstraint *pConstraint) {
+	const CPhysicsConstraint *pPhys = (const CPhysicsConstraint *)pConstraint->getUserConstraintPtr();
+	return pPhys && pPhys != (void *)-1 ? pPhys->GetSolveOrder() : 0;
+}
+
+int CConstraintOrder::CompareConstraintRefs(const constraintref_t *a, const constraintref_t *b) {
+	if (a->order != b->order)
+		return a->order < b->order ? -1 : 1;
+
+	return a->index - b->index;
+}
+
+btTypedConstraint **CConstraintOrder::Sort(btTypedConstraint **constraints, int numConstraints) {
+	bool sorted = true;
+	for (int i = 1; i < numConstraints && sorted; i++)
+		sorted = GetSolveOrder(constraints[i - 1]) <= GetSolveOrder(constraints[i]);
+
+	if (sorted)
+		return constraints;
+
+	m_refs.SetCount(numConstraints);
+	for (int i = 0; i < numConstraints; i++) {
+		m_refs[i].order = GetSolveOrder(constraints[i]);
+		m_refs[i].index = i;
+	}
+
+	m_refs.Sort(CompareConstraintRefs);
+
+	m_sorted.SetCount(numConstraints);
+	for (int i = 0; i < numConstraints; i++)
+		m_sorted[i] = constraints[m_refs[i].index];
+
+	return m_sorted.Base();
+}
+
+/*******************************
+* ISLAND DISPATCH
+*******************************/
+
+static inline int GetIslandSize(const btSimulationIslandManagerMt::Island *pIsland) {
+	return pIsland->manifoldArray.size() + pIsland->constraintArray.size();
+}
+
+struct IslandSizeGreater {
+	bool operator()(const btSimulationIslandManagerMt::Island *a, const btSimulationIslandManagerMt::Island *b) const {
+		return GetIslandSize(a) > GetIslandSize(b);
+	}
+};
+
+class CSmallIslandLoop : public btIParallelForBody {
+	public:
+		CSmallIslandLoop(btAlignedObjectArray<btSimulationIslandManagerMt::Island *> *islandsPtr, const btSimulationIslandManagerMt::SolverParams &solverParams)
+			: m_islandsPtr(islandsPtr), m_solverParams(solverParams) {
+		}
+
+		void forLoop(int iBegin, int iEnd) const override {
+			for (int i = iBegin; i < iEnd; i++)
+				btSimulationIslandManagerMt::solveIsland(m_solverParams.m_solverPool, *(*m_islandsPtr)[i], m_solverParams);
+		}
+
+	private:
+		btAlignedObjectArray<btSimulationIslandManagerMt::Island *> *	m_islandsPtr;
+		const btSimulationIslandManagerMt::SolverParams &				m_solverParams;
+};
+
+void LargeIslandDispatch(btAlignedObjectArray<btSimulationIslandManagerMt::Island *> *islandsPtr, const btSimulationIslandManagerMt::SolverParams &solverParams) {
+	btAlignedObjectArray<btSimulationIslandManagerMt::Island *> &islands = *islandsPtr;
+	islands.quickSort(IslandSizeGreater());
+
+	// Large islands first, each one uses all threads
+	int iBegin = 0;
+	if (solverParams.m_solverMt) {
+		const int largeIslandSize = btSequentialImpulseConstraintSolverMt::s_minimumContactManifoldsForBatching;
+		while (iBegin < islands.size() && GetIslandSize(islands[iBegin]) >= largeIslandSize) {
+			btSimulationIslandManagerMt::solveIsland(solverParams.m_solverMt, *islands[iBegin], solverParams);
+			iBegin++;
+		}
+	}
+
+	// Then the rest, one island per thread
+	CSmallIslandLoop loop(islandsPtr, solverParams);
+	btParallelFor(iBegin, islands.size(), 1, loop);
+}
@@ -0,0 +1,185 @@
+#ifndef PHYSICS_SOLVER_H
+#define PHYSICS_SOLVER_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <BulletDynamics/Dynamics/btSimulationIslandManagerMt.h>
+
+// Purpose: How much work the constraint solver actually did
+struct solverstats_t {
+	int		islands;			// Islands (or island batches) solved
+	int		iterations;			// Iterations actually run, summed over all islands
+	int		budget;				// Iterations allowed, summed over all islands
+	int		maxIterations;		// Most iterations spent on a single island
+	int		earlyExits;			// Islands that converged before running out of budget
+	int		contacts;			// Contact points handed to the solver
+	int		reducedContacts;	// Contact points actually solved after contact reduction
+};
+
+class CSolverStatsTracker {
+	public:
+		CSolverStatsTracker() { ClearStats(); }
+		virtual ~CSolverStatsTracker() {}
+
+		void					ClearStats() { memset(&m_solverStats, 0, sizeof(m_solverStats)); }
+		const solverstats_t &	GetStats() const { return m_solverStats; }
+
+	protected:
+		void					RecordIsland(int iterations, int budget);
+		void					RecordContacts(int contacts, int reducedContacts);
+
+	private:
+		solverstats_t			m_solverStats;
+};
+
+// Purpose: Merges all manifolds of a body pair (compound children vs. compound children/mesh triangles)
+// into a single manifold of up to 4 well spread points: the deepest point, and the points spanning the
+// largest contact area. The solver works on copies, the original manifolds are left to the narrowphase.
+class CContactReducer {
+	public:
+		CContactReducer();
+		~CContactReducer();
+
+		// Returns the manifold list to solve in pOutManifolds (either the input list, or our reduced list)
+		int						Reduce(btPersistentManifold **manifolds, int numManifolds, btPersistentManifold **&pOutManifolds);
+
+		// Copy the solved impulses back to the original points (for warmstarting)
+		void					WriteBack();
+
+		int						GetNumContacts() const { return m_numContacts; }
+		int						GetNumReducedContacts() const { return m_numReducedContacts; }
+
+	private:
+		struct manifoldref_t {
+			const btCollisionObject *	pObj0;	// Sorted pair
+			const btCollisionObject *	pObj1;
+			int							index;
+		};
+
+		// Where a reduced point came from
+		struct pointref_t {
+			btPersistentManifold *	pReduced;
+			int						reducedIndex;
+			btManifoldPoint *		pOriginal;
+		};
+
+		static int				CompareManifoldRefs(const manifoldref_t *a, const manifoldref_t *b);
+		btPersistentManifold *	ReducePair(btPersistentManifold **manifolds, const manifoldref_t *refs, int numRefs);
+		btPersistentManifold *	AllocManifold();
+
+		CUtlVector<btPersistentManifold *>	m_manifoldPool;
+		int									m_numUsedManifolds;
+
+		CUtlVector<manifoldref_t>			m_refs;
+		CUtlVector<btPersistentManifold *>	m_outManifolds;
+		CUtlVector<pointref_t>				m_pointRefs;
+		CUtlVector<btManifoldPoint *>		m_droppedPoints;
+
+		// Scratch space for a single pair
+		btAlignedObjectArray<btManifoldPoint> m_points;
+		CUtlVector<btManifoldPoint *>		m_pointOrigins;
+
+		int									m_numContacts;
+		int									m_numReducedContacts;
+};
+
+// Purpose: Hands the constraints of an island to the solver sorted by their solve order (see CPhysicsConstraint::SetSolveOrder).
+// The order of the world's constraint list can't be relied on: removing a constraint swaps the last one into its place,
+// and the single threaded world groups the list by island with an unstable sort.
+class CConstraintOrder {
+	public:
+		// Returns the constraints to solve (either the input list, or our sorted list)
+		btTypedConstraint **	Sort(btTypedConstraint **constraints, int numConstraints);
+
+	private:
+		struct constraintref_t {
+			int						order;
+			int						index;
+		};
+
+		static int				CompareConstraintRefs(const constraintref_t *a, const constraintref_t *b);
+
+		CUtlVector<constraintref_t>		m_refs;
+		CUtlVector<btTypedConstraint *>	m_sorted;
+};
+
+// Returns the iteration budget for an island. Islands with large, deeply stacked
+// constraint graphs get extra iterations on top of baseIterations.
+// Must be called after solver setup (while companion ids point into the solver body pool).
+// depth is scratch space, reused so a step doesn't allocate for every island.
+int ComputeIslandIterations(int baseIterations, int numSolverBodies, btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints, CUtlVector<int> &depth);
+
+// Purpose: Sequential impulse solver that picks its iteration count per island,
+// and stops as soon as the residual drops below m_leastSquaresResidualThreshold.
+template <class T>
+class CAdaptiveSolver : public T, public CSolverStatsTracker {
+	public:
+		btScalar solveGroup(btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints, const btContactSolverInfo &info, btIDebugDraw *debugDrawer, btDispatcher *dispatcher) override {
+			btPersistentManifold **solveManifolds = manifolds;
+			const int numSolveManifolds = m_contactReducer.Reduce(manifolds, numManifolds, solveManifolds);
+			btTypedConstraint **solveConstraints = m_constraintOrder.Sort(constraints, numConstraints);
+
+			const btScalar ret = T::solveGroup(bodies, numBodies, solveManifolds, numSolveManifolds, solveConstraints, numConstraints, info, debugDrawer, dispatcher);
+
+			m_contactReducer.WriteBack();
+			RecordContacts(m_contactReducer.GetNumContacts(), m_contactReducer.GetNumReducedContacts());
+			return ret;
+		}
+
+	protected:
+		btScalar solveGroupCacheFriendlyIterations(btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints, const btContactSolverInfo &infoGlobal, btIDebugDraw *debugDrawer) override {
+			// Special step to resolve penetrations (just for contacts)
+			this->solveGroupCacheFriendlySplitImpulseIterations(bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, infoGlobal, debugDrawer);
+
+			const int baseIterations = this->m_maxOverrideNumSolverIterations > infoGlobal.m_numIterations ? this->m_maxOverrideNumSolverIterations : infoGlobal.m_numIterations;
+			const int budget = ComputeIslandIterations(baseIterations, this->m_tmpSolverBodyPool.size(), manifolds, numManifolds, constraints, numConstraints, m_islandDepth);
+
+			int iteration = 0;
+			while (iteration < budget) {
+				this->m_leastSquaresResidual = this->solveSingleIteration(iteration, bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, infoGlobal, debugDrawer);
+				iteration++;
+
+				if (this->m_leastSquaresResidual <= infoGlobal.m_leastSquaresResidualThreshold)
+					break;
+			}
+
+			RecordIsland(iteration, budget);
+			return 0.f;
+		}
+
+	private:
+		CContactReducer m_contactReducer;
+		CConstraintOrder m_constraintOrder;
+		CUtlVector<int> m_islandDepth;	// Scratch space of ComputeIslandIterations (a solver is used by one thread at a time)
+};
+
+// Purpose: Solver for large islands (see LargeIslandDispatch).
+// It always splits the contacts and joints into batches that don't share any bodies (spatial grid coloring),
+// so a single giant island is solved on all worker threads.
+// NOTE: Joints are solved batch by batch here, so the solve order only holds within a batch.
+class CParallelIslandSolver : public CAdaptiveSolver<btSequentialImpulseConstraintSolverMt> {
+	public:
+		CParallelIslandSolver();
+
+		// Islands with fewer manifolds aren't batched. We're only given islands that are large enough (including their
+		// constraints, and before contact reduction), so this defaults to always batching.
+		void					SetMinBatchingManifolds(int minManifolds) { m_minBatchingManifolds = minManifolds; }
+
+	protected:
+		btScalar solveGroupCacheFriendlySetup(btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds, btTypedConstraint **constraints, int numConstraints, const btContactSolverInfo &infoGlobal, btIDebugDraw *debugDrawer) override;
+
+	private:
+		int						m_minBatchingManifolds;
+};
+
+// Applies bt_solver_batchingmethod to Bullet's (global) batching settings
+void ApplySolverBatchingMethod();
+
+// Island dispatch for btSimulationIslandManagerMt. Islands with at least bt_solver_islandbatchingthreshold
+// manifolds + constraints are solved one after another with the parallel solver, the rest are spread
+// over the threads with the solver pool.
+void LargeIslandDispatch(btAlignedObjectArray<btSimulationIslandManagerMt::Island *> *islandsPtr, const btSimulationIslandManagerMt::SolverParams &solverParams);
+
+#endif // PHYSICS_SOLVER_H
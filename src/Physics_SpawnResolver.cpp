@@ -0,0 +1,169 @@
+#include "StdAfx.h"
+
+#include "Physics_SpawnResolver.h"
+#include "Physics_Environment.h"
+#include "Physics_Object.h"
+#include "convert.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cvar_spawn_depenetration("bt_spawn_depenetration", "1", FCVAR_REPLICATED, "Push newly created objects out of whatever they were spawned into before their first simulation step");
+static ConVar cvar_spawn_depenetration_iterations("bt_spawn_depenetration_iterations", "4", FCVAR_REPLICATED, "Maximum number of projection passes over the new objects", true, 1, true, 16);
+static ConVar cvar_spawn_depenetration_maxobjects("bt_spawn_depenetration_maxobjects", "128", FCVAR_REPLICATED, "Maximum number of new objects handled in a single tick, the rest are handled in the next ticks", true, 1, false, 0);
+
+/*******************************
+* CLASS CSpawnContactCallback
+*******************************/
+
+// Collects how far an object has to move to get out of everything it's penetrating
+class CSpawnContactCallback : public btCollisionWorld::ContactResultCallback {
+	public:
+		CSpawnContactCallback(btDynamicsWorld *pWorld, btRigidBody *pBody, const CUtlVector<CPhysicsObject *> &batch) : m_batch(batch) {
+			m_pWorld = pWorld;
+			m_pBody = pBody;
+			m_correction.setZero();
+		}
+
+		bool needsCollision(btBroadphaseProxy *proxy0) const override {
+			if (!btCollisionWorld::ContactResultCallback::needsCollision(proxy0))
+				return false;
+
+			const btCollisionObject *pOther = static_cast<const btCollisionObject *>(proxy0->m_clientObject);
+			if (pOther->hasContactResponse() == false || !m_pBody->checkCollideWith(pOther))
+				return false;
+
+			// Let the game decide, same as the simulation
+			btOverlapFilterCallback *pFilter = m_pWorld->getPairCache()->getOverlapFilterCallback();
+			if (pFilter && !pFilter->needBroadphaseCollision(m_pBody->getBroadphaseHandle(), proxy0))
+				return false;
+
+			return true;
+		}
+
+		btScalar addSingleResult(btManifoldPoint &cp, const btCollisionObjectWrapper *colObj0Wrap, int partId0, int index0, const btCollisionObjectWrapper *colObj1Wrap, int partId1, int index1) override {
+			const btScalar depth = -cp.getDistance();
+			if (depth <= 0)
+				return 0;
+
+			// Normal points from object 1 to object 0
+			const bool isBody0 = colObj0Wrap->getCollisionObject() == m_pBody;
+			const btCollisionObject *pOther = isBody0 ? colObj1Wrap->getCollisionObject() : colObj0Wrap->getCollisionObject();
+			const btVector3 normal = isBody0 ? cp.m_normalWorldOnB : -cp.m_normalWorldOnB;
+
+			// Other new objects move out of the way too, old objects stay where they are
+			btScalar share = 1;
+			CPhysicsObject *pOtherObject = static_cast<CPhysicsObject *>(pOther->getUserPointer());
+			if (pOtherObject && m_batch.Find(pOtherObject) != -1) {
+				const btScalar invMass = m_pBody->getInvMass();
+				const btScalar otherInvMass = pOtherObject->GetObject()->getInvMass();
+				share = invMass + otherInvMass > 0 ? invMass / (invMass + otherInvMass) : btScalar(0.5);
+			}
+
+			// Only add what we aren't already moving in this direction (multiple points of one contact share the normal)
+			const btScalar wanted = depth * share;
+			const btScalar covered = m_correction.dot(normal);
+			if (covered < wanted)
+				m_correction += normal * (wanted - covered);
+
+			return 0;
+		}
+
+		const btVector3 &GetCorrection() const { return m_correction; }
+
+	private:
+		btDynamicsWorld *					m_pWorld;
+		btRigidBody *						m_pBody;
+		const CUtlVector<CPhysicsObject *> &m_batch;
+		btVector3							m_correction;
+};
+
+/*******************************
+* CLASS CSpawnResolver
+*******************************/
+
+CSpawnResolver::CSpawnResolver(CPhysicsEnvironment *pEnv) {
+	m_pEnv = pEnv;
+}
+
+void CSpawnResolver::ObjectCreated(CPhysicsObject *pObject) {
+	if (!cvar_spawn_depenetration.GetBool())
+		return;
+
+	m_pending.AddToTail(pObject);
+}
+
+void CSpawnResolver::ObjectRemoved(CPhysicsObject *pObject) {
+	m_pending.FindAndRemove(pObject);
+}
+
+bool CSpawnResolver::ShouldResolve(CPhysicsObject *pObject) const {
+	if (pObject->IsStatic() || !pObject->IsMotionEnabled() || !pObject->IsCollisionEnabled() || pObject->IsTrigger())
+		return false;
+
+	if (pObject->GetCallbackFlags() & CALLBACK_MARKED_FOR_DELETE)
+		return false;
+
+	return pObject->GetObject()->hasContactResponse();
+}
+
+void CSpawnResolver::PreTick() {
+	if (m_pending.Count() == 0)
+		return;
+
+	if (!cvar_spawn_depenetration.GetBool()) {
+		m_pending.RemoveAll();
+		return;
+	}
+
+	// Cap the work done in a single tick
+	const int maxObjects = cvar_spawn_depenetration_maxobjects.GetInt();
+	m_batch.RemoveAll();
+	while (m_pending.Count() > 0 && m_batch.Count() < maxObjects) {
+		CPhysicsObject *pObject = m_pending[0];
+		m_pending.Remove(0);
+
+		if (ShouldResolve(pObject))
+			m_batch.AddToTail(pObject);
+	}
+
+	btDiscreteDynamicsWorld *pWorld = m_pEnv->GetBulletEnvironment();
+	m_corrections.resize(m_batch.Count());
+
+	const int iterations = cvar_spawn_depenetration_iterations.GetInt();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		// Jacobi style: find all corrections first, then move everything
+		bool penetrating = false;
+		for (int i = 0; i < m_batch.Count(); i++) {
+			btRigidBody *pBody = m_batch[i]->GetObject();
+
+			CSpawnContactCallback callback(pWorld, pBody, m_batch);
+			pWorld->contactTest(pBody, callback);
+
+			m_corrections[i] = callback.GetCorrection();
+			penetrating |= !m_corrections[i].fuzzyZero();
+		}
+
+		if (!penetrating)
+			break;
+
+		for (int i = 0; i < m_batch.Count(); i++) {
+			if (m_corrections[i].fuzzyZero())
+				continue;
+
+			btRigidBody *pBody = m_batch[i]->GetObject();
+
+			btTransform trans = pBody->getWorldTransform();
+			trans.getOrigin() += m_corrections[i];
+
+			pBody->setWorldTransform(trans);
+			pBody->setInterpolationWorldTransform(trans);
+			if (pBody->getMotionState())
+				pBody->getMotionState()->setWorldTransform(trans);
+
+			pWorld->updateSingleAabb(pBody);
+		}
+	}
+
+	m_batch.RemoveAll();
+}
@@ -0,0 +1,33 @@
+#ifndef PHYSICS_SPAWNRESOLVER_H
+#define PHYSICS_SPAWNRESOLVER_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+class CPhysicsEnvironment;
+class CPhysicsObject;
+
+// Purpose: Pushes newly created objects out of whatever they were spawned into, before their first simulation step.
+// Without this, a burst of props spawned into the same space is pushed apart by the solver, which takes a lot
+// of iterations and launches the props with huge velocities.
+// This only moves the objects (positional projection), velocities are left alone.
+class CSpawnResolver {
+	public:
+		CSpawnResolver(CPhysicsEnvironment *pEnv);
+
+		void						ObjectCreated(CPhysicsObject *pObject);
+		void						ObjectRemoved(CPhysicsObject *pObject);
+
+		// Called before each simulation tick
+		void						PreTick();
+
+	private:
+		bool						ShouldResolve(CPhysicsObject *pObject) const;
+
+		CPhysicsEnvironment *		m_pEnv;
+		CUtlVector<CPhysicsObject *> m_pending;
+		CUtlVector<CPhysicsObject *> m_batch;
+		btAlignedObjectArray<btVector3> m_corrections;
+};
+
+#endif // PHYSICS_SPAWNRESOLVER_H
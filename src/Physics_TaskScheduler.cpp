@@ -0,0 +1,436 @@
+#include "StdAfx.h"
+
+#include <thread>
+
+#include "Physics_TaskScheduler.h"
+#include "Physics_Allocator.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Seconds we give the engine's threads to show up before we start our own ones instead
+#define SCHEDULER_START_TIMEOUT 0.5
+
+// Slot of the calling thread while it's one of our workers. A borrowed thread keeps its slot negated once it's back
+// with the provider, to get the same one again next time.
+static CThreadLocalInt<int> s_threadSlot;
+
+static ConVar cvar_scheduler_spintime("bt_scheduler_spintime", "200", FCVAR_REPLICATED, "Microseconds the physics worker threads spin waiting for more work before they go to sleep", true, 0, true, 10000);
+static ConVar cvar_scheduler_affinity("bt_scheduler_affinity", "0", FCVAR_REPLICATED, "Pin each physics worker thread to its own core (worker N runs on core N, the main thread usually owns core 0). Not applied to threads borrowed from the engine");
+
+static inline uint64 PackDeque(uint32 head, uint32 tail) {
+	return ((uint64)tail << 32) | head;
+}
+
+static inline uint32 DequeHead(uint64 deque) {
+	return (uint32)(deque & 0xFFFFFFFF);
+}
+
+static inline uint32 DequeTail(uint64 deque) {
+	return (uint32)(deque >> 32);
+}
+
+// Only for our own threads, the engine's threads are none of our business
+static void UpdateAffinity(int slot, int &applied) {
+	if (applied == cvar_scheduler_affinity.GetInt())
+		return;
+
+	applied = cvar_scheduler_affinity.GetInt();
+
+	const int numCores = clamp((int)std::thread::hardware_concurrency(), 1, 31);
+	ThreadSetAffinity(ThreadGetCurrentHandle(), applied ? 1 << (slot % numCores) : (1 << numCores) - 1);
+}
+
+/*******************************
+* CLASS CTaskScheduler
+*******************************/
+
+CTaskScheduler::CTaskScheduler() : btITaskScheduler("Physics") {
+	m_pProvider = NULL;
+	m_pWorkers = NULL;
+	m_numSlots = 1;
+	m_maxThreads = 1;
+	m_numThreads = 1;
+	m_bInJob = false;
+	m_bAcceptBorrowed = false;
+	m_pJob = NULL;
+
+	m_jobState = 0;
+	m_workersDone = 0;
+	m_workersReported = 0;
+	m_workersRunning = 0;
+	m_bQuit = false;
+	m_bSleepHint = false;
+
+	StartWorkers();
+	m_numThreads = m_maxThreads;
+}
+
+CTaskScheduler::~CTaskScheduler() {
+	StopWorkers();
+}
+
+int CTaskScheduler::getMaxNumThreads() const {
+	return m_maxThreads;
+}
+
+int CTaskScheduler::getNumThreads() const {
+	return m_numThreads;
+}
+
+void CTaskScheduler::setNumThreads(int numThreads) {
+	m_numThreads = clamp(numThreads, 1, m_maxThreads);
+}
+
+void CTaskScheduler::parallelFor(int iBegin, int iEnd, int grainSize, const btIParallelForBody &body) {
+	job_t job;
+	job.iBegin = iBegin;
+	job.iEnd = iEnd;
+	job.grainSize = max(grainSize, 1);
+	job.pForBody = &body;
+	job.pSumBody = NULL;
+
+	const int numChunks = (iEnd - iBegin + job.grainSize - 1) / job.grainSize;
+	job.numParticipants = min(m_numThreads, numChunks);
+
+	// Not worth waking anyone up (or called from inside a job)
+	if (job.numParticipants <= 1 || m_bInJob || !btIsMainThread()) {
+		if (iBegin < iEnd)
+			body.forLoop(iBegin, iEnd);
+
+		return;
+	}
+
+	RunJob(job);
+}
+
+btScalar CTaskScheduler::parallelSum(int iBegin, int iEnd, int grainSize, const btIParallelSumBody &body) {
+	job_t job;
+	job.iBegin = iBegin;
+	job.iEnd = iEnd;
+	job.grainSize = max(grainSize, 1);
+	job.pForBody = NULL;
+	job.pSumBody = &body;
+
+	const int numChunks = (iEnd - iBegin + job.grainSize - 1) / job.grainSize;
+	job.numParticipants = min(m_numThreads, numChunks);
+
+	if (job.numParticipants <= 1 || m_bInJob || !btIsMainThread())
+		return iBegin < iEnd ? body.sumLoop(iBegin, iEnd) : btScalar(0);
+
+	for (int i = 0; i < job.numParticipants; i++)
+		job.sums[i] = 0;
+
+	RunJob(job);
+
+	// Always add up in the same order
+	btScalar sum = 0;
+	for (int i = 0; i < job.numParticipants; i++)
+		sum += job.sums[i];
+
+	return sum;
+}
+
+void CTaskScheduler::sleepWorkerThreadsHint() {
+	// Nothing more to do for a while, don't burn the cores the engine needs
+	m_bSleepHint = true;
+}
+
+void CTaskScheduler::SetThreadProvider(IPhysicsThreadProvider *pProvider) {
+	Assert(btIsMainThread() && !m_bInJob);
+	if (pProvider == m_pProvider)
+		return;
+
+	const int numThreads = m_numThreads;
+
+	StopWorkers();
+	m_pProvider = pProvider;
+	StartWorkers();
+
+	m_numThreads = clamp(numThreads, 1, m_maxThreads);
+}
+
+unsigned CTaskScheduler::WorkerThreadFunc(void *pContext) {
+	static_cast<CTaskScheduler *>(pContext)->WorkerLoop(true);
+	return 0;
+}
+
+void CTaskScheduler::ProviderWorkerFunc(void *pContext) {
+	static_cast<CTaskScheduler *>(pContext)->WorkerLoop(false);
+}
+
+void CTaskScheduler::WorkerLoop(bool ownThread) {
+	m_startMutex.Lock();
+	if (!ownThread && !m_bAcceptBorrowed) {
+		// The provider got to us after we gave up on it
+		m_startMutex.Unlock();
+		return;
+	}
+
+	// A borrowed thread gets its old slot back if it's still free, anyone else the first free one
+	int slot = -s_threadSlot;
+	if (slot <= 0 || slot >= m_numSlots || m_pWorkers[slot].started) {
+		slot = 1;
+		while (slot < m_numSlots && m_pWorkers[slot].started)
+			slot++;
+	}
+
+	const bool valid = slot < m_numSlots;
+	if (valid) {
+		m_pWorkers[slot].started = true;
+		s_threadSlot = slot;
+	}
+
+	m_workersRunning++;
+	m_workersReported++;
+	m_startMutex.Unlock();
+
+	uint64 lastState = m_jobState;
+
+	if (!valid) {
+		// More workers than slots, can't happen unless StartWorkers miscounted
+		DevWarning("Physics task scheduler: no free slot for a worker thread\n");
+		m_workersRunning--;
+		return;
+	}
+
+	worker_t &worker = m_pWorkers[slot];
+	int affinity = 0;
+	int spins = 0;
+	double spinStart = Plat_FloatTime();
+
+	while (!m_bQuit) {
+		if (ownThread)
+			UpdateAffinity(slot, affinity);
+
+		const uint64 state = m_jobState;
+		if (state != lastState) {
+			lastState = state;
+			if (slot < (int)(state & 0xFF)) {
+				Work(*m_pJob, slot);
+				m_workersDone++;
+			}
+
+			spins = 0;
+			spinStart = Plat_FloatTime();
+			continue;
+		}
+
+		// Spin for a bit, jobs usually come in bursts
+		if (!m_bSleepHint) {
+			ThreadPause();
+			if ((++spins & 63) != 0 || Plat_FloatTime() - spinStart < cvar_scheduler_spintime.GetFloat() * 1e-6)
+				continue;
+		}
+
+		// Then sleep. Recheck the state after announcing it so we can't miss a wake up.
+		worker.sleeping = true;
+		if (m_jobState != lastState || m_bQuit) {
+			worker.sleeping = false;
+			continue;
+		}
+
+		worker.wakeEvent.Wait();
+		worker.sleeping = false;
+
+		spins = 0;
+		spinStart = Plat_FloatTime();
+	}
+
+	// Our thread exits (or goes back to the provider), its cached blocks would be lost to the pools
+	ReleaseAllocatorThreadCache();
+	s_threadSlot = -slot;
+	m_workersRunning--;
+}
+
+void CTaskScheduler::StartWorkers() {
+	int numWorkers;
+	if (m_pProvider)
+		numWorkers = m_pProvider->GetThreadCount();
+	else
+		numWorkers = (int)std::thread::hardware_concurrency() - 1;
+
+	numWorkers = clamp(numWorkers, 0, BT_MAX_THREAD_COUNT - 1);
+
+	m_numSlots = numWorkers + 1;
+	m_pWorkers = new worker_t[m_numSlots];
+	for (int i = 0; i < m_numSlots; i++) {
+		m_pWorkers[i].deque = 0;
+		m_pWorkers[i].sleeping = false;
+		m_pWorkers[i].started = i == 0;
+	}
+
+	m_bQuit = false;
+	m_workersReported = 0;
+
+	int numOwnThreads = numWorkers;
+	if (m_pProvider) {
+		m_bAcceptBorrowed = true;
+		for (int i = 0; i < numWorkers; i++)
+			m_pProvider->RunOnThread(ProviderWorkerFunc, this);
+
+		// The provider may queue the work rather than start it right away, don't wait on it forever
+		const double timeout = Plat_FloatTime() + SCHEDULER_START_TIMEOUT;
+		while (m_workersReported < numWorkers && Plat_FloatTime() < timeout)
+			ThreadSleep(0);
+
+		m_startMutex.Lock();
+		m_bAcceptBorrowed = false;
+		numOwnThreads = numWorkers - m_workersReported;
+		m_startMutex.Unlock();
+
+		if (numOwnThreads > 0)
+			DevWarning("Physics task scheduler: %d of the engine's threads didn't start, using our own instead\n", numOwnThreads);
+	}
+
+	for (int i = 0; i < numOwnThreads; i++)
+		m_threads.AddToTail(CreateSimpleThread(WorkerThreadFunc, this));
+
+	// Wait for everyone to find their slot, a job can't count on a slot without a worker
+	while (m_workersReported < numWorkers)
+		ThreadSleep(0);
+
+	m_maxThreads = 1;
+	while (m_maxThreads < m_numSlots && m_pWorkers[m_maxThreads].started)
+		m_maxThreads++;
+}
+
+void CTaskScheduler::StopWorkers() {
+	if (!m_pWorkers)
+		return;
+
+	m_bQuit = true;
+	for (int i = 1; i < m_numSlots; i++)
+		m_pWorkers[i].wakeEvent.Set();
+
+	for (int i = 0; i < m_threads.Count(); i++) {
+		ThreadJoin(m_threads[i]);
+		ReleaseThreadHandle(m_threads[i]);
+	}
+
+	m_threads.RemoveAll();
+
+	// Borrowed threads go back to the provider once they're out of the loop
+	while (m_workersRunning > 0)
+		ThreadSleep(0);
+
+	delete [] m_pWorkers;
+	m_pWorkers = NULL;
+	m_numSlots = 1;
+	m_maxThreads = 1;
+}
+
+void CTaskScheduler::RunJob(job_t &job) {
+	m_bInJob = true;
+	m_bSleepHint = false;
+
+	// Spread the chunks evenly over the participants
+	const int numChunks = (job.iEnd - job.iBegin + job.grainSize - 1) / job.grainSize;
+	const int chunksPerThread = numChunks / job.numParticipants;
+	const int remainder = numChunks % job.numParticipants;
+
+	uint32 head = 0;
+	for (int i = 0; i < job.numParticipants; i++) {
+		const uint32 tail = head + chunksPerThread + (i < remainder ? 1 : 0);
+		m_pWorkers[i].deque = PackDeque(head, tail);
+		head = tail;
+	}
+
+	m_pJob = &job;
+	m_workersDone = 0;
+
+	// Publish it
+	m_jobState = ((m_jobState >> 8) + 1) << 8 | (uint64)job.numParticipants;
+	for (int i = 1; i < job.numParticipants; i++) {
+		if (m_pWorkers[i].sleeping.exchange(false))
+			m_pWorkers[i].wakeEvent.Set();
+	}
+
+	Work(job, 0);
+
+	// The job lives on our stack, wait for everyone to let go of it
+	while (m_workersDone < job.numParticipants - 1)
+		ThreadPause();
+
+	m_pJob = NULL;
+	m_bInJob = false;
+}
+
+void CTaskScheduler::Work(job_t &job, int slot) {
+	int chunk;
+	while (PopChunk(slot, chunk))
+		RunChunk(job, slot, chunk);
+
+	while (StealChunk(job, slot, chunk))
+		RunChunk(job, slot, chunk);
+}
+
+bool CTaskScheduler::PopChunk(int slot, int &chunk) {
+	std::atomic<uint64> &deque = m_pWorkers[slot].deque;
+
+	uint64 value = deque;
+	while (DequeHead(value) < DequeTail(value)) {
+		if (deque.compare_exchange_weak(value, PackDeque(DequeHead(value) + 1, DequeTail(value)))) {
+			chunk = DequeHead(value);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool CTaskScheduler::StealChunk(const job_t &job, int slot, int &chunk) {
+	// Chunks are never added during a job, so once every deque is empty we're done
+	const int numParticipants = job.numParticipants;
+	for (int i = 1; i < numParticipants; i++) {
+		std::atomic<uint64> &deque = m_pWorkers[(slot + i) % numParticipants].deque;
+
+		uint64 value = deque;
+		while (DequeHead(value) < DequeTail(value)) {
+			if (deque.compare_exchange_weak(value, PackDeque(DequeHead(value), DequeTail(value) - 1))) {
+				chunk = DequeTail(value) - 1;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void CTaskScheduler::RunChunk(job_t &job, int slot, int chunk) {
+	const int begin = job.iBegin + chunk * job.grainSize;
+	const int end = min(begin + job.grainSize, job.iEnd);
+
+	if (job.pForBody)
+		job.pForBody->forLoop(begin, end);
+	else
+		job.sums[slot] += job.pSumBody->sumLoop(begin, end);
+}
+
+/*******************************
+* GLOBALS
+*******************************/
+
+int GetPhysicsThreadSlot() {
+	return max((int)s_threadSlot, 0);
+}
+
+static CTaskScheduler *s_pTaskScheduler = NULL;
+
+CTaskScheduler *GetPhysicsTaskScheduler() {
+	if (!s_pTaskScheduler)
+		s_pTaskScheduler = new CTaskScheduler;
+
+	return s_pTaskScheduler;
+}
+
+void ShutdownPhysicsTaskScheduler() {
+	if (!s_pTaskScheduler)
+		return;
+
+	if (btGetTaskScheduler() == s_pTaskScheduler)
+		btSetTaskScheduler(btGetSequentialTaskScheduler());
+
+	delete s_pTaskScheduler;
+	s_pTaskScheduler = NULL;
+}
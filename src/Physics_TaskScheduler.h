@@ -0,0 +1,93 @@
+#ifndef PHYSICS_TASKSCHEDULER_H
+#define PHYSICS_TASKSCHEDULER_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+#include <atomic>
+#include <tier0/threadtools.h>
+#include <LinearMath/btThreads.h>
+
+class IPhysicsThreadProvider;
+
+// Purpose: Work stealing task scheduler for Bullet.
+// A parallel for is cut into chunks of grainSize, each participating thread gets a contiguous range of chunks
+// (a deque) and takes chunks from the front of its own range, and steals from the back of the others once it runs dry.
+// Workers spin for a while after a job so back to back loops don't pay the wake up latency, then sleep.
+// Workers are either our own threads, or borrowed from the engine with an IPhysicsThreadProvider. Provider threads
+// that don't start in time are replaced by our own.
+class CTaskScheduler : public btITaskScheduler {
+	public:
+		CTaskScheduler();
+		~CTaskScheduler();
+
+		int						getMaxNumThreads() const override;
+		int						getNumThreads() const override;
+		void					setNumThreads(int numThreads) override;
+		void					parallelFor(int iBegin, int iEnd, int grainSize, const btIParallelForBody &body) override;
+		btScalar				parallelSum(int iBegin, int iEnd, int grainSize, const btIParallelSumBody &body) override;
+		void					sleepWorkerThreadsHint() override;
+
+		// Stops the current workers and starts new ones (on the provider's threads, or our own if NULL)
+		// Must be called from the main thread, while nothing is being simulated.
+		void					SetThreadProvider(IPhysicsThreadProvider *pProvider);
+
+	private:
+		struct job_t {
+			int							iBegin;
+			int							iEnd;
+			int							grainSize;
+			int							numParticipants;
+			const btIParallelForBody *	pForBody;
+			const btIParallelSumBody *	pSumBody;
+			btScalar					sums[BT_MAX_THREAD_COUNT];
+		};
+
+		// Indexed by slot. Padded to a cache line so the deques don't false share.
+		struct worker_t {
+			std::atomic<uint64>		deque;		// head (low 32 bits) and tail (high 32 bits) chunk index
+			std::atomic<bool>		sleeping;
+			CThreadEvent			wakeEvent;
+			bool					started;
+			char					pad[64];
+		};
+
+		static unsigned			WorkerThreadFunc(void *pContext);
+		static void				ProviderWorkerFunc(void *pContext);
+		void					WorkerLoop(bool ownThread);
+
+		void					StartWorkers();
+		void					StopWorkers();
+		void					RunJob(job_t &job);
+		void					Work(job_t &job, int slot);
+		bool					PopChunk(int slot, int &chunk);
+		bool					StealChunk(const job_t &job, int slot, int &chunk);
+		void					RunChunk(job_t &job, int slot, int chunk);
+
+		IPhysicsThreadProvider *m_pProvider;
+		worker_t *				m_pWorkers;		// Slot 0 is the main thread
+		int						m_numSlots;		// Main thread + launched workers
+		int						m_maxThreads;	// Main thread + workers that got a usable slot
+		int						m_numThreads;	// Threads participating in jobs (setNumThreads)
+		bool					m_bInJob;
+		bool					m_bAcceptBorrowed;	// Still waiting for the provider's threads (m_startMutex)
+		CUtlVector<ThreadHandle_t> m_threads;	// Our own threads (with a provider, the ones standing in for its late threads)
+
+		std::atomic<uint64>		m_jobState;		// Generation (high bits) and number of participants (low 8 bits)
+		job_t * volatile		m_pJob;
+		std::atomic<int>		m_workersDone;		// Participants done with the current job
+		std::atomic<int>		m_workersReported;	// Workers that looked for their slot
+		std::atomic<int>		m_workersRunning;
+		std::atomic<bool>		m_bQuit;
+		std::atomic<bool>		m_bSleepHint;
+		CThreadFastMutex		m_startMutex;
+};
+
+CTaskScheduler *		GetPhysicsTaskScheduler();
+void					ShutdownPhysicsTaskScheduler();
+
+// Slot of the calling thread in the task scheduler: 1 to getMaxNumThreads() - 1 on a worker, 0 on any other thread.
+// Use this for per thread data, not Bullet's thread index: the engine's threads keep that one for good.
+int						GetPhysicsThreadSlot();
+
+#endif // PHYSICS_TASKSCHEDULER_H
@@ -1,10 +1,12 @@
 #ifndef PHYSICS_VEHICLEAIRBOAT_H
 #define PHYSICS_VEHICLEAIRBOAT_H
 
+#include "Physics_ParallelActions.h"
+
 class CPhysicsObject;
 class IPhysicsGameTrace;
 
-class CAirboatVehicle : public btActionInterface {
+class CAirboatVehicle : public btActionInterface, public IParallelAction {
 	public:
 		CAirboatVehicle(CPhysicsObject *pBody, IPhysicsGameTrace *pGameTrace);
 		~CAirboatVehicle();
@@ -12,6 +14,9 @@ class CAirboatVehicle : public btActionInterface {
 		virtual void updateAction(btCollisionWorld *pWorld, btScalar dt);
 		virtual void debugDraw(btIDebugDraw *pDebugDrawer);
 
+		// Only moves its own body
+		bool IsParallelSafe() const { return true; }
+
 	private:
 		CPhysicsObject *m_pBody;
 		IPhysicsGameTrace *m_pGameTrace;
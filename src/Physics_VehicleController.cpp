@@ -5,6 +5,7 @@
 #include "Physics_Object.h"
 #include "Physics_VehicleController.h"
 #include "Physics_Environment.h"
+#include "Physics_ParallelActions.h"
 #include "convert.h"
 
 #include "BulletCollision/NarrowPhaseCollision/btRaycastCallback.h"
@@ -96,73 +97,708 @@ struct CIgnoreObjectRayResultCallback : public btCollisionWorld::ClosestRayResul
 	const btRigidBody *m_pIgnoreObject;
 };
 
-// Purpose: This raycaster will cast a ray ignoring the vehicle's body.
-class CCarRaycaster : public btVehicleRaycaster {
+static ConVar cvar_vehicle_batchraycasts("bt_vehicle_batchraycasts", "1", FCVAR_REPLICATED, "Cast the wheel rays of all vehicles as one parallel batch before the vehicles update");
+static ConVar cvar_vehicle_wheelprobe("bt_vehicle_wheelprobe", "0", FCVAR_REPLICATED, "Shape vehicle wheels probe the ground with. 0 = ray, 1 = sphere, 2 = cylinder (the convex probes don't slip through cracks)", true, 0, true, 2);
+
+#define VEHICLE_RAY_GRAIN_SIZE	4	// Wheel rays per task, each one is a full world query
+#define VEHICLE_RAY_MAX_HITS	4	// Hits in front of the candidate kept for the game's collision filter
+
+enum wheelprobe_t {
+	WHEEL_PROBE_RAY = 0,
+	WHEEL_PROBE_SPHERE,
+	WHEEL_PROBE_CYLINDER,
+};
+
+#define WHEEL_CYLINDER_HALF_WIDTH	0.5f	// Of the wheel radius, the vehicle scripts don't have a wheel width
+#define WHEEL_CONTACT_MAX_AGE		4		// Steps a convex probe's contact is kept for without being hit again
+
+class CVehicleRaycaster;
+
+// Purpose: Last contact of a convex wheel probe, in the space of the object it's on.
+// Works like a one point persistent manifold: when the probe slips through a crack or misses an edge
+// for a step, the wheel keeps the contact for as long as it's still under the wheel.
+struct wheelcontact_t {
+	const btRigidBody *			pObject;
+	btVector3					localPoint;
+	btVector3					localNormal;
+	int							age;		// Steps since the probe last hit
+};
+
+// Purpose: A wheel ray of the batch cast (or a sweep, with a convex probe)
+struct wheelray_t {
+	CVehicleRaycaster *			pRaycaster;
+	btVector3					from;
+	btVector3					to;
+
+	// Convex probe, NULL for a ray. The sweep starts one radius behind the hard point so a compressed wheel
+	// still finds the ground it sits in, the hit fraction is then the same as a ray's.
+	btConvexShape *				pShape;
+	int							shapeType;
+	btTransform					sweepFrom;
+	btTransform					sweepTo;
+	wheelcontact_t				contact;
+
+	// Object the wheel hit last time, cast on its own first so the world query can skip everything behind it.
+	// It's put through the whole filter before the cast.
+	const btCollisionObject *	pCandidate;
+	btScalar					candidateFraction;	// 1 if the candidate wasn't hit
+	btVector3					candidateNormal;
+	btVector3					candidatePoint;
+
+	// Hits in front of the candidate, closest first. These still have to go through the game's collision filter.
+	struct hit_t {
+		const btCollisionObject *	pObject;
+		btScalar					fraction;
+		btVector3					normal;
+		btVector3					point;
+	};
+	hit_t						hits[VEHICLE_RAY_MAX_HITS];
+	int							numHits;
+	bool						overflow;	// More hits than fit in hits
+
+	// Result handed out by castRay
+	const btRigidBody *			pHit;
+	btVehicleRaycaster::btVehicleRaycasterResult result;
+	bool						valid;		// Cast this step and not handed out yet
+};
+
+// Default filter group and mask of btCollisionWorld::RayResultCallback
+static inline bool DefaultRayFilter(const btBroadphaseProxy *proxy0) {
+	return (proxy0->m_collisionFilterGroup & btBroadphaseProxy::AllFilter) && (btBroadphaseProxy::DefaultFilter & proxy0->m_collisionFilterMask);
+}
+
+// Records a hit of a batch cast, returns the new closest hit fraction of the callback
+static btScalar AddWheelHit(wheelray_t &ray, bool candidate, const btCollisionObject *pObject, btScalar fraction, const btVector3 &normal, const btVector3 &point, btScalar closestHitFraction) {
+	if (candidate) {
+		ray.candidateFraction = fraction;
+		ray.candidateNormal = normal;
+		ray.candidatePoint = point;
+		return fraction;
+	}
+
+	// Objects with several hits (triangle meshes) only keep their closest one
+	int slot = 0;
+	while (slot < ray.numHits && ray.hits[slot].pObject != pObject)
+		slot++;
+
+	if (slot < ray.numHits) {
+		if (fraction >= ray.hits[slot].fraction)
+			return closestHitFraction;
+	} else if (ray.numHits < VEHICLE_RAY_MAX_HITS) {
+		ray.numHits++;
+	} else {
+		// Full, drop the farthest one
+		ray.overflow = true;
+		slot = VEHICLE_RAY_MAX_HITS - 1;
+		if (fraction >= ray.hits[slot].fraction)
+			return closestHitFraction;
+	}
+
+	while (slot > 0 && ray.hits[slot - 1].fraction > fraction) {
+		ray.hits[slot] = ray.hits[slot - 1];
+		slot--;
+	}
+
+	ray.hits[slot].pObject = pObject;
+	ray.hits[slot].fraction = fraction;
+	ray.hits[slot].normal = normal;
+	ray.hits[slot].point = point;
+
+	// Nothing behind the farthest hit we keep matters anymore
+	if (ray.numHits == VEHICLE_RAY_MAX_HITS)
+		return ray.hits[VEHICLE_RAY_MAX_HITS - 1].fraction;
+
+	return closestHitFraction;
+}
+
+// Purpose: Base of the wheel raycasters. Rays the environment's CVehicleRaycastBatch already cast this step are
+// handed out from the batch, anything else is cast right away.
+class CVehicleRaycaster : public btVehicleRaycaster {
 	public:
-		CCarRaycaster(btDynamicsWorld *pWorld, CPhysicsVehicleController *pController) {
+		CVehicleRaycaster(btDynamicsWorld *pWorld, btRigidBody *pBody) {
 			m_pWorld = pWorld;
-			m_pController = pController;
+			m_pBody = pBody;
+			m_pVehicle = NULL;
+			m_rayFlags = 0;
+			m_bParallelUpdate = false;
+		}
+
+		~CVehicleRaycaster() {
+			for (int i = 0; i < m_rays.size(); i++)
+				delete m_rays[i].pShape;
 		}
 
 		void *castRay(btWheelInfo *wheel, const btVector3 &from, const btVector3 &to, btVehicleRaycasterResult &result) {
-			CIgnoreObjectRayResultCallback rayCallback(m_pController->GetBody()->GetObject(), from, to);
-			rayCallback.m_flags |= btTriangleRaycastCallback::kF_UseSubSimplexConvexCastRaytest; // GJK has an issue of going through triangles
+			UpdateWheelCount();
+
+			const int index = m_pVehicle ? (int)(wheel - &m_pVehicle->getWheelInfo(0)) : -1;
+			if (index < 0 || index >= m_rays.size()) {
+				Assert(!m_bParallelUpdate);
+				return m_bParallelUpdate ? NULL : (void *)CastRayDirect(from, to, result);
+			}
+
+			wheelray_t &ray = m_rays[index];
+			const btRigidBody *pHit;
+			if (m_bParallelUpdate) {
+				// Possibly off the main thread, so no direct casts: they run the game's filter. The batch cast the
+				// same rays this step (CanUpdateInParallel), a different ray is a bug.
+				Assert(ray.valid && ray.from == from && ray.to == to);
+				pHit = ray.pHit;
+				if (pHit)
+					result = ray.result;
+			} else if (ray.valid && ray.from == from && ray.to == to) {
+				pHit = ray.pHit;
+				if (pHit)
+					result = ray.result;
+			} else {
+				ray.from = from;
+				ray.to = to;
+				UpdateProbe(ray, *wheel);
+				pHit = ray.pShape ? SweepDirect(ray, result) : CastRayDirect(from, to, result);
+			}
+
+			if (ray.pShape)
+				pHit = UpdateContact(ray, *wheel, pHit, result);
+
+			ray.valid = false;
+			ray.pCandidate = pHit;
+			return (void *)pHit;
+		}
+
+		// UNEXPOSED
+		void SetVehicle(btRaycastVehicle *pVehicle) {
+			m_pVehicle = pVehicle;
+		}
+
+		// UNEXPOSED
+		// Set while the vehicle is updated with the other parallel actions, castRay then only uses the batch's results
+		void SetParallelUpdate(bool parallel) {
+			m_bParallelUpdate = parallel;
+		}
+
+		// UNEXPOSED
+		void ObjectRemoved(const btCollisionObject *pObject) {
+			for (int i = 0; i < m_rays.size(); i++) {
+				if (m_rays[i].pCandidate == pObject)
+					m_rays[i].pCandidate = NULL;
+
+				if (m_rays[i].contact.pObject == pObject)
+					m_rays[i].contact.pObject = NULL;
+			}
+		}
+
+		// UNEXPOSED
+		// True if this step's batch cast every wheel ray and nothing a wheel stands on can move. The vehicle's update
+		// then only touches the vehicle: btRaycastVehicle pushes on the ground objects, but not on static ones.
+		bool CanUpdateInParallel() const {
+			if (!m_pVehicle || m_rays.size() != m_pVehicle->getNumWheels())
+				return false;
+
+			for (int i = 0; i < m_rays.size(); i++) {
+				const wheelray_t &ray = m_rays[i];
+				if (!ray.valid)
+					return false;
+
+				// The cached contact of a convex probe stands in for a miss
+				const btRigidBody *pGround = ray.pHit ? ray.pHit : (ray.pShape ? ray.contact.pObject : NULL);
+				if (pGround && pGround->getInvMass() != 0)
+					return false;
+			}
+
+			return true;
+		}
+
+		// UNEXPOSED
+		void						GatherRays(CUtlVector<wheelray_t *> &rays);
+		void						CastBatchRay(const btCollisionWorld *pWorld, wheelray_t &ray) const;
+		void						ResolveRay(wheelray_t &ray);
+
+		// Thread safe part of the ray filter
+		virtual bool				NeedsCollisionFast(const btBroadphaseProxy *proxy0) const = 0;
+
+		// Rest of the ray filter, may call into the game (main thread only)
+		virtual bool				NeedsCollisionGame(const btCollisionObject *pObject) const { return true; }
+
+	protected:
+		// Casts a single ray on the calling thread
+		virtual const btRigidBody *	CastRayDirect(const btVector3 &from, const btVector3 &to, btVehicleRaycasterResult &result) const = 0;
+
+		// Body the wheel stands on when the ray hits the object, NULL if the hit doesn't count
+		virtual const btRigidBody *	AcceptHit(const btCollisionObject *pObject) const = 0;
+
+		const btRigidBody *			SweepDirect(const wheelray_t &ray, btVehicleRaycasterResult &result) const;
+		void						UpdateWheelCount();
+		void						UpdateProbe(wheelray_t &ray, const btWheelInfo &wheel);
+		const btRigidBody *			UpdateContact(wheelray_t &ray, const btWheelInfo &wheel, const btRigidBody *pHit, btVehicleRaycasterResult &result);
+
+		btDynamicsWorld *			m_pWorld;
+		btRigidBody *				m_pBody;
+		btRaycastVehicle *			m_pVehicle;
+		unsigned int				m_rayFlags;
+		bool						m_bParallelUpdate;
+		btAlignedObjectArray<wheelray_t> m_rays;	// Per wheel
+};
+
+// Purpose: Collects the hits of a batch wheel ray. Runs on the worker threads, so only the thread safe part
+// of the filter is applied here.
+struct CWheelRayCollector : public btCollisionWorld::RayResultCallback {
+	CWheelRayCollector(const CVehicleRaycaster *pRaycaster, wheelray_t &ray) : m_ray(ray) {
+		m_pRaycaster = pRaycaster;
+		m_bCandidate = false;
+	}
+
+	bool needsCollision(btBroadphaseProxy *proxy0) const {
+		// Already cast
+		if (proxy0->m_clientObject == m_ray.pCandidate)
+			return false;
+
+		return m_pRaycaster->NeedsCollisionFast(proxy0);
+	}
+
+	btScalar addSingleResult(btCollisionWorld::LocalRayResult &rayResult, bool normalInWorldSpace) {
+		const btCollisionObject *pObject = rayResult.m_collisionObject;
+		const btVector3 normal = normalInWorldSpace ? rayResult.m_hitNormalLocal : pObject->getWorldTransform().getBasis() * rayResult.m_hitNormalLocal;
+		btVector3 point;
+		point.setInterpolate3(m_ray.from, m_ray.to, rayResult.m_hitFraction);
+
+		m_closestHitFraction = AddWheelHit(m_ray, m_bCandidate, pObject, rayResult.m_hitFraction, normal, point, m_closestHitFraction);
+		return m_closestHitFraction;
+	}
+
+	const CVehicleRaycaster *	m_pRaycaster;
+	wheelray_t &				m_ray;
+	bool						m_bCandidate;	// Casting the candidate
+};
+
+// Purpose: Same as CWheelRayCollector, for the sweep of a convex probe
+struct CWheelSweepCollector : public btCollisionWorld::ConvexResultCallback {
+	CWheelSweepCollector(const CVehicleRaycaster *pRaycaster, wheelray_t &ray) : m_ray(ray) {
+		m_pRaycaster = pRaycaster;
+		m_bCandidate = false;
+	}
+
+	bool needsCollision(btBroadphaseProxy *proxy0) const {
+		if (proxy0->m_clientObject == m_ray.pCandidate)
+			return false;
+
+		return m_pRaycaster->NeedsCollisionFast(proxy0);
+	}
+
+	btScalar addSingleResult(btCollisionWorld::LocalConvexResult &convexResult, bool normalInWorldSpace) {
+		const btCollisionObject *pObject = convexResult.m_hitCollisionObject;
+		const btVector3 normal = normalInWorldSpace ? convexResult.m_hitNormalLocal : pObject->getWorldTransform().getBasis() * convexResult.m_hitNormalLocal;
+
+		// m_hitPointLocal is in world space
+		m_closestHitFraction = AddWheelHit(m_ray, m_bCandidate, pObject, convexResult.m_hitFraction, normal, convexResult.m_hitPointLocal, m_closestHitFraction);
+		return m_closestHitFraction;
+	}
+
+	const CVehicleRaycaster *	m_pRaycaster;
+	wheelray_t &				m_ray;
+	bool						m_bCandidate;
+};
+
+// Purpose: Closest hit of a convex probe that passes the whole ray filter (main thread only)
+struct CWheelSweepCallback : public btCollisionWorld::ClosestConvexResultCallback {
+	CWheelSweepCallback(const CVehicleRaycaster *pRaycaster, const btVector3 &from, const btVector3 &to)
+	: ClosestConvexResultCallback(from, to) {
+		m_pRaycaster = pRaycaster;
+	}
+
+	bool needsCollision(btBroadphaseProxy *proxy0) const {
+		return m_pRaycaster->NeedsCollisionFast(proxy0) && m_pRaycaster->NeedsCollisionGame((const btCollisionObject *)proxy0->m_clientObject);
+	}
+
+	const CVehicleRaycaster *	m_pRaycaster;
+};
+
+void CVehicleRaycaster::UpdateWheelCount() {
+	if (!m_pVehicle || m_rays.size() == m_pVehicle->getNumWheels())
+		return;
+
+	const int oldCount = m_rays.size();
+	for (int i = m_pVehicle->getNumWheels(); i < oldCount; i++)
+		delete m_rays[i].pShape;
+
+	m_rays.resize(m_pVehicle->getNumWheels());
+	for (int i = oldCount; i < m_rays.size(); i++) {
+		m_rays[i].pShape = NULL;
+		m_rays[i].shapeType = WHEEL_PROBE_RAY;
+		m_rays[i].contact.pObject = NULL;
+		m_rays[i].pCandidate = NULL;
+		m_rays[i].valid = false;
+	}
+}
+
+// Sets up the convex probe of the wheel (if any) for the ray in from/to
+void CVehicleRaycaster::UpdateProbe(wheelray_t &ray, const btWheelInfo &wheel) {
+	const int shapeType = cvar_vehicle_wheelprobe.GetInt();
+	if (shapeType != ray.shapeType) {
+		delete ray.pShape;
+		ray.pShape = NULL;
+		ray.shapeType = shapeType;
+		ray.contact.pObject = NULL;
+
+		const btScalar radius = wheel.m_wheelsRadius;
+		if (shapeType == WHEEL_PROBE_SPHERE)
+			ray.pShape = new btSphereShape(radius);
+		else if (shapeType == WHEEL_PROBE_CYLINDER)
+			ray.pShape = new btCylinderShapeX(btVector3(radius * WHEEL_CYLINDER_HALF_WIDTH, radius, radius));	// Local x is the axle
+	}
+
+	if (!ray.pShape)
+		return;
+
+	const btVector3 back = wheel.m_raycastInfo.m_wheelDirectionWS * wheel.m_wheelsRadius;
+	ray.sweepFrom.setBasis(wheel.m_worldTransform.getBasis());
+	ray.sweepFrom.setOrigin(ray.from - back);
+	ray.sweepTo.setBasis(wheel.m_worldTransform.getBasis());
+	ray.sweepTo.setOrigin(ray.to - back);
+}
+
+// Sweeps the convex probe on the calling thread
+const btRigidBody *CVehicleRaycaster::SweepDirect(const wheelray_t &ray, btVehicleRaycasterResult &result) const {
+	CWheelSweepCallback sweepCallback(this, ray.sweepFrom.getOrigin(), ray.sweepTo.getOrigin());
+
+	m_pWorld->convexSweepTest(ray.pShape, ray.sweepFrom, ray.sweepTo, sweepCallback);
+
+	if (sweepCallback.hasHit()) {
+		const btRigidBody *body = AcceptHit(sweepCallback.m_hitCollisionObject);
+		if (body) {
+			result.m_hitPointInWorld = sweepCallback.m_hitPointWorld;
+			result.m_hitNormalInWorld = sweepCallback.m_hitNormalWorld;
+			result.m_hitNormalInWorld.normalize();
+			result.m_distFraction = sweepCallback.m_closestHitFraction;
+			return body;
+		}
+	}
+
+	return NULL;
+}
+
+// Refreshes the wheel's cached contact with the probe's hit, or falls back to it on a miss
+const btRigidBody *CVehicleRaycaster::UpdateContact(wheelray_t &ray, const btWheelInfo &wheel, const btRigidBody *pHit, btVehicleRaycasterResult &result) {
+	wheelcontact_t &contact = ray.contact;
+	if (pHit) {
+		const btTransform &transform = pHit->getWorldTransform();
+		contact.pObject = pHit;
+		contact.localPoint = transform.invXform(result.m_hitPointInWorld);
+		contact.localNormal = result.m_hitNormalInWorld * transform.getBasis();
+		contact.age = 0;
+		return pHit;
+	}
+
+	if (!contact.pObject || ++contact.age > WHEEL_CONTACT_MAX_AGE) {
+		contact.pObject = NULL;
+		return NULL;
+	}
+
+	// Only while it's still under the wheel and in reach of the suspension
+	const btTransform &transform = contact.pObject->getWorldTransform();
+	const btVector3 point = transform * contact.localPoint;
+	const btVector3 &dir = wheel.m_raycastInfo.m_wheelDirectionWS;
+	const btScalar rayLength = ray.from.distance(ray.to);
+	const btVector3 offset = point - ray.from;
+	const btScalar dist = offset.dot(dir);
+	if (dist < 0 || dist > rayLength || (offset - dir * dist).length2() > wheel.m_wheelsRadius * wheel.m_wheelsRadius) {
+		contact.pObject = NULL;
+		return NULL;
+	}
+
+	result.m_hitPointInWorld = point;
+	result.m_hitNormalInWorld = transform.getBasis() * contact.localNormal;
+	result.m_distFraction = dist / rayLength;
+	return contact.pObject;
+}
+
+// Main thread: computes this step's wheel rays the same way btRaycastVehicle::rayCast will
+void CVehicleRaycaster::GatherRays(CUtlVector<wheelray_t *> &rays) {
+	if (!m_pVehicle) return;
+
+	UpdateWheelCount();
+
+	for (int i = 0; i < m_rays.size(); i++) {
+		// Also updates the wheel's orientation, a cylinder probe needs it
+		m_pVehicle->updateWheelTransform(i, false);
+		const btWheelInfo &wheel = m_pVehicle->getWheelInfo(i);
+
+		wheelray_t &ray = m_rays[i];
+		ray.pRaycaster = this;
+		ray.from = wheel.m_raycastInfo.m_hardPointWS;
+		ray.to = ray.from + wheel.m_raycastInfo.m_wheelDirectionWS * (wheel.getSuspensionRestLength() + wheel.m_wheelsRadius);
+		ray.candidateFraction = 1;
+		ray.numHits = 0;
+		ray.overflow = false;
+		ray.pHit = NULL;
+		ray.valid = false;
+		UpdateProbe(ray, wheel);
+
+		// The workers can't run the game's filter, so the candidate goes through it here
+		if (ray.pCandidate) {
+			const btBroadphaseProxy *pProxy = ray.pCandidate->getBroadphaseHandle();
+			if (!pProxy || !NeedsCollisionFast(pProxy) || !NeedsCollisionGame(ray.pCandidate))
+				ray.pCandidate = NULL;
+		}
+
+		rays.AddToTail(&ray);
+	}
+}
+
+// Any thread: casts the candidate, then the world in front of the candidate's hit
+void CVehicleRaycaster::CastBatchRay(const btCollisionWorld *pWorld, wheelray_t &ray) const {
+	if (ray.pShape) {
+		CWheelSweepCollector collector(this, ray);
+
+		if (ray.pCandidate) {
+			collector.m_bCandidate = true;
+			btCollisionWorld::objectQuerySingle(ray.pShape, ray.sweepFrom, ray.sweepTo, const_cast<btCollisionObject *>(ray.pCandidate), ray.pCandidate->getCollisionShape(), ray.pCandidate->getWorldTransform(), collector, 0);
+			collector.m_bCandidate = false;
+		}
+
+		pWorld->convexSweepTest(ray.pShape, ray.sweepFrom, ray.sweepTo, collector);
+		return;
+	}
+
+	CWheelRayCollector collector(this, ray);
+	collector.m_flags = m_rayFlags;
+
+	if (ray.pCandidate) {
+		const btTransform rayFrom(btMatrix3x3::getIdentity(), ray.from);
+		const btTransform rayTo(btMatrix3x3::getIdentity(), ray.to);
+
+		collector.m_bCandidate = true;
+		btCollisionWorld::rayTestSingle(rayFrom, rayTo, const_cast<btCollisionObject *>(ray.pCandidate), ray.pCandidate->getCollisionShape(), ray.pCandidate->getWorldTransform(), collector);
+		collector.m_bCandidate = false;
+	}
+
+	pWorld->rayTest(ray.from, ray.to, collector);
+}
+
+// Main thread: runs the hits in front of the candidate through the game's filter and picks the result
+void CVehicleRaycaster::ResolveRay(wheelray_t &ray) {
+	const btCollisionObject *pObject = NULL;
+	btScalar fraction = 1;
+	btVector3 normal(0, 0, 0);
+	btVector3 point(0, 0, 0);
+
+	for (int i = 0; i < ray.numHits; i++) {
+		if (NeedsCollisionGame(ray.hits[i].pObject)) {
+			pObject = ray.hits[i].pObject;
+			fraction = ray.hits[i].fraction;
+			normal = ray.hits[i].normal;
+			point = ray.hits[i].point;
+			break;
+		}
+	}
+
+	if (!pObject) {
+		if (ray.overflow) {
+			// Everything we kept got filtered out, but there were more hits. Do it the slow way.
+			ray.pHit = ray.pShape ? SweepDirect(ray, ray.result) : CastRayDirect(ray.from, ray.to, ray.result);
+			ray.valid = true;
+			return;
+		}
+
+		if (ray.candidateFraction < 1) {
+			pObject = ray.pCandidate;
+			fraction = ray.candidateFraction;
+			normal = ray.candidateNormal;
+			point = ray.candidatePoint;
+		}
+	}
+
+	ray.pHit = pObject ? AcceptHit(pObject) : NULL;
+	if (ray.pHit) {
+		ray.result.m_hitPointInWorld = point;
+		ray.result.m_hitNormalInWorld = normal;
+		ray.result.m_hitNormalInWorld.normalize();
+		ray.result.m_distFraction = fraction;
+	}
+
+	ray.valid = true;
+}
+
+// Purpose: This raycaster will cast a ray ignoring the vehicle's body.
+class CCarRaycaster : public CVehicleRaycaster {
+	public:
+		CCarRaycaster(btDynamicsWorld *pWorld, CPhysicsVehicleController *pController) : CVehicleRaycaster(pWorld, pController->GetBody()->GetObject()) {
+			m_pController = pController;
+			m_rayFlags = btTriangleRaycastCallback::kF_UseSubSimplexConvexCastRaytest; // GJK has an issue of going through triangles
+		}
+
+		bool NeedsCollisionFast(const btBroadphaseProxy *proxy0) const {
+			const btCollisionObject *pObject = (const btCollisionObject *)proxy0->m_clientObject;
+			if (pObject == m_pBody)
+				return false;
+
+			const CPhysicsObject *pPhys = (const CPhysicsObject *)pObject->getUserPointer();
+			if (pPhys && !pPhys->IsCollisionEnabled())
+				return false;
+
+			return DefaultRayFilter(proxy0);
+		}
+
+	protected:
+		const btRigidBody *CastRayDirect(const btVector3 &from, const btVector3 &to, btVehicleRaycasterResult &result) const {
+			CIgnoreObjectRayResultCallback rayCallback(m_pBody, from, to);
+			rayCallback.m_flags |= m_rayFlags;
 			
 			m_pWorld->rayTest(from, to, rayCallback);
 			
 			if (rayCallback.hasHit()) {
-				const btRigidBody *body = btRigidBody::upcast(rayCallback.m_collisionObject);
-				if (body && body->hasContactResponse()) {
+				const btRigidBody *body = AcceptHit(rayCallback.m_collisionObject);
+				if (body) {
 					result.m_hitPointInWorld = rayCallback.m_hitPointWorld;
 					result.m_hitNormalInWorld = rayCallback.m_hitNormalWorld;
 					result.m_hitNormalInWorld.normalize();
 					result.m_distFraction = rayCallback.m_closestHitFraction;
-					return (void *)body;
+					return body;
 				}
 			}
 
 			return NULL;
 		}
 
+		bool NeedsCollisionGame(const btCollisionObject *pObject) const {
+			CPhysicsObject *pChassis = m_pController->GetBody();
+			return pChassis->GetVPhysicsEnvironment()->GetCollisionSolver()->NeedsCollision(pChassis, (CPhysicsObject *)pObject->getUserPointer());
+		}
+
+		const btRigidBody *AcceptHit(const btCollisionObject *pObject) const {
+			const btRigidBody *body = btRigidBody::upcast(pObject);
+			return body && body->hasContactResponse() ? body : NULL;
+		}
+
 	private:
-		btDynamicsWorld *			m_pWorld;
 		CPhysicsVehicleController *	m_pController;
 };
 
 // Purpose: Airboat raycaster
 // DEPRECATED: To be replaced...
-class CAirboatRaycaster : public btVehicleRaycaster {
+class CAirboatRaycaster : public CVehicleRaycaster {
 	public:
-		CAirboatRaycaster(btDynamicsWorld *pWorld, btRigidBody *pBody) {
-			m_pWorld = pWorld;
-			m_pBody = pBody;
+		CAirboatRaycaster(btDynamicsWorld *pWorld, btRigidBody *pBody) : CVehicleRaycaster(pWorld, pBody) {
 		}
 
+		// Same as CDetectWaterRayResultCallback
+		bool NeedsCollisionFast(const btBroadphaseProxy *proxy0) const {
+			const btCollisionObject *pObject = (const btCollisionObject *)proxy0->m_clientObject;
+			if (pObject == m_pBody)
+				return false;
+
+			const CPhysicsObject *pPhys = (const CPhysicsObject *)pObject->getUserPointer();
+			if (pPhys && (pPhys->GetCallbackFlags() & CALLBACK_FLUID_TOUCH || pPhys->GetContents() & MASK_WATER))
+				return true;
+
+			return DefaultRayFilter(proxy0);
+		}
+
+	protected:
 		// Returns the rigid body the ray hits
-		void *castRay(btWheelInfo *wheel, const btVector3 &from, const btVector3 &to, btVehicleRaycasterResult &result) {
+		const btRigidBody *CastRayDirect(const btVector3 &from, const btVector3 &to, btVehicleRaycasterResult &result) const {
 			CDetectWaterRayResultCallback rayCallback(m_pBody, from, to);
 
 			m_pWorld->rayTest(from, to, rayCallback);
 
 			if (rayCallback.hasHit()) {
-				const btRigidBody *body = btRigidBody::upcast(rayCallback.m_collisionObject);
+				const btRigidBody *body = AcceptHit(rayCallback.m_collisionObject);
 				if (body) {
 					result.m_hitPointInWorld = rayCallback.m_hitPointWorld;
 					result.m_hitNormalInWorld = rayCallback.m_hitNormalWorld;
 					result.m_hitNormalInWorld.normalize();
 					result.m_distFraction = rayCallback.m_closestHitFraction;
-					return (void *)body;
+					return body;
 				}
 			}
 
 			return NULL;
 		}
 
+		const btRigidBody *AcceptHit(const btCollisionObject *pObject) const {
+			return btRigidBody::upcast(pObject);
+		}
+};
+
+// Purpose: Raycast vehicle that updates in parallel with the other vehicles when it can
+class CRaycastVehicle : public btRaycastVehicle, public IParallelAction {
+	public:
+		CRaycastVehicle(const btVehicleTuning &tuning, btRigidBody *pChassis, CVehicleRaycaster *pRaycaster)
+		: btRaycastVehicle(tuning, pChassis, pRaycaster) {
+			m_pRaycaster = pRaycaster;
+		}
+
+		bool IsParallelSafe() const {
+			return m_pRaycaster->CanUpdateInParallel();
+		}
+
+		void PrepareParallelUpdate() {
+			m_pRaycaster->SetParallelUpdate(true);
+		}
+
+		void updateAction(btCollisionWorld *pWorld, btScalar dt) {
+			btRaycastVehicle::updateAction(pWorld, dt);
+			m_pRaycaster->SetParallelUpdate(false);
+		}
+
 	private:
-		btDynamicsWorld *	m_pWorld;
-		btRigidBody *		m_pBody;
+		CVehicleRaycaster *	m_pRaycaster;
 };
 
+/*********************************
+* CLASS CVehicleRaycastBatch
+*********************************/
+
+class CWheelRayLoop : public btIParallelForBody {
+	public:
+		CWheelRayLoop(const btCollisionWorld *pWorld, wheelray_t *const *ppRays)
+			: m_pWorld(pWorld), m_ppRays(ppRays) {
+		}
+
+		void forLoop(int iBegin, int iEnd) const override {
+			for (int i = iBegin; i < iEnd; i++)
+				m_ppRays[i]->pRaycaster->CastBatchRay(m_pWorld, *m_ppRays[i]);
+		}
+
+	private:
+		const btCollisionWorld *	m_pWorld;
+		wheelray_t *const *			m_ppRays;
+};
+
+CVehicleRaycastBatch::CVehicleRaycastBatch(CPhysicsEnvironment *pEnv) {
+	m_pEnv = pEnv;
+}
+
+void CVehicleRaycastBatch::AddRaycaster(CVehicleRaycaster *pRaycaster) {
+	m_raycasters.AddToTail(pRaycaster);
+}
+
+void CVehicleRaycastBatch::RemoveRaycaster(CVehicleRaycaster *pRaycaster) {
+	m_raycasters.FindAndRemove(pRaycaster);
+}
+
+void CVehicleRaycastBatch::ObjectRemoved(CPhysicsObject *pObject) {
+	for (int i = 0; i < m_raycasters.Count(); i++)
+		m_raycasters[i]->ObjectRemoved(pObject->GetObject());
+}
+
+void CVehicleRaycastBatch::updateAction(btCollisionWorld *pWorld, btScalar dt) {
+	m_rays.RemoveAll();
+	if (!cvar_vehicle_batchraycasts.GetBool())
+		return;
+
+	for (int i = 0; i < m_raycasters.Count(); i++)
+		m_raycasters[i]->GatherRays(m_rays);
+
+	if (m_rays.Count() == 0)
+		return;
+
+	CWheelRayLoop loop(pWorld, m_rays.Base());
+	btParallelFor(0, m_rays.Count(), VEHICLE_RAY_GRAIN_SIZE, loop);
+
+	for (int i = 0; i < m_rays.Count(); i++)
+		m_rays[i]->pRaycaster->ResolveRay(*m_rays[i]);
+}
+
 /*********************************
 * CLASS CPhysicsVehicleController
 *********************************/
@@ -219,8 +855,11 @@ void CPhysicsVehicleController::InitBullVehicle() {
 	else
 		Assert(0);
 
-	m_pVehicle = new btRaycastVehicle(m_tuning, m_pBody->GetObject(), m_pRaycaster);
+	m_pVehicle = new CRaycastVehicle(m_tuning, m_pBody->GetObject(), m_pRaycaster);
 	m_pVehicle->setCoordinateSystem(0, 1, 2);
+
+	m_pRaycaster->SetVehicle(m_pVehicle);
+	m_pEnv->GetVehicleRaycastBatch()->AddRaycaster(m_pRaycaster);
 #else
 	m_pVehicle = new btWheeledVehicle(m_pEnv->GetBulletEnvironment(), m_pBody->GetObject());
 #endif
@@ -238,6 +877,7 @@ void CPhysicsVehicleController::ShutdownBullVehicle() {
 	delete m_pVehicle;
 #else
 	delete m_pVehicle;
+	m_pEnv->GetVehicleRaycastBatch()->RemoveRaycaster(m_pRaycaster);
 	delete m_pRaycaster;
 #endif
 
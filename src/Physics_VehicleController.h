@@ -12,6 +12,8 @@ class CPhysicsObject;
 class CPhysicsEnvironment;
 
 struct btVehicleRaycaster;
+class CVehicleRaycaster;
+struct wheelray_t;
 class btRaycastVehicle;
 class btWheeledVehicle;
 
@@ -105,11 +107,30 @@ class CPhysicsVehicleController : public IPhysicsVehicleController32 {
 		btWheeledVehicle *			m_pVehicle;
 #else
 		btRaycastVehicle *			m_pVehicle;
-		btVehicleRaycaster *		m_pRaycaster;
+		CVehicleRaycaster *			m_pRaycaster;
 		btRaycastVehicle::btVehicleTuning	m_tuning;
 #endif
 };
 
+// Purpose: Casts the wheel rays of all the vehicles in an environment as one parallel batch, once per simulation step.
+// Added to the world before any vehicle so it runs first, the vehicles' raycasters then hand out its results.
+class CVehicleRaycastBatch : public btActionInterface {
+	public:
+		CVehicleRaycastBatch(CPhysicsEnvironment *pEnv);
+
+		void								AddRaycaster(CVehicleRaycaster *pRaycaster);
+		void								RemoveRaycaster(CVehicleRaycaster *pRaycaster);
+		void								ObjectRemoved(CPhysicsObject *pObject);
+
+		void								updateAction(btCollisionWorld *pWorld, btScalar dt) override;
+		void								debugDraw(btIDebugDraw *pDebugDrawer) override {}
+
+	private:
+		CPhysicsEnvironment *				m_pEnv;
+		CUtlVector<CVehicleRaycaster *>		m_raycasters;
+		CUtlVector<wheelray_t *>			m_rays;		// This step's rays
+};
+
 IPhysicsVehicleController *CreateVehicleController(CPhysicsEnvironment *pEnv, CPhysicsObject *pBody, const vehicleparams_t &params, unsigned int nVehicleType, IPhysicsGameTrace *pGameTrace);
 
 #endif // PHYSICS_VEHICLECONTROLLER_H
@@ -0,0 +1,198 @@
+#include "StdAfx.h"
+
+#include "Physics_WakeQueue.h"
+#include "Physics_Environment.h"
+#include "Physics_Object.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar cvar_wake_budget("bt_wake_budget", "256", FCVAR_REPLICATED, "Maximum number of sleeping objects that can wake up in a single tick, the rest are woken up over the next ticks (0 = unlimited)", true, 0, false, 0);
+
+/*******************************
+* CLASS CWakeQueue
+*******************************/
+
+CWakeQueue::CWakeQueue(CPhysicsEnvironment *pEnv) {
+	m_pEnv = pEnv;
+	m_numWoken = 0;
+}
+
+int CWakeQueue::CompareAwakeIslands(const awakeisland_t *a, const awakeisland_t *b) {
+	return a->islandTag - b->islandTag;
+}
+
+// Lowest priority first
+int CWakeQueue::CompareEntries(const wakeentry_t *a, const wakeentry_t *b) {
+	if (a->priority != b->priority)
+		return a->priority < b->priority ? -1 : 1;
+
+	return 0;
+}
+
+void CWakeQueue::PreTick() {
+	m_numWoken = 0;
+
+	const int budget = cvar_wake_budget.GetInt();
+	while (m_queue.Count() > 0 && (budget <= 0 || m_numWoken < budget)) {
+		const wakeentry_t entry = m_queue.Tail();
+		m_queue.RemoveMultipleFromTail(1);
+
+		// Woken up by the game in the meantime
+		wakestate_t &wake = entry.pObject->GetWakeState();
+		if (!wake.deferred)
+			continue;
+
+		wake.deferred = false;
+
+		btRigidBody *pBody = entry.pObject->GetObject();
+		pBody->activate(true);
+		m_numWoken++;
+	}
+}
+
+const CWakeQueue::awakeisland_t *CWakeQueue::FindAwakeIsland(int islandTag) const {
+	int lo = 0, hi = m_awakeIslands.Count() - 1;
+	while (lo <= hi) {
+		const int mid = (lo + hi) / 2;
+		if (m_awakeIslands[mid].islandTag == islandTag)
+			return &m_awakeIslands[mid];
+
+		if (m_awakeIslands[mid].islandTag < islandTag)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return NULL;
+}
+
+void CWakeQueue::IslandsCalculated(btCollisionWorld *pWorld) {
+	btCollisionObjectArray &colObjArray = pWorld->getCollisionObjectArray();
+
+	// The islands that are awake, the solver wakes up every sleeping object in them
+	m_awakeIslands.RemoveAll();
+	for (int i = 0; i < colObjArray.size(); i++) {
+		const btCollisionObject *pColObj = colObjArray[i];
+		const int state = pColObj->getActivationState();
+		if (pColObj->getIslandTag() < 0 || (state != ACTIVE_TAG && state != DISABLE_DEACTIVATION))
+			continue;
+
+		const btRigidBody *pBody = btRigidBody::upcast(pColObj);
+		const btScalar speedSqr = pBody ? pBody->getLinearVelocity().length2() : 0;
+
+		awakeisland_t &island = m_awakeIslands[m_awakeIslands.AddToTail()];
+		island.islandTag = pColObj->getIslandTag();
+		island.maxSpeedSqr = speedSqr;
+	}
+
+	if (m_awakeIslands.Count() == 0)
+		return;
+
+	m_awakeIslands.Sort(CompareAwakeIslands);
+
+	// Merge the duplicates, keeping the fastest object
+	int numIslands = 0;
+	for (int i = 0; i < m_awakeIslands.Count(); i++) {
+		if (numIslands > 0 && m_awakeIslands[numIslands - 1].islandTag == m_awakeIslands[i].islandTag) {
+			m_awakeIslands[numIslands - 1].maxSpeedSqr = btMax(m_awakeIslands[numIslands - 1].maxSpeedSqr, m_awakeIslands[i].maxSpeedSqr);
+		} else {
+			m_awakeIslands[numIslands++] = m_awakeIslands[i];
+		}
+	}
+
+	m_awakeIslands.SetCountNonDestructively(numIslands);
+
+	// Sleeping objects about to be woken up
+	m_candidates.RemoveAll();
+	for (int i = 0; i < colObjArray.size(); i++) {
+		btCollisionObject *pColObj = colObjArray[i];
+		if (pColObj->getActivationState() != ISLAND_SLEEPING || pColObj->getIslandTag() < 0)
+			continue;
+
+		CPhysicsObject *pObject = static_cast<CPhysicsObject *>(pColObj->getUserPointer());
+		if (!pObject) continue;
+
+		// Objects held by the simulation LOD aren't really asleep
+		if (pObject->GetLodState().held || pObject->GetCallbackFlags() & CALLBACK_MARKED_FOR_DELETE)
+			continue;
+
+		const awakeisland_t *pIsland = FindAwakeIsland(pColObj->getIslandTag());
+		if (!pIsland)
+			continue;
+
+		// Already waiting for its turn
+		if (pObject->GetWakeState().deferred) {
+			HoldObject(pObject);
+			continue;
+		}
+
+		wakeentry_t &entry = m_candidates[m_candidates.AddToTail()];
+		entry.pObject = pObject;
+		entry.priority = pIsland->maxSpeedSqr; // Whatever is about to hit us is this fast
+	}
+
+	const int budget = cvar_wake_budget.GetInt();
+	if (budget <= 0 || m_numWoken + m_candidates.Count() <= budget) {
+		m_numWoken += m_candidates.Count();
+		return;
+	}
+
+	// Wake up the objects touched by the fastest objects, the rest stay asleep until we have budget for them
+	m_candidates.Sort(CompareEntries);
+
+	const int numWake = max(budget - m_numWoken, 0);
+	for (int i = 0; i < m_candidates.Count() - numWake; i++) {
+		const wakeentry_t &entry = m_candidates[i];
+		entry.pObject->GetWakeState().deferred = true;
+		HoldObject(entry.pObject);
+		m_queue.AddToTail(entry);
+	}
+
+	m_numWoken += numWake;
+	m_queue.Sort(CompareEntries);
+}
+
+// Taking a deferred object out of its island keeps the solver from waking it up. Its contacts with the awake
+// objects still get solved, so it's also made static for the solve: it can't be pushed around or pick up velocity
+// while it isn't integrated.
+void CWakeQueue::HoldObject(CPhysicsObject *pObject) {
+	btRigidBody *pBody = pObject->GetObject();
+	pBody->setIslandTag(-1);
+
+	heldobject_t held;
+	held.pObject = pObject;
+	held.invInertiaLocal = pBody->getInvInertiaDiagLocal();
+	m_held.push_back(held);
+
+	pBody->setMassProps(0, btVector3(0, 0, 0));
+	pBody->updateInertiaTensor();
+}
+
+void CWakeQueue::ConstraintsSolved() {
+	for (int i = 0; i < m_held.size(); i++) {
+		btRigidBody *pBody = m_held[i].pObject->GetObject();
+		pBody->setMassProps(m_held[i].pObject->GetMass(), btVector3(0, 0, 0));
+		pBody->setInvInertiaDiagLocal(m_held[i].invInertiaLocal);
+		pBody->updateInertiaTensor();
+	}
+
+	m_held.resize(0);
+}
+
+void CWakeQueue::ObjectRemoved(CPhysicsObject *pObject) {
+	wakestate_t &wake = pObject->GetWakeState();
+	if (!wake.deferred)
+		return;
+
+	// It's still a plain sleeping object, just stop tracking it
+	wake.deferred = false;
+
+	for (int i = 0; i < m_queue.Count(); i++) {
+		if (m_queue[i].pObject == pObject) {
+			// Keep the order
+			m_queue.Remove(i);
+			break;
+		}
+	}
+}
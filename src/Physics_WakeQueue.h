@@ -0,0 +1,91 @@
+#ifndef PHYSICS_WAKEQUEUE_H
+#define PHYSICS_WAKEQUEUE_H
+#if defined(_MSC_VER) || (defined(__GNUC__) && __GNUC__ > 3)
+	#pragma once
+#endif
+
+class CPhysicsEnvironment;
+class CPhysicsObject;
+
+// Purpose: Limits the amount of sleeping objects that can wake up in a single tick.
+// An explosion or a collapsing structure can wake thousands of objects through island activation,
+// objects over the budget are kept asleep and woken up over the next ticks (the objects touched by
+// the fastest objects first). This happens before the solver, so the budget bounds the tick that woke them.
+class CWakeQueue {
+	public:
+		CWakeQueue(CPhysicsEnvironment *pEnv);
+
+		// Called before each simulation tick, wakes up queued objects while there's budget left
+		void						PreTick();
+
+		// Called once the simulation islands are known, before the solver wakes up sleeping objects in awake islands
+		void						IslandsCalculated(btCollisionWorld *pWorld);
+
+		// Called once the solver is done, gives the objects held static for the solve their mass back
+		void						ConstraintsSolved();
+
+		void						ObjectRemoved(CPhysicsObject *pObject);
+		int							GetQueuedCount() const { return m_queue.Count(); }
+
+	private:
+		struct wakeentry_t {
+			CPhysicsObject *		pObject;
+			btScalar				priority;
+		};
+
+		struct heldobject_t {
+			CPhysicsObject *		pObject;
+			btVector3				invInertiaLocal;
+		};
+
+		struct awakeisland_t {
+			int						islandTag;
+			btScalar				maxSpeedSqr;	// Fastest object in the island
+		};
+
+		static int					CompareAwakeIslands(const awakeisland_t *a, const awakeisland_t *b);
+		static int					CompareEntries(const wakeentry_t *a, const wakeentry_t *b);
+		const awakeisland_t *		FindAwakeIsland(int islandTag) const;
+		void						HoldObject(CPhysicsObject *pObject);
+
+		CPhysicsEnvironment *		m_pEnv;
+		CUtlVector<wakeentry_t>		m_queue;			// Sorted by priority, highest last
+		CUtlVector<wakeentry_t>		m_candidates;		// Objects the solver would wake up in this tick
+		CUtlVector<awakeisland_t>	m_awakeIslands;		// Sorted by island tag
+		btAlignedObjectArray<heldobject_t> m_held;		// Deferred objects made static for this solve
+		int							m_numWoken;			// Objects woken up in this tick
+};
+
+// Purpose: Dynamics world that lets the wake queue look at the simulation islands before they're solved,
+// and clean up after the solve.
+template <class T>
+class CWakeBudgetWorld : public T {
+	public:
+		template <class A, class B, class C, class D>
+		CWakeBudgetWorld(A a, B b, C c, D d) : T(a, b, c, d), m_pWakeQueue(NULL) {}
+
+		template <class A, class B, class C, class D, class E>
+		CWakeBudgetWorld(A a, B b, C c, D d, E e) : T(a, b, c, d, e), m_pWakeQueue(NULL) {}
+
+		void SetWakeQueue(CWakeQueue *pWakeQueue) { m_pWakeQueue = pWakeQueue; }
+
+	protected:
+		void calculateSimulationIslands() override {
+			T::calculateSimulationIslands();
+
+			if (m_pWakeQueue)
+				m_pWakeQueue->IslandsCalculated(this);
+		}
+
+		void solveConstraints(btContactSolverInfo &solverInfo) override {
+			T::solveConstraints(solverInfo);
+
+			if (m_pWakeQueue)
+				m_pWakeQueue->ConstraintsSolved();
+		}
+
+	private:
+		CWakeQueue *				m_pWakeQueue;
+};
+
+#endif // PHYSICS_WAKEQUEUE_H